@@ -0,0 +1,102 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "../src/kernels.h"
+
+/*
+** Times the gather and scatter kernels at every level the
+** processor supports, for 4 and 8 byte elements with random and
+** sequential indices. Sources are larger than the last level
+** cache. The library stays at the generic level unless this
+** shows a vector kernel ahead on the machine at hand.
+**
+**    kernels_bench [n_idxs [n_src [n_reps]]]
+*/
+
+double
+now( void )
+{
+   struct timespec ts;
+
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+double
+best_time( int scatter,
+           unsigned n,
+           unsigned const* idxs,
+           size_t elem_size,
+           void* src,
+           void* dst,
+           int n_reps )
+{
+   double best = 1e30, start;
+   int rr;
+
+   for( rr = 0; rr < n_reps; ++rr )
+   {
+      start = now();
+      if( scatter )
+         kernel_scatter( n, idxs, elem_size, src, dst );
+      else
+         kernel_gather( n, idxs, elem_size, src, dst );
+      start = now() - start;
+      if( start < best )
+         best = start;
+   }
+   return best;
+}
+
+int
+main( int argc,
+      char** argv )
+{
+   unsigned n_idxs = (argc > 1) ? atoi( argv[1] ) : (1 << 24);
+   unsigned n_src = (argc > 2) ? atoi( argv[2] ) : (1 << 25);
+   int n_reps = (argc > 3) ? atoi( argv[3] ) : 5;
+   unsigned *idxs, ii;
+   char *big, *small;
+   size_t sizes[] = { 4, 8 };
+   int max_level, level, pattern, ss, op;
+
+   /* Scatters write into the large array, so the index range is
+      the same for both. */
+   idxs = (unsigned*)malloc( sizeof(unsigned)*n_idxs );
+   big = (char*)malloc( 8*(size_t)n_src );
+   small = (char*)malloc( 8*(size_t)n_idxs );
+   memset( big, 1, 8*(size_t)n_src );
+   memset( small, 1, 8*(size_t)n_idxs );
+
+   max_level = kernels_max_level();
+   printf( "%-8s %-7s %-4s %-10s %s\n", "op", "level", "size", "indices", "seconds" );
+   for( pattern = 0; pattern < 2; ++pattern )
+   {
+      srand( 1 );
+      for( ii = 0; ii < n_idxs; ++ii )
+         idxs[ii] = pattern ? (unsigned)(((size_t)ii*n_src)/n_idxs) : (unsigned)(rand()%n_src);
+      for( op = 0; op < 2; ++op )
+      {
+         for( ss = 0; ss < 2; ++ss )
+         {
+            for( level = 0; level <= max_level; ++level )
+            {
+               double secs;
+
+               kernels_set_level( level );
+               secs = op ? best_time( 1, n_idxs, idxs, sizes[ss], small, big, n_reps )
+                         : best_time( 0, n_idxs, idxs, sizes[ss], big, small, n_reps );
+               printf( "%-8s %-7s %-4d %-10s %.4f\n", op ? "scatter" : "gather", kernels_level_name( level ),
+                       (int)sizes[ss], pattern ? "sequential" : "random", secs );
+            }
+         }
+      }
+   }
+   kernels_set_level( KERNELS_GENERIC );
+
+   free( idxs );
+   free( big );
+   free( small );
+   return EXIT_SUCCESS;
+}
@@ -11,6 +11,9 @@
 **  3. Load the mapping of halos to galaxies. Permute the 2D array of
 **     particle IDs as associated to halos into galaxy order.
 **
+** The two permutations are recorded in a lazy permutation and
+** composed, so the particle IDs only cross the network once.
+**
 ** @author Luke Hodkinson, 2014
 */
 
@@ -19,6 +22,7 @@
 #include <argp.h>
 #include <mpi.h>
 #include "../src/load.h"
+#include "../src/lazy_perm.h"
 #include "../src/utils.h"
 
 struct arguments
@@ -102,6 +106,7 @@ main( int argc,
    unsigned n_local_idxs, *local_idxs;
    unsigned n_elems;
    file_loader_t fl;
+   lazy_perm_t lp;
    char fn[1000];
    FILE* file;
    int ii, jj, kk;
@@ -237,14 +242,18 @@ main( int argc,
       halos_displs[ii + 1] = halos_displs[ii] + halos_data[2*ii + 1] - halos_data[2*ii];
    }
 
-   /* Call the permutation. */
-   permute( n_pids, n_local_idxs, local_idxs, &pids_data, MPI_UNSIGNED, MPI_COMM_WORLD );
+   /* Record the permutation. Nothing is moved yet, we only remember
+      which PID ends up where, grouped by halo. */
+   lazy_perm_init( &lp, n_pids, MPI_COMM_WORLD );
+   lazy_perm_permute( &lp, n_pids, n_local_idxs, local_idxs );
+   lazy_perm_set_rows( &lp, n_local_halos, halos_displs );
+   FREE( local_idxs );
+   FREE( halos_displs );
 
    /*
-    * At this point we have the sets of PIDs that are associated with the halos
-    * we loaded, in the order we loaded them, all available locally on each process.
-    * However, what we really want is to reorder the halos so that they are in
-    * galaxy order.
+    * At this point we know the sets of PIDs that are associated with the halos
+    * we loaded, in the order we loaded them. However, what we really want is
+    * to reorder the halos so that they are in galaxy order.
     */
 
    /* Load the halos that are associated with each galaxy. */
@@ -283,17 +292,24 @@ main( int argc,
    fl_free( &fl );
 
    /* The galaxy data is just the index for the halo it's associated with.
-      Now we can just perform a permute to place the PIDs associated with each
-      halo on the correct process. */
-   permutev( n_gals, &halos_displs, n_gals, gals_data, &halos_data, MPI_UNSIGNED, MPI_COMM_WORLD );
+      Compose a permute of the halos onto the recorded permutation, then
+      move the PIDs associated with each galaxy to the correct process in
+      a single step. */
+   lazy_perm_permutev( &lp, n_halos, n_local_gals, gals_data );
+   lazy_perm_apply( &lp, (void**)&pids_data, MPI_UNSIGNED );
+   FREE( gals_data );
 
    /*
     * Now we have the particle IDs associated with each galaxy loaded, and
     * ordered in galaxy order, and also distributed evenly across the ranks.
     * From here you could do a gatherall to get the particle IDs for each
     * galaxy on all the ranks. Ideally, in the future, you would perform
-    * an inversion of this information and create a distributed map.
+    * an inversion of this information and create a distributed map. The
+    * displacements of each galaxy's PIDs are in lazy_perm_displs( &lp ).
     */
+   lazy_perm_free( &lp );
+   FREE( pids_data );
+   FREE( halos_data );
 
    MPI_Finalize();
    return EXIT_SUCCESS;
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <mpi.h>
 #include "../utils.h"
+#include "../src/permute.h"
 
 int
 main( int argc,
@@ -9,8 +10,9 @@ main( int argc,
 {
    unsigned n_chunks, *chunks;
    unsigned n_files = 8, *n_file_elems;
-   unsigned n_elems = 0, *idxs, *data;
+   unsigned n_elems = 0, *data;
    unsigned n_local_elems, elem_offs;
+   perm_desc_t perm;
    char fn[1000];
    int rank, n_ranks;
    FILE* file;
@@ -54,11 +56,11 @@ main( int argc,
       }
    }
 
-   idxs = ALLOC( unsigned, n_local_elems );
-   for( ii = 0; ii < n_local_elems; ++ii )
-      idxs[ii] = (elem_offs + ii + 10)%n_elems;
+   /* A cyclic shift is known in closed form, so no index array
+      needs to be built or exchanged. */
+   perm_shift( &perm, n_elems, 10 );
 
-   permute( n_elems, n_local_elems, idxs, data, MPI_UNSIGNED, MPI_COMM_WORLD );
+   permute_analytic( &perm, (void**)&data, MPI_UNSIGNED, MPI_COMM_WORLD );
 
    {
       unsigned *all_sizes, *all_data, *all_displs;
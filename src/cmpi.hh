@@ -0,0 +1,540 @@
+/*!
+** @file
+** @author Luke Hodkinson, 2014
+**
+** Typed C++ interface to the scatter routines. Header only, and
+** needs C++17. Elements are packed and unpacked by loops
+** compiled for their type and moved as bytes, results are
+** returned in owning buffers, and outputs may instead be
+** provided by the caller. Element types are named explicitly,
+** as in cmpi::scatter<double>( ... ).
+*/
+
+#ifndef cmpi_hh
+#define cmpi_hh
+
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <mpi.h>
+#include "permute.h"
+#include "utils.h"
+
+namespace cmpi {
+
+/*!
+** MPI datatype of an element type. Types without an MPI
+** equivalent are sent as opaque bytes, which is enough for
+** any trivially copyable type on a homogeneous machine.
+*/
+template< class T >
+MPI_Datatype
+datatype()
+{
+   static_assert( std::is_trivially_copyable<T>::value, "elements must be trivially copyable" );
+
+   if constexpr( std::is_same<T, char>::value )
+      return MPI_CHAR;
+   else if constexpr( std::is_same<T, signed char>::value )
+      return MPI_SIGNED_CHAR;
+   else if constexpr( std::is_same<T, unsigned char>::value )
+      return MPI_UNSIGNED_CHAR;
+   else if constexpr( std::is_same<T, short>::value )
+      return MPI_SHORT;
+   else if constexpr( std::is_same<T, unsigned short>::value )
+      return MPI_UNSIGNED_SHORT;
+   else if constexpr( std::is_same<T, int>::value )
+      return MPI_INT;
+   else if constexpr( std::is_same<T, unsigned>::value )
+      return MPI_UNSIGNED;
+   else if constexpr( std::is_same<T, long>::value )
+      return MPI_LONG;
+   else if constexpr( std::is_same<T, unsigned long>::value )
+      return MPI_UNSIGNED_LONG;
+   else if constexpr( std::is_same<T, long long>::value )
+      return MPI_LONG_LONG;
+   else if constexpr( std::is_same<T, unsigned long long>::value )
+      return MPI_UNSIGNED_LONG_LONG;
+   else if constexpr( std::is_same<T, float>::value )
+      return MPI_FLOAT;
+   else if constexpr( std::is_same<T, double>::value )
+      return MPI_DOUBLE;
+   else if constexpr( std::is_same<T, long double>::value )
+      return MPI_LONG_DOUBLE;
+   else
+   {
+      // Created on first use and kept for the life of the program.
+      static MPI_Datatype type = []{
+         MPI_Datatype bytes;
+         MPI_OK( MPI_Type_contiguous( sizeof(T), MPI_BYTE, &bytes ) );
+         MPI_OK( MPI_Type_commit( &bytes ) );
+         return bytes;
+      }();
+      return type;
+   }
+}
+
+/*!
+** A non-owning view of contiguous elements. Converts from
+** anything with data() and size(), such as std::vector,
+** std::array, std::span and buffer.
+*/
+template< class T >
+class span
+{
+public:
+
+   span()
+      : _ptr( nullptr ),
+        _size( 0 )
+   {
+   }
+
+   span( T* ptr,
+         std::size_t size )
+      : _ptr( ptr ),
+        _size( size )
+   {
+   }
+
+   template< std::size_t N >
+   span( T (&arr)[N] )
+      : _ptr( arr ),
+        _size( N )
+   {
+   }
+
+   template< class C,
+             class = typename std::enable_if<
+                std::is_convertible<decltype( std::declval<C&>().data() ), T*>::value>::type >
+   span( C&& cont )
+      : _ptr( cont.data() ),
+        _size( cont.size() )
+   {
+   }
+
+   T*
+   data() const
+   {
+      return _ptr;
+   }
+
+   std::size_t
+   size() const
+   {
+      return _size;
+   }
+
+   bool
+   empty() const
+   {
+      return !_size;
+   }
+
+   T&
+   operator[]( std::size_t idx ) const
+   {
+      return _ptr[idx];
+   }
+
+   T*
+   begin() const
+   {
+      return _ptr;
+   }
+
+   T*
+   end() const
+   {
+      return _ptr + _size;
+   }
+
+protected:
+
+   T*          _ptr;
+   std::size_t _size;
+};
+
+/*!
+** An owning array of elements, as returned by the library.
+** Move only. Memory comes from malloc, so a buffer may adopt
+** arrays allocated by the C interface and release them back.
+*/
+template< class T >
+class buffer
+{
+public:
+
+   static_assert( std::is_trivially_copyable<T>::value, "elements must be trivially copyable" );
+
+   buffer()
+      : _ptr( nullptr ),
+        _size( 0 )
+   {
+   }
+
+   explicit
+   buffer( std::size_t size )
+      : _ptr( (T*)std::malloc( sizeof(T)*size ) ),
+        _size( size )
+   {
+      if( size && !_ptr )
+         throw std::bad_alloc();
+   }
+
+   buffer( buffer const& ) = delete;
+
+   buffer( buffer&& src )
+      : _ptr( src._ptr ),
+        _size( src._size )
+   {
+      src._ptr = nullptr;
+      src._size = 0;
+   }
+
+   ~buffer()
+   {
+      std::free( _ptr );
+   }
+
+   buffer&
+   operator=( buffer const& ) = delete;
+
+   buffer&
+   operator=( buffer&& src )
+   {
+      std::swap( _ptr, src._ptr );
+      std::swap( _size, src._size );
+      return *this;
+   }
+
+   /*!
+   ** Take ownership of a malloc'd array.
+   */
+   static buffer
+   adopt( void* ptr,
+          std::size_t size )
+   {
+      buffer buf;
+      buf._ptr = (T*)ptr;
+      buf._size = size;
+      return buf;
+   }
+
+   /*!
+   ** Give up ownership of the array, to be freed with free.
+   */
+   T*
+   release()
+   {
+      T* ptr = _ptr;
+      _ptr = nullptr;
+      _size = 0;
+      return ptr;
+   }
+
+   T*
+   data()
+   {
+      return _ptr;
+   }
+
+   T const*
+   data() const
+   {
+      return _ptr;
+   }
+
+   std::size_t
+   size() const
+   {
+      return _size;
+   }
+
+   bool
+   empty() const
+   {
+      return !_size;
+   }
+
+   T&
+   operator[]( std::size_t idx )
+   {
+      return _ptr[idx];
+   }
+
+   T const&
+   operator[]( std::size_t idx ) const
+   {
+      return _ptr[idx];
+   }
+
+   T*
+   begin()
+   {
+      return _ptr;
+   }
+
+   T*
+   end()
+   {
+      return _ptr + _size;
+   }
+
+   T const*
+   begin() const
+   {
+      return _ptr;
+   }
+
+   T const*
+   end() const
+   {
+      return _ptr + _size;
+   }
+
+protected:
+
+   T*          _ptr;
+   std::size_t _size;
+};
+
+/*!
+** Local gather, out[i] = src[idxs[i]], as a copy loop compiled
+** for the element type.
+*/
+template< class T >
+void
+local_gather( span<unsigned const> idxs,
+              span<T const> src,
+              span<T> out )
+{
+   assert( out.size() >= idxs.size() );
+   for( std::size_t ii = 0; ii < idxs.size(); ++ii )
+      out[ii] = src[idxs[ii]];
+}
+
+/*!
+** Local scatter, out[idxs[i]] = src[i], as for local_gather.
+*/
+template< class T >
+void
+local_scatter( span<unsigned const> idxs,
+               span<T const> src,
+               span<T> out )
+{
+   assert( src.size() >= idxs.size() );
+   for( std::size_t ii = 0; ii < idxs.size(); ++ii )
+      out[idxs[ii]] = src[ii];
+}
+
+/*!
+** Selects the plan constructor for a plan used once.
+*/
+struct single_use_t
+{
+};
+inline constexpr single_use_t single_use{};
+
+/*!
+** A scatter plan that frees itself. Build once, then execute
+** for as many arrays as needed.
+*/
+class plan
+{
+public:
+
+   /*!
+   ** Build a plan. Must be called collectively.
+   */
+   plan( unsigned n_elems,
+         span<unsigned const> idxs,
+         MPI_Comm comm )
+   {
+      scatter_plan_init( &_plan, n_elems, idxs.size(), idxs.data(), comm );
+   }
+
+   /*!
+   ** Build a plan to be executed once, which skips duplicating
+   ** the communicator (see scatter_plan_init_shared). Must be
+   ** called collectively.
+   */
+   plan( unsigned n_elems,
+         span<unsigned const> idxs,
+         MPI_Comm comm,
+         single_use_t )
+   {
+      scatter_plan_init_shared( &_plan, n_elems, idxs.size(), idxs.data(), comm );
+   }
+
+   plan( plan const& ) = delete;
+
+   plan&
+   operator=( plan const& ) = delete;
+
+   ~plan()
+   {
+      scatter_plan_free( &_plan );
+   }
+
+   /*!
+   ** Number of elements each execution delivers.
+   */
+   std::size_t
+   size() const
+   {
+      return _plan.n_idxs;
+   }
+
+   /*!
+   ** Scatter into a caller provided output. Outgoing elements
+   ** are gathered into a contiguous buffer, sent as bytes in one
+   ** exchange, and scattered into place on arrival. Must be
+   ** called collectively.
+   */
+   template< class T >
+   void
+   execute( span<T const> data,
+            span<T> out ) const
+   {
+      static_assert( std::is_trivially_copyable<T>::value, "elements must be trivially copyable" );
+
+      int n_ranks = _plan.n_ranks;
+      std::size_t n_out = _plan.out_displs[n_ranks - 1] + _plan.out_cnts[n_ranks - 1];
+      buffer<int> counts( 4*n_ranks );
+      int* out_bytes = counts.data();
+      int* out_offs = out_bytes + n_ranks;
+      int* inc_bytes = out_offs + n_ranks;
+      int* inc_offs = inc_bytes + n_ranks;
+
+      assert( out.size() >= size() );
+      assert( sizeof(T)*std::max( n_out, size() ) <= INT_MAX );
+      for( int rr = 0; rr < n_ranks; ++rr )
+      {
+         out_bytes[rr] = sizeof(T)*_plan.out_cnts[rr];
+         out_offs[rr] = sizeof(T)*_plan.out_displs[rr];
+         inc_bytes[rr] = sizeof(T)*_plan.req_cnts[rr];
+         inc_offs[rr] = sizeof(T)*_plan.req_displs[rr];
+      }
+
+      buffer<T> packed( n_out );
+      buffer<T> inc( size() );
+      local_gather<T>( span<unsigned const>( _plan.out_idxs, n_out ), data, packed );
+      MPI_OK( MPI_Alltoallv( packed.data(), out_bytes, out_offs, MPI_BYTE,
+                             inc.data(), inc_bytes, inc_offs, MPI_BYTE, _plan.comm ) );
+      local_scatter<T>( span<unsigned const>( _plan.local, size() ), inc, out );
+   }
+
+   /*!
+   ** Scatter into a new buffer. Must be called collectively.
+   */
+   template< class T >
+   buffer<T>
+   execute( span<T const> data ) const
+   {
+      buffer<T> out( size() );
+      execute<T>( data, out );
+      return out;
+   }
+
+   scatter_plan_t const*
+   get() const
+   {
+      return &_plan;
+   }
+
+protected:
+
+   scatter_plan_t _plan;
+};
+
+/*!
+** Scatter typed elements, returning the requested elements in
+** index order. Must be called collectively.
+*/
+template< class T >
+buffer<T>
+scatter( unsigned n_elems,
+         span<unsigned const> idxs,
+         span<T const> data,
+         MPI_Comm comm )
+{
+   return plan( n_elems, idxs, comm, single_use ).execute<T>( data );
+}
+
+/*!
+** Scatter typed elements into a caller provided output, which
+** saves an allocation when the output is reused. Must be
+** called collectively.
+*/
+template< class T >
+void
+scatter( unsigned n_elems,
+         span<unsigned const> idxs,
+         span<T const> data,
+         span<T> out,
+         MPI_Comm comm )
+{
+   plan( n_elems, idxs, comm, single_use ).execute<T>( data, out );
+}
+
+template< class T,
+          class Out,
+          class F >
+void
+_transform_thunk( void const* elem,
+                  void* out,
+                  void* ctx )
+{
+   T in;
+   std::memcpy( &in, elem, sizeof(T) );
+   Out res = (*(F*)ctx)( in );
+   std::memcpy( out, &res, sizeof(Out) );
+}
+
+/*!
+** Element type of a container with data() and size().
+*/
+template< class C >
+using elem_t = typename std::remove_const<
+   typename std::remove_pointer<decltype( std::declval<C const&>().data() )>::type>::type;
+
+/*!
+** Scatter typed elements through a function object, such as a
+** lambda, called on each element as it arrives. The result
+** type is given explicitly and the element type is that of the
+** data container, such as std::vector, buffer or span:
+** scatter_transform<float>( n_elems, idxs, vec, func, comm ).
+** Must be called collectively.
+*/
+template< class Out,
+          class C,
+          class F >
+buffer<Out>
+scatter_transform( unsigned n_elems,
+                   span<unsigned const> idxs,
+                   C const& cont,
+                   F func,
+                   MPI_Comm comm )
+{
+   static_assert( std::is_trivially_copyable<Out>::value, "results must be trivially copyable" );
+
+   using T = elem_t<C>;
+   span<T const> data( cont.data(), cont.size() );
+   plan pl( n_elems, idxs, comm, single_use );
+   buffer<Out> out( pl.size() );
+   scatter_plan_execute_transform( pl.get(), data.data(), out.data(), datatype<T>(), sizeof(Out),
+                                   _transform_thunk<T, Out, F>, &func );
+   return out;
+}
+
+}
+
+#endif
@@ -0,0 +1,461 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include "fields.h"
+#include "permute.h"
+#include "kernels.h"
+#include "utils.h"
+
+void
+field_set_init( field_set_t* fs,
+                unsigned n_fields,
+                MPI_Aint const* offs,
+                MPI_Aint const* sizes )
+{
+   unsigned ii;
+
+   assert( fs );
+   assert( !n_fields || (offs && sizes) );
+
+   fs->n_fields = n_fields;
+   fs->offs = ALLOC( MPI_Aint, n_fields );
+   fs->sizes = ALLOC( MPI_Aint, n_fields );
+   fs->size = 0;
+   for( ii = 0; ii < n_fields; ++ii )
+   {
+      fs->offs[ii] = offs[ii];
+      fs->sizes[ii] = sizes[ii];
+      fs->size += sizes[ii];
+   }
+}
+
+void
+field_set_from_struct( field_set_t* fs,
+                       MPI_Datatype data_type,
+                       unsigned mask )
+{
+   int n_ints, n_addrs, n_types, combiner;
+   int *ints;
+   MPI_Aint *addrs, *offs, *sizes, lb, extent;
+   MPI_Datatype *types;
+   unsigned n_fields;
+   int ii;
+
+   MPI_OK( MPI_Type_get_envelope( data_type, &n_ints, &n_addrs, &n_types, &combiner ) );
+
+   /* Look through a resize to the struct underneath. */
+   if( combiner == MPI_COMBINER_RESIZED )
+   {
+      MPI_Datatype inner;
+      MPI_Aint bounds[2];
+
+      MPI_OK( MPI_Type_get_contents( data_type, 0, 2, 1, NULL, bounds, &inner ) );
+      field_set_from_struct( fs, inner, mask );
+      MPI_OK( MPI_Type_free( &inner ) );
+      return;
+   }
+   assert( combiner == MPI_COMBINER_STRUCT );
+
+   ints = ALLOC( int, n_ints );
+   addrs = ALLOC( MPI_Aint, n_addrs );
+   types = ALLOC( MPI_Datatype, n_types );
+   MPI_OK( MPI_Type_get_contents( data_type, n_ints, n_addrs, n_types, ints, addrs, types ) );
+
+   /* ints holds the count followed by the block lengths. */
+   offs = ALLOC( MPI_Aint, ints[0] );
+   sizes = ALLOC( MPI_Aint, ints[0] );
+   n_fields = 0;
+   for( ii = 0; ii < ints[0]; ++ii )
+   {
+      if( ii < 8*sizeof(unsigned) && (mask & (1u << ii)) )
+      {
+         MPI_OK( MPI_Type_get_extent( types[ii], &lb, &extent ) );
+         offs[n_fields] = addrs[ii];
+         sizes[n_fields++] = ints[ii + 1]*extent;
+      }
+   }
+   field_set_init( fs, n_fields, offs, sizes );
+
+   /* Predefined types must not be freed. */
+   for( ii = 0; ii < n_types; ++ii )
+   {
+      int ni, na, nt, comb;
+
+      MPI_OK( MPI_Type_get_envelope( types[ii], &ni, &na, &nt, &comb ) );
+      if( comb != MPI_COMBINER_NAMED )
+         MPI_OK( MPI_Type_free( types + ii ) );
+   }
+   FREE( ints );
+   FREE( addrs );
+   FREE( types );
+   FREE( offs );
+   FREE( sizes );
+}
+
+void
+field_set_free( field_set_t* fs )
+{
+   FREE( fs->offs );
+   FREE( fs->sizes );
+}
+
+void
+field_set_pack( field_set_t const* fs,
+                unsigned n,
+                unsigned const* idxs,
+                MPI_Aint extent,
+                void const* src,
+                void* dst )
+{
+   uint8_t* ptr = (uint8_t*)dst;
+   unsigned ii, ff;
+
+   for( ii = 0; ii < n; ++ii )
+   {
+      uint8_t const* rec = (uint8_t const*)src + extent*idxs[ii];
+
+      for( ff = 0; ff < fs->n_fields; ++ff )
+      {
+         memcpy( ptr, rec + fs->offs[ff], fs->sizes[ff] );
+         ptr += fs->sizes[ff];
+      }
+   }
+}
+
+void
+field_set_unpack( field_set_t const* fs,
+                  unsigned n,
+                  unsigned const* idxs,
+                  MPI_Aint extent,
+                  void const* src,
+                  void* dst )
+{
+   uint8_t const* ptr = (uint8_t const*)src;
+   unsigned ii, ff;
+
+   for( ii = 0; ii < n; ++ii )
+   {
+      uint8_t* rec = (uint8_t*)dst + extent*idxs[ii];
+
+      for( ff = 0; ff < fs->n_fields; ++ff )
+      {
+         memcpy( rec + fs->offs[ff], ptr, fs->sizes[ff] );
+         ptr += fs->sizes[ff];
+      }
+   }
+}
+
+void
+_flat_append( field_set_t* fs,
+              unsigned* max_fields,
+              MPI_Aint offs,
+              MPI_Aint size )
+{
+   if( !size )
+      return;
+   fs->size += size;
+
+   /* Coalesce with the previous range where possible. */
+   if( fs->n_fields && fs->offs[fs->n_fields - 1] + fs->sizes[fs->n_fields - 1] == offs )
+   {
+      fs->sizes[fs->n_fields - 1] += size;
+      return;
+   }
+
+   if( fs->n_fields == *max_fields )
+   {
+      *max_fields = *max_fields ? 2*(*max_fields) : 8;
+      fs->offs = (MPI_Aint*)realloc( fs->offs, sizeof(MPI_Aint)*(*max_fields) );
+      fs->sizes = (MPI_Aint*)realloc( fs->sizes, sizeof(MPI_Aint)*(*max_fields) );
+      assert( fs->offs && fs->sizes );
+   }
+   fs->offs[fs->n_fields] = offs;
+   fs->sizes[fs->n_fields++] = size;
+}
+
+void
+_flatten( field_set_t* fs,
+          unsigned* max_fields,
+          MPI_Datatype data_type,
+          MPI_Aint disp )
+{
+   int n_ints, n_addrs, n_types, combiner;
+   int *ints;
+   MPI_Aint *addrs, lb, extent;
+   MPI_Datatype *types;
+   int ii, jj;
+
+   MPI_OK( MPI_Type_get_envelope( data_type, &n_ints, &n_addrs, &n_types, &combiner ) );
+   if( combiner == MPI_COMBINER_NAMED )
+   {
+      int size;
+
+      MPI_OK( MPI_Type_size( data_type, &size ) );
+      _flat_append( fs, max_fields, disp, size );
+      return;
+   }
+
+   ints = ALLOC( int, n_ints );
+   addrs = ALLOC( MPI_Aint, n_addrs );
+   types = ALLOC( MPI_Datatype, n_types );
+   MPI_OK( MPI_Type_get_contents( data_type, n_ints, n_addrs, n_types, ints, addrs, types ) );
+   if( n_types )
+      MPI_OK( MPI_Type_get_extent( types[0], &lb, &extent ) );
+
+   switch( combiner )
+   {
+      case MPI_COMBINER_DUP:
+      case MPI_COMBINER_RESIZED:
+         _flatten( fs, max_fields, types[0], disp );
+         break;
+
+      case MPI_COMBINER_CONTIGUOUS:
+         for( ii = 0; ii < ints[0]; ++ii )
+            _flatten( fs, max_fields, types[0], disp + ii*extent );
+         break;
+
+      case MPI_COMBINER_VECTOR:
+         for( ii = 0; ii < ints[0]; ++ii )
+         {
+            for( jj = 0; jj < ints[1]; ++jj )
+               _flatten( fs, max_fields, types[0], disp + ((MPI_Aint)ii*ints[2] + jj)*extent );
+         }
+         break;
+
+      case MPI_COMBINER_HVECTOR:
+         for( ii = 0; ii < ints[0]; ++ii )
+         {
+            for( jj = 0; jj < ints[1]; ++jj )
+               _flatten( fs, max_fields, types[0], disp + ii*addrs[0] + jj*extent );
+         }
+         break;
+
+      case MPI_COMBINER_INDEXED:
+         for( ii = 0; ii < ints[0]; ++ii )
+         {
+            for( jj = 0; jj < ints[1 + ii]; ++jj )
+               _flatten( fs, max_fields, types[0], disp + ((MPI_Aint)ints[1 + ints[0] + ii] + jj)*extent );
+         }
+         break;
+
+      case MPI_COMBINER_HINDEXED:
+         for( ii = 0; ii < ints[0]; ++ii )
+         {
+            for( jj = 0; jj < ints[1 + ii]; ++jj )
+               _flatten( fs, max_fields, types[0], disp + addrs[ii] + jj*extent );
+         }
+         break;
+
+      case MPI_COMBINER_INDEXED_BLOCK:
+         for( ii = 0; ii < ints[0]; ++ii )
+         {
+            for( jj = 0; jj < ints[1]; ++jj )
+               _flatten( fs, max_fields, types[0], disp + ((MPI_Aint)ints[2 + ii] + jj)*extent );
+         }
+         break;
+
+      case MPI_COMBINER_HINDEXED_BLOCK:
+         for( ii = 0; ii < ints[0]; ++ii )
+         {
+            for( jj = 0; jj < ints[1]; ++jj )
+               _flatten( fs, max_fields, types[0], disp + addrs[ii] + jj*extent );
+         }
+         break;
+
+      case MPI_COMBINER_STRUCT:
+         for( ii = 0; ii < ints[0]; ++ii )
+         {
+            MPI_OK( MPI_Type_get_extent( types[ii], &lb, &extent ) );
+            for( jj = 0; jj < ints[1 + ii]; ++jj )
+               _flatten( fs, max_fields, types[ii], disp + addrs[ii] + jj*extent );
+         }
+         break;
+
+      case MPI_COMBINER_SUBARRAY:
+      {
+         int n_dims = ints[0], *sizes = ints + 1, *subs = ints + 1 + n_dims, *starts = ints + 1 + 2*n_dims;
+         int c_order = (ints[1 + 3*n_dims] == MPI_ORDER_C);
+         int *pos = ALLOCZ( int, n_dims );
+         MPI_Aint offs;
+
+         /* Walk the subarray with the fastest varying dimension
+            innermost, so neighbouring elements coalesce. */
+         for( ii = 0; ii < n_dims && subs[ii]; ++ii );
+         if( ii == n_dims )
+         {
+            do
+            {
+               offs = 0;
+               for( jj = 0; jj < n_dims; ++jj )
+               {
+                  ii = c_order ? jj : n_dims - 1 - jj;
+                  offs = offs*sizes[ii] + starts[ii] + pos[ii];
+               }
+               _flatten( fs, max_fields, types[0], disp + offs*extent );
+               for( jj = n_dims - 1; jj >= 0; --jj )
+               {
+                  ii = c_order ? jj : n_dims - 1 - jj;
+                  if( ++pos[ii] < subs[ii] )
+                     break;
+                  pos[ii] = 0;
+               }
+            }
+            while( jj >= 0 );
+         }
+         FREE( pos );
+         break;
+      }
+
+      default:
+      {
+         MPI_Aint true_lb, true_extent;
+
+         /* Anything else is moved as a single range; holes are
+            copied but nothing is lost. */
+         MPI_OK( MPI_Type_get_true_extent( data_type, &true_lb, &true_extent ) );
+         _flat_append( fs, max_fields, disp + true_lb, true_extent );
+      }
+   }
+
+   /* Predefined types must not be freed. */
+   for( ii = 0; ii < n_types; ++ii )
+   {
+      int ni, na, nt, comb;
+
+      MPI_OK( MPI_Type_get_envelope( types[ii], &ni, &na, &nt, &comb ) );
+      if( comb != MPI_COMBINER_NAMED )
+         MPI_OK( MPI_Type_free( types + ii ) );
+   }
+   FREE( ints );
+   FREE( addrs );
+   FREE( types );
+}
+
+void
+field_set_flatten( field_set_t* fs,
+                   MPI_Datatype data_type )
+{
+   unsigned max_fields = 0;
+
+   assert( fs );
+
+   fs->n_fields = 0;
+   fs->offs = NULL;
+   fs->sizes = NULL;
+   fs->size = 0;
+   _flatten( fs, &max_fields, data_type, 0 );
+}
+
+static int flat_keyval = MPI_KEYVAL_INVALID;
+static pthread_once_t flat_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t flat_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int
+_flat_delete( MPI_Datatype data_type,
+              int keyval,
+              void* attr,
+              void* extra )
+{
+   field_set_free( (field_set_t*)attr );
+   free( attr );
+   return MPI_SUCCESS;
+}
+
+void
+_flat_create( void )
+{
+   MPI_OK( MPI_Type_create_keyval( MPI_TYPE_NULL_COPY_FN, _flat_delete, &flat_keyval, NULL ) );
+}
+
+field_set_t const*
+field_set_cached( MPI_Datatype data_type )
+{
+   field_set_t* fs;
+   int found;
+
+   pthread_once( &flat_once, _flat_create );
+
+   /* Predefined types cannot carry attributes, but they have
+      no holes to flatten either. */
+   {
+      int ni, na, nt, comb;
+
+      MPI_OK( MPI_Type_get_envelope( data_type, &ni, &na, &nt, &comb ) );
+      if( comb == MPI_COMBINER_NAMED )
+         return NULL;
+   }
+
+   /* Threads flattening the same datatype must not both set
+      the attribute, or the loser's result would be deleted. */
+   pthread_mutex_lock( &flat_lock );
+   MPI_OK( MPI_Type_get_attr( data_type, flat_keyval, &fs, &found ) );
+   if( !found )
+   {
+      fs = ALLOC( field_set_t, 1 );
+      field_set_flatten( fs, data_type );
+      MPI_OK( MPI_Type_set_attr( data_type, flat_keyval, fs ) );
+   }
+   pthread_mutex_unlock( &flat_lock );
+   return fs;
+}
+
+void
+scatter_fields( unsigned n_elems,
+                unsigned n_idxs,
+                unsigned const* idxs,
+                void const* data,
+                void** recv_data,
+                MPI_Datatype data_type,
+                field_set_t const* fs,
+                int layout,
+                MPI_Comm comm )
+{
+   scatter_plan_t plan;
+   MPI_Datatype rec_type;
+   MPI_Aint lb, extent, size = fs->size, offs;
+   uint8_t *out_buf, *inc_buf;
+   unsigned n_out, ii, ff;
+   int n_ranks;
+
+   assert( !n_idxs || idxs );
+   assert( !n_elems || data );
+   assert( !n_elems || comm );
+   assert( layout == FIELDS_AOS || layout == FIELDS_SOA );
+
+   scatter_plan_init_shared( &plan, n_elems, n_idxs, idxs, comm );
+   n_ranks = plan.n_ranks;
+   MPI_OK( MPI_Type_get_extent( data_type, &lb, &extent ) );
+
+   /* Gather only the selected fields of outgoing records. */
+   n_out = plan.out_displs[n_ranks - 1] + plan.out_cnts[n_ranks - 1];
+   out_buf = ALLOC( uint8_t, size*n_out );
+   field_set_pack( fs, n_out, plan.out_idxs, extent, data, out_buf );
+
+   /* Exchange compact records. */
+   MPI_OK( MPI_Type_contiguous( size, MPI_BYTE, &rec_type ) );
+   MPI_OK( MPI_Type_commit( &rec_type ) );
+   inc_buf = ALLOC( uint8_t, size*n_idxs );
+   MPI_OK( MPI_Alltoallv( out_buf, (int*)plan.out_cnts, (int*)plan.out_displs, rec_type,
+                          inc_buf, (int*)plan.req_cnts, (int*)plan.req_displs, rec_type, plan.comm ) );
+   MPI_OK( MPI_Type_free( &rec_type ) );
+   FREE( out_buf );
+
+   /* Place records in request order. */
+   *recv_data = (void*)ALLOC( uint8_t, size*n_idxs );
+   if( layout == FIELDS_AOS )
+      kernel_scatter( n_idxs, plan.local, size, inc_buf, *recv_data );
+   else
+   {
+      for( ff = 0, offs = 0; ff < fs->n_fields; offs += fs->sizes[ff++] )
+      {
+         uint8_t* field = (uint8_t*)*recv_data + n_idxs*offs;
+
+         for( ii = 0; ii < n_idxs; ++ii )
+            memcpy( field + fs->sizes[ff]*plan.local[ii], inc_buf + size*ii + offs, fs->sizes[ff] );
+      }
+   }
+   FREE( inc_buf );
+   scatter_plan_free( &plan );
+}
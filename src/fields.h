@@ -0,0 +1,168 @@
+/*!
+** @file
+** @author Luke Hodkinson, 2014
+*/
+
+#ifndef fields_h
+#define fields_h
+
+#include <mpi.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*!
+** A set of byte ranges within a record, used to move only
+** some of the fields of array-of-structs data.
+*/
+struct field_set
+{
+   unsigned  n_fields;
+   MPI_Aint* offs;
+   MPI_Aint* sizes;
+   MPI_Aint  size;
+};
+typedef struct field_set field_set_t;
+
+/*!
+** Output layouts for field subsets. FIELDS_AOS packs the
+** selected fields of each record together; FIELDS_SOA stores
+** each field as its own contiguous array, one after another.
+*/
+enum fields_layout
+{
+   FIELDS_AOS,
+   FIELDS_SOA
+};
+
+/*!
+** Initialise a field set from explicit byte ranges.
+**
+** @param[out] fs       field set to initialise
+** @param[in]  n_fields number of fields
+** @param[in]  offs     byte offset of each field in a record
+** @param[in]  sizes    byte size of each field
+*/
+void
+field_set_init( field_set_t* fs,
+                unsigned n_fields,
+                MPI_Aint const* offs,
+                MPI_Aint const* sizes );
+
+/*!
+** Initialise a field set from the blocks of a datatype created
+** with MPI_Type_create_struct (optionally resized). Bit i of the
+** mask selects block i.
+**
+** @param[out] fs        field set to initialise
+** @param[in]  data_type struct datatype
+** @param[in]  mask      bit mask of blocks to select
+*/
+void
+field_set_from_struct( field_set_t* fs,
+                       MPI_Datatype data_type,
+                       unsigned mask );
+
+/*!
+** Release a field set.
+**
+** @param[inout] fs field set
+*/
+void
+field_set_free( field_set_t* fs );
+
+/*!
+** Flatten any datatype into the coalesced byte ranges that
+** hold data, leaving out padding and holes. The total size
+** matches MPI_Type_size, except for darray and other
+** combiners not listed in fields.c, which are moved as a
+** single range over their true extent, holes included.
+**
+** @param[out] fs        field set to initialise
+** @param[in]  data_type datatype to flatten
+*/
+void
+field_set_flatten( field_set_t* fs,
+                   MPI_Datatype data_type );
+
+/*!
+** Flattened form of a datatype, computed on first use and
+** cached as an attribute of the datatype. Returns NULL for
+** predefined datatypes, which have no holes.
+**
+** @param[in] data_type datatype to flatten
+** @returns A field set owned by the datatype.
+*/
+field_set_t const*
+field_set_cached( MPI_Datatype data_type );
+
+/*!
+** Gather the fields of indexed records into a compact buffer
+** of fs->size bytes per record.
+**
+** @param[in]  fs     field set
+** @param[in]  n      number of records
+** @param[in]  idxs   index of each record in src
+** @param[in]  extent record stride in src
+** @param[in]  src    source records
+** @param[out] dst    compact fields
+*/
+void
+field_set_pack( field_set_t const* fs,
+                unsigned n,
+                unsigned const* idxs,
+                MPI_Aint extent,
+                void const* src,
+                void* dst );
+
+/*!
+** Scatter compact fields back into indexed records. Bytes
+** outside the fields are left untouched.
+**
+** @param[in]  fs     field set
+** @param[in]  n      number of records
+** @param[in]  idxs   index of each record in dst
+** @param[in]  extent record stride in dst
+** @param[in]  src    compact fields
+** @param[out] dst    destination records
+*/
+void
+field_set_unpack( field_set_t const* fs,
+                  unsigned n,
+                  unsigned const* idxs,
+                  MPI_Aint extent,
+                  void const* src,
+                  void* dst );
+
+/*!
+** Send/recv a subset of the fields of indexed records. Only
+** the selected fields cross the network, and the result holds
+** n_idxs compact records laid out as requested.
+**
+** @param[in]  n_elems   number of global records
+** @param[in]  n_idxs    number of local desired indices
+** @param[in]  idxs      array of desired indices
+** @param[in]  data      array of local records
+** @param[out] recv_data resulting compact fields
+** @param[in]  data_type MPI datatype of records
+** @param[in]  fs        fields to move
+** @param[in]  layout    one of the fields_layout values
+** @param[in]  comm      MPI communicator
+*/
+void
+scatter_fields( unsigned n_elems,
+                unsigned n_idxs,
+                unsigned const* idxs,
+                void const* data,
+                void** recv_data,
+                MPI_Datatype data_type,
+                field_set_t const* fs,
+                int layout,
+                MPI_Comm comm );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
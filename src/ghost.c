@@ -0,0 +1,183 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include "ghost.h"
+#include "utils.h"
+
+#define GHOST_TAG 3003
+#define BITS (8*sizeof(unsigned))
+
+void
+ghost_init( ghost_t* gh,
+            unsigned n_elems,
+            unsigned n_ghosts,
+            unsigned const* idxs,
+            void const* data,
+            MPI_Datatype data_type,
+            MPI_Comm comm )
+{
+   scatter_plan_t* plan = &gh->plan;
+   unsigned n_local, *cnts, ii, jj;
+   int rr;
+   MPI_Aint lb;
+
+   assert( gh );
+
+   scatter_plan_init( plan, n_elems, n_ghosts, idxs, comm );
+   gh->data_type = data_type;
+   MPI_OK( MPI_Type_get_extent( data_type, &lb, &gh->elem_size ) );
+   gh->ghosts = ALLOC( uint8_t, gh->elem_size*n_ghosts );
+   scatter_plan_execute( plan, data, gh->ghosts, data_type );
+
+   /* Invert the outgoing lists, so each local element knows which
+      ranks and slots hold a ghost of it. */
+   n_local = plan->n_local_elems;
+   cnts = ALLOCZ( unsigned, n_local );
+   for( ii = 0; ii < plan->out_displs[plan->n_ranks - 1] + plan->out_cnts[plan->n_ranks - 1]; ++ii )
+      ++cnts[plan->out_idxs[ii]];
+   gh->sub_displs = ALLOC( unsigned, n_local + 1 );
+   gh->sub_displs[0] = 0;
+   make_displs2( n_local, cnts, gh->sub_displs );
+   gh->sub_ranks = ALLOC( unsigned, gh->sub_displs[n_local] );
+   gh->sub_slots = ALLOC( unsigned, gh->sub_displs[n_local] );
+   memset( cnts, 0, sizeof(unsigned)*n_local );
+   for( rr = 0; rr < plan->n_ranks; ++rr )
+   {
+      for( jj = 0; jj < plan->out_cnts[rr]; ++jj )
+      {
+         ii = plan->out_idxs[plan->out_displs[rr] + jj];
+         gh->sub_ranks[gh->sub_displs[ii] + cnts[ii]] = rr;
+         gh->sub_slots[gh->sub_displs[ii] + cnts[ii]++] = jj;
+      }
+   }
+   FREE( cnts );
+
+   gh->dirty_bits = ALLOCZ( unsigned, (n_local + BITS - 1)/BITS );
+   gh->dirty = ALLOC( unsigned, n_local );
+   gh->n_dirty = 0;
+   gh->n_sent = 0;
+}
+
+void
+ghost_free( ghost_t* gh )
+{
+   scatter_plan_free( &gh->plan );
+   FREE( gh->ghosts );
+   FREE( gh->sub_displs );
+   FREE( gh->sub_ranks );
+   FREE( gh->sub_slots );
+   FREE( gh->dirty_bits );
+   FREE( gh->dirty );
+}
+
+void
+ghost_mark_dirty( ghost_t* gh,
+                  unsigned idx )
+{
+   assert( idx < gh->plan.n_local_elems );
+
+   /* The bitmap keeps the list free of duplicates. */
+   if( gh->dirty_bits[idx/BITS] & (1u << (idx%BITS)) )
+      return;
+   gh->dirty_bits[idx/BITS] |= 1u << (idx%BITS);
+   gh->dirty[gh->n_dirty++] = idx;
+}
+
+void
+ghost_update( ghost_t* gh,
+              void const* data )
+{
+   scatter_plan_t const* plan = &gh->plan;
+   MPI_Aint elem_size = gh->elem_size, rec_size = sizeof(unsigned) + gh->elem_size;
+   unsigned *cnts, *offs, ii, jj, idx;
+   uint8_t *out_buf, *inc_buf;
+   MPI_Request* reqs;
+   MPI_Status status;
+   int n_ranks = plan->n_ranks, n_reqs = 0, len, rr;
+
+   /* Count changed values going to each neighbour. */
+   cnts = ALLOCZ( unsigned, n_ranks );
+   offs = ALLOC( unsigned, n_ranks );
+   for( ii = 0; ii < gh->n_dirty; ++ii )
+   {
+      idx = gh->dirty[ii];
+      for( jj = gh->sub_displs[idx]; jj < gh->sub_displs[idx + 1]; ++jj )
+         ++cnts[gh->sub_ranks[jj]];
+   }
+   make_displs( n_ranks, cnts, offs );
+
+   /* Each change is sent as the slot it occupies in the receiver's
+      list followed by the new value. */
+   out_buf = ALLOC( uint8_t, rec_size*(offs[n_ranks - 1] + cnts[n_ranks - 1]) );
+   memset( cnts, 0, sizeof(unsigned)*n_ranks );
+   for( ii = 0; ii < gh->n_dirty; ++ii )
+   {
+      idx = gh->dirty[ii];
+      for( jj = gh->sub_displs[idx]; jj < gh->sub_displs[idx + 1]; ++jj )
+      {
+         uint8_t* rec = out_buf + rec_size*(offs[gh->sub_ranks[jj]] + cnts[gh->sub_ranks[jj]]++);
+
+         memcpy( rec, gh->sub_slots + jj, sizeof(unsigned) );
+         memcpy( rec + sizeof(unsigned), (uint8_t const*)data + elem_size*idx, elem_size );
+      }
+      gh->dirty_bits[idx/BITS] &= ~(1u << (idx%BITS));
+   }
+   gh->n_sent = offs[n_ranks - 1] + cnts[n_ranks - 1] - cnts[plan->rank];
+   gh->n_dirty = 0;
+
+   /* Every neighbour gets a message, possibly empty, so receivers
+      know when they are done. */
+   reqs = ALLOC( MPI_Request, n_ranks );
+   for( rr = 0; rr < n_ranks; ++rr )
+   {
+      if( rr == plan->rank || !plan->out_cnts[rr] )
+         continue;
+      MPI_OK( MPI_Isend( out_buf + rec_size*offs[rr], rec_size*cnts[rr], MPI_BYTE, rr,
+                         GHOST_TAG, plan->comm, reqs + n_reqs++ ) );
+   }
+
+   /* Apply incoming changes, including our own. */
+   for( rr = 0; rr < n_ranks; ++rr )
+   {
+      unsigned const* local = plan->local + plan->req_displs[rr];
+      unsigned n;
+
+      if( !plan->req_cnts[rr] )
+         continue;
+      if( rr == plan->rank )
+      {
+         inc_buf = out_buf + rec_size*offs[rr];
+         n = cnts[rr];
+      }
+      else
+      {
+         MPI_OK( MPI_Probe( rr, GHOST_TAG, plan->comm, &status ) );
+         MPI_OK( MPI_Get_count( &status, MPI_BYTE, &len ) );
+         inc_buf = ALLOC( uint8_t, len );
+         MPI_OK( MPI_Recv( inc_buf, len, MPI_BYTE, rr, GHOST_TAG, plan->comm, MPI_STATUS_IGNORE ) );
+         n = len/rec_size;
+      }
+      for( ii = 0; ii < n; ++ii )
+      {
+         unsigned slot;
+
+         memcpy( &slot, inc_buf + rec_size*ii, sizeof(unsigned) );
+         memcpy( (uint8_t*)gh->ghosts + elem_size*local[slot], inc_buf + rec_size*ii + sizeof(unsigned), elem_size );
+      }
+      if( rr != plan->rank )
+         FREE( inc_buf );
+   }
+
+   MPI_OK( MPI_Waitall( n_reqs, reqs, MPI_STATUSES_IGNORE ) );
+   FREE( reqs );
+   FREE( out_buf );
+   FREE( cnts );
+   FREE( offs );
+}
+
+void const*
+ghost_data( ghost_t const* gh )
+{
+   return gh->ghosts;
+}
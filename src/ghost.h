@@ -0,0 +1,103 @@
+/*!
+** @file
+** @author Luke Hodkinson, 2014
+*/
+
+#ifndef ghost_h
+#define ghost_h
+
+#include <mpi.h>
+#include "permute.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*!
+** Read-only copies of remote elements of a distributed array
+** (ghosts), refreshed by sending only the elements that changed
+** since the last exchange. Owners record changes with
+** ghost_mark_dirty.
+*/
+struct ghost
+{
+   scatter_plan_t plan;
+   MPI_Datatype   data_type;
+   MPI_Aint       elem_size;
+   void*          ghosts;
+   unsigned*      sub_displs;
+   unsigned*      sub_ranks;
+   unsigned*      sub_slots;
+   unsigned*      dirty_bits;
+   unsigned*      dirty;
+   unsigned       n_dirty;
+   unsigned       n_sent;
+};
+typedef struct ghost ghost_t;
+
+/*!
+** Set up ghosts of the given global indices and fetch their
+** initial values. Must be called collectively.
+**
+** @param[out] gh        ghost exchange to initialise
+** @param[in]  n_elems   number of global data elements
+** @param[in]  n_ghosts  number of local ghosts
+** @param[in]  idxs      global index of each ghost
+** @param[in]  data      array of local data elements
+** @param[in]  data_type MPI datatype of data elements
+** @param[in]  comm      MPI communicator
+*/
+void
+ghost_init( ghost_t* gh,
+            unsigned n_elems,
+            unsigned n_ghosts,
+            unsigned const* idxs,
+            void const* data,
+            MPI_Datatype data_type,
+            MPI_Comm comm );
+
+/*!
+** Release a ghost exchange. Must be called collectively.
+**
+** @param[inout] gh ghost exchange
+*/
+void
+ghost_free( ghost_t* gh );
+
+/*!
+** Record that a locally owned element has changed.
+**
+** @param[inout] gh  ghost exchange
+** @param[in]    idx local index of the changed element
+*/
+void
+ghost_mark_dirty( ghost_t* gh,
+                  unsigned idx );
+
+/*!
+** Send changed elements to the ranks holding ghosts of them,
+** and apply incoming changes to our ghosts. Only neighbours
+** are contacted and only changed values are sent. Must be
+** called collectively.
+**
+** @param[inout] gh   ghost exchange
+** @param[in]    data array of local data elements
+*/
+void
+ghost_update( ghost_t* gh,
+              void const* data );
+
+/*!
+** Current ghost values, in the order of the indices given to
+** ghost_init.
+**
+** @param[in] gh ghost exchange
+*/
+void const*
+ghost_data( ghost_t const* gh );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -94,6 +94,22 @@ hash_lookup( hash_t const* obj,
    return HASH_INVALID;
 }
 
+void
+hash_remove( hash_t* obj,
+             HASH_KEY key )
+{
+   unsigned idx = key%obj->max_size;
+   hash_node_t** np = obj->tbl + idx;
+   while( *np && (*np)->key != key )
+      np = &(*np)->next;
+   if( *np )
+   {
+      hash_node_t* next = (*np)->next;
+      free( *np );
+      *np = next;
+   }
+}
+
 unsigned
 _sieve_of_eratosthenes( unsigned N,
                         unsigned max_primes,
@@ -14,6 +14,10 @@
 
 #include <limits.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define HASH_KEY     unsigned
 #define HASH_VAL     unsigned
 #define HASH_INVALID UINT_MAX
@@ -24,10 +28,11 @@ typedef struct hash      hash_t;
 /*
 ** Create a new hashmap.
 **
+** @param[in] size  Expected number of entries.
 ** @returns A hashmap allocated on the heap.
 */
 hash_t*
-hash_new();
+hash_new( unsigned size );
 
 /*
 ** Delete an existing hashmap.
@@ -61,6 +66,16 @@ HASH_VAL
 hash_lookup( hash_t const* obj,
              HASH_KEY key );
 
+/*
+** Remove an entry from a hashmap, if it exists.
+**
+** @param[in] obj  An existing hashmap object.
+** @param[in] key  The key of the entry to remove.
+*/
+void
+hash_remove( hash_t* obj,
+             HASH_KEY key );
+
 struct hash_node
 {
    HASH_KEY     key;
@@ -79,4 +94,8 @@ struct hash
 #endif
 };
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,279 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "kernels.h"
+#include "utils.h"
+
+#if defined( __GNUC__ ) && defined( __x86_64__ )
+#define KERNELS_X86
+#include <immintrin.h>
+#endif
+
+/* Prefetching is a hint; compilers without the builtin go
+   without it. */
+#ifdef __GNUC__
+#define PREFETCH( addr, rw ) __builtin_prefetch( (addr), (rw) )
+#else
+#define PREFETCH( addr, rw )
+#endif
+
+/* The level is the one piece of state shared by every caller.
+   It is atomic so that a kernel starting while it is set sees
+   either level, both of which give the same results. */
+static int kern_max = KERNELS_GENERIC;
+static atomic_int kern_level = KERNELS_GENERIC;
+static pthread_once_t kern_once = PTHREAD_ONCE_INIT;
+
+void
+_kernels_detect( void )
+{
+#ifdef KERNELS_X86
+   __builtin_cpu_init();
+   if( __builtin_cpu_supports( "avx512f" ) )
+      kern_max = KERNELS_AVX512;
+   else if( __builtin_cpu_supports( "avx2" ) )
+      kern_max = KERNELS_AVX2;
+#endif
+}
+
+int
+kernels_level( void )
+{
+   return atomic_load_explicit( &kern_level, memory_order_relaxed );
+}
+
+int
+kernels_max_level( void )
+{
+   pthread_once( &kern_once, _kernels_detect );
+   return kern_max;
+}
+
+int
+kernels_set_level( int level )
+{
+   level = MIN( MAX( level, KERNELS_GENERIC ), kernels_max_level() );
+   atomic_store_explicit( &kern_level, level, memory_order_relaxed );
+   return level;
+}
+
+char const*
+kernels_level_name( int level )
+{
+   switch( level )
+   {
+      case KERNELS_GENERIC:
+         return "generic";
+      case KERNELS_AVX2:
+         return "avx2";
+      case KERNELS_AVX512:
+         return "avx512";
+      default:
+         return "unknown";
+   }
+}
+
+/* Copies of a constant size compile to plain moves, and stay
+   correct for elements of any alignment. */
+#define GATHER_LOOP( size )                                             \
+   for( ii = 0; ii < n; ++ii )                                          \
+   {                                                                    \
+      if( ii + KERNELS_PREFETCH < n )                                   \
+         PREFETCH( s + (size_t)(size)*idxs[ii + KERNELS_PREFETCH], 0 ); \
+      memcpy( d + (size_t)(size)*ii, s + (size_t)(size)*idxs[ii], (size) ); \
+   }
+
+#define SCATTER_LOOP( size )                                            \
+   for( ii = 0; ii < n; ++ii )                                          \
+   {                                                                    \
+      if( ii + KERNELS_PREFETCH < n )                                   \
+         PREFETCH( d + (size_t)(size)*idxs[ii + KERNELS_PREFETCH], 1 ); \
+      memcpy( d + (size_t)(size)*idxs[ii], s + (size_t)(size)*ii, (size) ); \
+   }
+
+void
+_gather_fixed( unsigned n,
+               unsigned const* idxs,
+               size_t elem_size,
+               uint8_t const* s,
+               uint8_t* d )
+{
+   unsigned ii;
+
+   switch( elem_size )
+   {
+      case 1: GATHER_LOOP( 1 ); break;
+      case 2: GATHER_LOOP( 2 ); break;
+      case 4: GATHER_LOOP( 4 ); break;
+      case 8: GATHER_LOOP( 8 ); break;
+      case 12: GATHER_LOOP( 12 ); break;
+      case 16: GATHER_LOOP( 16 ); break;
+      case 24: GATHER_LOOP( 24 ); break;
+      case 32: GATHER_LOOP( 32 ); break;
+      default: GATHER_LOOP( elem_size ); break;
+   }
+}
+
+#ifdef KERNELS_X86
+
+/* Vector gathers take 64 bit indices so that unsigned indices of
+   any size are safe. Returns how many elements were done; the
+   caller finishes the tail. */
+
+/* Prefetch the sources of a vector's worth of elements ahead, as
+   the scalar loops do. */
+#define PREFETCH_AHEAD( width )                                         \
+   if( ii + KERNELS_PREFETCH + (width) <= n )                           \
+   {                                                                    \
+      unsigned pp;                                                      \
+      for( pp = 0; pp < (width); ++pp )                                 \
+         PREFETCH( s + elem_size*idxs[ii + KERNELS_PREFETCH + pp], 0 ); \
+   }
+
+__attribute__(( target( "avx2" ) ))
+unsigned
+_gather_avx2( unsigned n,
+              unsigned const* idxs,
+              size_t elem_size,
+              uint8_t const* s,
+              uint8_t* d )
+{
+   int stream = (size_t)n*elem_size >= KERNELS_STREAM_BYTES && !((uintptr_t)d%32);
+   unsigned ii = 0;
+
+   if( elem_size == 8 )
+   {
+      for( ; ii + 4 <= n; ii += 4 )
+      {
+         PREFETCH_AHEAD( 4 );
+         __m256i vi = _mm256_cvtepu32_epi64( _mm_loadu_si128( (__m128i const*)(idxs + ii) ) );
+         __m256i v = _mm256_i64gather_epi64( (long long const*)s, vi, 8 );
+
+         if( stream )
+            _mm256_stream_si256( (__m256i*)(d + 8*ii), v );
+         else
+            _mm256_storeu_si256( (__m256i*)(d + 8*ii), v );
+      }
+   }
+   else if( elem_size == 4 )
+   {
+      for( ; ii + 8 <= n; ii += 8 )
+      {
+         PREFETCH_AHEAD( 8 );
+         __m256i lo = _mm256_cvtepu32_epi64( _mm_loadu_si128( (__m128i const*)(idxs + ii) ) );
+         __m256i hi = _mm256_cvtepu32_epi64( _mm_loadu_si128( (__m128i const*)(idxs + ii + 4) ) );
+         __m256i v = _mm256_set_m128i( _mm256_i64gather_epi32( (int const*)s, hi, 4 ),
+                                       _mm256_i64gather_epi32( (int const*)s, lo, 4 ) );
+
+         if( stream )
+            _mm256_stream_si256( (__m256i*)(d + 4*ii), v );
+         else
+            _mm256_storeu_si256( (__m256i*)(d + 4*ii), v );
+      }
+   }
+   if( stream )
+      _mm_sfence();
+   return ii;
+}
+
+__attribute__(( target( "avx512f" ) ))
+unsigned
+_gather_avx512( unsigned n,
+                unsigned const* idxs,
+                size_t elem_size,
+                uint8_t const* s,
+                uint8_t* d )
+{
+   int stream = (size_t)n*elem_size >= KERNELS_STREAM_BYTES && !((uintptr_t)d%64);
+   unsigned ii = 0;
+
+   if( elem_size == 8 )
+   {
+      for( ; ii + 8 <= n; ii += 8 )
+      {
+         PREFETCH_AHEAD( 8 );
+         __m512i vi = _mm512_cvtepu32_epi64( _mm256_loadu_si256( (__m256i const*)(idxs + ii) ) );
+         __m512i v = _mm512_i64gather_epi64( vi, (void const*)s, 8 );
+
+         if( stream )
+            _mm512_stream_si512( (__m512i*)(d + 8*ii), v );
+         else
+            _mm512_storeu_si512( (void*)(d + 8*ii), v );
+      }
+   }
+   else if( elem_size == 4 )
+   {
+      for( ; ii + 16 <= n; ii += 16 )
+      {
+         PREFETCH_AHEAD( 16 );
+         __m512i lo = _mm512_cvtepu32_epi64( _mm256_loadu_si256( (__m256i const*)(idxs + ii) ) );
+         __m512i hi = _mm512_cvtepu32_epi64( _mm256_loadu_si256( (__m256i const*)(idxs + ii + 8) ) );
+         __m512i v = _mm512_inserti64x4( _mm512_castsi256_si512( _mm512_i64gather_epi32( lo, (void const*)s, 4 ) ),
+                                         _mm512_i64gather_epi32( hi, (void const*)s, 4 ), 1 );
+
+         if( stream )
+            _mm512_stream_si512( (__m512i*)(d + 4*ii), v );
+         else
+            _mm512_storeu_si512( (void*)(d + 4*ii), v );
+      }
+   }
+   if( stream )
+      _mm_sfence();
+   return ii;
+}
+
+#endif
+
+void
+kernel_gather( unsigned n,
+               unsigned const* idxs,
+               size_t elem_size,
+               void const* src,
+               void* dst )
+{
+   uint8_t const* s = (uint8_t const*)src;
+   uint8_t* d = (uint8_t*)dst;
+   unsigned done = 0;
+
+#ifdef KERNELS_X86
+   if( elem_size == 4 || elem_size == 8 )
+   {
+      int level = kernels_level();
+
+      if( level == KERNELS_AVX512 )
+         done = _gather_avx512( n, idxs, elem_size, s, d );
+      else if( level == KERNELS_AVX2 )
+         done = _gather_avx2( n, idxs, elem_size, s, d );
+   }
+#endif
+   _gather_fixed( n - done, idxs + done, elem_size, s, d + elem_size*done );
+}
+
+void
+kernel_scatter( unsigned n,
+                unsigned const* idxs,
+                size_t elem_size,
+                void const* src,
+                void* dst )
+{
+   uint8_t const* s = (uint8_t const*)src;
+   uint8_t* d = (uint8_t*)dst;
+   unsigned ii;
+
+   /* Vector scatters lose to the scalar loop in
+      examples/kernels_bench.c, so every level uses it. */
+   switch( elem_size )
+   {
+      case 1: SCATTER_LOOP( 1 ); break;
+      case 2: SCATTER_LOOP( 2 ); break;
+      case 4: SCATTER_LOOP( 4 ); break;
+      case 8: SCATTER_LOOP( 8 ); break;
+      case 12: SCATTER_LOOP( 12 ); break;
+      case 16: SCATTER_LOOP( 16 ); break;
+      case 24: SCATTER_LOOP( 24 ); break;
+      case 32: SCATTER_LOOP( 32 ); break;
+      default: SCATTER_LOOP( elem_size ); break;
+   }
+}
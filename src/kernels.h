@@ -0,0 +1,120 @@
+/*!
+** @file
+** @author Luke Hodkinson, 2014
+*/
+
+#ifndef kernels_h
+#define kernels_h
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*!
+** Instruction set levels of the gather and scatter kernels.
+*/
+enum kernels_level
+{
+   KERNELS_GENERIC,
+   KERNELS_AVX2,
+   KERNELS_AVX512
+};
+
+/*!
+** Distance, in elements, that gathers and scatters prefetch
+** ahead of the element being moved.
+*/
+#define KERNELS_PREFETCH 16
+
+/*!
+** Outputs of at least this many bytes are written with
+** non-temporal stores where the kernel supports it, so that
+** they do not evict the inputs from cache.
+*/
+#define KERNELS_STREAM_BYTES (1 << 22)
+
+/*!
+** Gather elements, out[i] = in[idxs[i]]. Element sizes of 1, 2,
+** 4, 8, 12, 16, 24 and 32 bytes have specialised loops. At the
+** AVX2 and AVX-512 levels, 4 and 8 byte elements use vector
+** gathers instead.
+**
+** @param[in]  n         number of elements
+** @param[in]  idxs      source index of each element
+** @param[in]  elem_size size of each element in bytes
+** @param[in]  src       source elements
+** @param[out] dst       n gathered elements
+*/
+void
+kernel_gather( unsigned n,
+               unsigned const* idxs,
+               size_t elem_size,
+               void const* src,
+               void* dst );
+
+/*!
+** Scatter elements, out[idxs[i]] = in[i]. Specialised by size as
+** for kernel_gather, with the same loop at every level; where
+** indices repeat, the last element wins.
+**
+** @param[in]  n         number of elements
+** @param[in]  idxs      destination index of each element
+** @param[in]  elem_size size of each element in bytes
+** @param[in]  src       n source elements
+** @param[out] dst       destination elements
+*/
+void
+kernel_scatter( unsigned n,
+                unsigned const* idxs,
+                size_t elem_size,
+                void const* src,
+                void* dst );
+
+/*!
+** The instruction set level in use. Generic unless raised with
+** kernels_set_level: examples/kernels_bench.c finds the vector
+** gathers no faster than the prefetching scalar loops, so they
+** are only used where that benchmark shows them ahead.
+**
+** @returns Kernel level.
+*/
+int
+kernels_level( void );
+
+/*!
+** The highest instruction set level the processor supports.
+** Detected on first use.
+**
+** @returns Kernel level.
+*/
+int
+kernels_max_level( void );
+
+/*!
+** Select the instruction set level, for testing and tuning. The
+** level is capped at what the processor supports. The level is
+** process wide and atomic, so it may be changed from any thread;
+** kernels already running finish at the level they started with.
+**
+** @param[in] level requested kernel level
+** @returns Kernel level now in use.
+*/
+int
+kernels_set_level( int level );
+
+/*!
+** Name of a kernel level.
+**
+** @param[in] level kernel level
+** @returns Static string naming the level.
+*/
+char const*
+kernels_level_name( int level );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
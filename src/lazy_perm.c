@@ -0,0 +1,125 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "lazy_perm.h"
+#include "permute.h"
+#include "utils.h"
+
+void
+lazy_perm_init( lazy_perm_t* lp,
+                unsigned n_src,
+                MPI_Comm comm )
+{
+   int n_ranks, rank;
+   unsigned base, ii;
+
+   assert( lp );
+
+   MPI_OK( MPI_Comm_size( comm, &n_ranks ) );
+   MPI_OK( MPI_Comm_rank( comm, &rank ) );
+   lp->n_src = n_src;
+   lp->n_idxs = local_size( n_src, n_ranks, rank );
+   MPI_OK( MPI_Scan( &lp->n_idxs, &base, 1, MPI_UNSIGNED, MPI_SUM, comm ) );
+   base -= lp->n_idxs;
+
+   lp->idxs = ALLOC( unsigned, lp->n_idxs );
+   for( ii = 0; ii < lp->n_idxs; ++ii )
+      lp->idxs[ii] = base + ii;
+   lp->n_rows = 0;
+   lp->displs = NULL;
+   lp->identity = 1;
+   lp->comm = comm;
+}
+
+void
+lazy_perm_free( lazy_perm_t* lp )
+{
+   FREE( lp->idxs );
+   FREE( lp->displs );
+}
+
+void
+lazy_perm_permute( lazy_perm_t* lp,
+                   unsigned n_elems,
+                   unsigned n_idxs,
+                   unsigned const* idxs )
+{
+   unsigned* new_idxs;
+
+   assert( !n_idxs || idxs );
+
+   /* Composing with the identity is just a copy. */
+   if( lp->identity )
+   {
+      assert( n_elems == lp->n_src );
+      new_idxs = ALLOC( unsigned, n_idxs );
+      memcpy( new_idxs, idxs, sizeof(unsigned)*n_idxs );
+   }
+   else
+      scatter( n_elems, n_idxs, idxs, lp->idxs, (void**)&new_idxs, MPI_UNSIGNED, lp->comm );
+
+   FREE( lp->idxs );
+   FREE( lp->displs );
+   lp->idxs = new_idxs;
+   lp->n_idxs = n_idxs;
+   lp->displs = NULL;
+   lp->n_rows = 0;
+   lp->identity = 0;
+}
+
+void
+lazy_perm_set_rows( lazy_perm_t* lp,
+                    unsigned n_rows,
+                    unsigned const* displs )
+{
+   assert( displs );
+   assert( displs[n_rows] == lp->n_idxs );
+
+   FREE( lp->displs );
+   lp->displs = ALLOC( unsigned, n_rows + 1 );
+   memcpy( lp->displs, displs, sizeof(unsigned)*(n_rows + 1) );
+   lp->n_rows = n_rows;
+}
+
+void
+lazy_perm_permutev( lazy_perm_t* lp,
+                    unsigned n_rows,
+                    unsigned n_idxs,
+                    unsigned const* idxs )
+{
+   assert( lp->displs );
+   assert( !n_idxs || idxs );
+
+   /* Row grouped index arrays are just CSR data. */
+   permutev( n_rows, &lp->displs, n_idxs, idxs, (void**)&lp->idxs, MPI_UNSIGNED, lp->comm );
+   lp->n_rows = n_idxs;
+   lp->n_idxs = lp->displs[n_idxs];
+   lp->identity = 0;
+}
+
+unsigned const*
+lazy_perm_displs( lazy_perm_t const* lp )
+{
+   return lp->displs;
+}
+
+void
+lazy_perm_apply( lazy_perm_t const* lp,
+                 void** data,
+                 MPI_Datatype data_type )
+{
+   if( lp->identity )
+      return;
+   permute( lp->n_src, lp->n_idxs, lp->idxs, data, data_type, lp->comm );
+}
+
+void
+lazy_perm_applyv( lazy_perm_t const* lp,
+                  unsigned** elem_displs,
+                  void** data,
+                  MPI_Datatype data_type )
+{
+   if( lp->identity )
+      return;
+   permutev( lp->n_src, elem_displs, lp->n_idxs, lp->idxs, data, data_type, lp->comm );
+}
@@ -0,0 +1,142 @@
+/*!
+** @file
+** @author Luke Hodkinson, 2014
+*/
+
+#ifndef lazy_perm_h
+#define lazy_perm_h
+
+#include <mpi.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*!
+** A lazily evaluated permutation. Records a sequence of
+** permute and permutev operations as a single mapping from
+** the original distributed array to the final layout, so the
+** payload only crosses the network once. Composing moves only
+** the index arrays.
+*/
+struct lazy_perm
+{
+   unsigned  n_src;
+   unsigned  n_idxs;
+   unsigned* idxs;
+   unsigned  n_rows;
+   unsigned* displs;
+   int       identity;
+   MPI_Comm  comm;
+};
+typedef struct lazy_perm lazy_perm_t;
+
+/*!
+** Initialise a lazy permutation to the identity over a block
+** distributed array.
+**
+** @param[out] lp    lazy permutation to initialise
+** @param[in]  n_src number of global source elements
+** @param[in]  comm  MPI communicator
+*/
+void
+lazy_perm_init( lazy_perm_t* lp,
+                unsigned n_src,
+                MPI_Comm comm );
+
+/*!
+** Release a lazy permutation.
+**
+** @param[inout] lp lazy permutation
+*/
+void
+lazy_perm_free( lazy_perm_t* lp );
+
+/*!
+** Record a permute. The current layout must be block
+** distributed over n_elems elements. Any row grouping is
+** discarded. Must be called collectively.
+**
+** @param[inout] lp      lazy permutation
+** @param[in]    n_elems number of global elements in the current layout
+** @param[in]    n_idxs  number of local desired indices
+** @param[in]    idxs    array of desired indices
+*/
+void
+lazy_perm_permute( lazy_perm_t* lp,
+                   unsigned n_elems,
+                   unsigned n_idxs,
+                   unsigned const* idxs );
+
+/*!
+** Group the current layout into rows, as if it were CSR
+** data with the given displacements.
+**
+** @param[inout] lp     lazy permutation
+** @param[in]    n_rows number of local rows
+** @param[in]    displs n_rows + 1 row displacements
+*/
+void
+lazy_perm_set_rows( lazy_perm_t* lp,
+                    unsigned n_rows,
+                    unsigned const* displs );
+
+/*!
+** Record a permutev over the rows of the current layout. The
+** rows must be block distributed over n_rows rows. Must be
+** called collectively.
+**
+** @param[inout] lp     lazy permutation
+** @param[in]    n_rows number of global rows in the current layout
+** @param[in]    n_idxs number of local desired rows
+** @param[in]    idxs   array of desired rows
+*/
+void
+lazy_perm_permutev( lazy_perm_t* lp,
+                    unsigned n_rows,
+                    unsigned n_idxs,
+                    unsigned const* idxs );
+
+/*!
+** Row displacements of the current layout, or NULL if it is
+** not grouped into rows. Owned by the lazy permutation.
+**
+** @param[in] lp lazy permutation
+*/
+unsigned const*
+lazy_perm_displs( lazy_perm_t const* lp );
+
+/*!
+** Apply the recorded permutation to fixed size data. Must be
+** called collectively.
+**
+** @param[in]    lp        lazy permutation
+** @param[inout] data      array of local source elements
+** @param[in]    data_type MPI datatype of data elements
+*/
+void
+lazy_perm_apply( lazy_perm_t const* lp,
+                 void** data,
+                 MPI_Datatype data_type );
+
+/*!
+** Apply the recorded permutation to CSR data, where each
+** source element is a row of items. Must be called
+** collectively.
+**
+** @param[in]    lp          lazy permutation
+** @param[inout] elem_displs displacements of local source elements
+** @param[inout] data        array of local source items
+** @param[in]    data_type   MPI datatype of items
+*/
+void
+lazy_perm_applyv( lazy_perm_t const* lp,
+                  unsigned** elem_displs,
+                  void** data,
+                  MPI_Datatype data_type );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -8,6 +8,10 @@
 
 #include <mpi.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 struct file_loader
 {
    unsigned  n_files;
@@ -110,4 +114,8 @@ fl_n_local_elems( file_loader_t const* fl );
 void
 fl_free( file_loader_t* fl );
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
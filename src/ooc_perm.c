@@ -0,0 +1,336 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "ooc_perm.h"
+#include "utils.h"
+
+#define OOC_TAG 3004
+#define OOC_MIN_BLOCK (1 << 16)
+
+/* File errors are not programming errors, so they are checked
+   whatever the build and abort every rank, rather than leave the
+   others waiting on an exchange. */
+void
+_ooc_fail( char const* what,
+           char const* path,
+           int err )
+{
+   fprintf( stderr, "cmpi: ooc_permute_push: %s %s: %s\n", what, path, err ? strerror( err ) : "unexpected end of file" );
+   MPI_Abort( MPI_COMM_WORLD, 1 );
+}
+
+int
+_open_file( char const* path,
+            int flags,
+            mode_t mode )
+{
+   int fd = open( path, flags, mode );
+
+   if( fd < 0 )
+      _ooc_fail( "cannot open", path, errno );
+   return fd;
+}
+
+void
+_read_at( int fd,
+          char const* path,
+          void* buf,
+          size_t size,
+          off_t offs )
+{
+   ssize_t n;
+
+   while( size )
+   {
+      n = pread( fd, buf, size, offs );
+      if( n < 0 && errno == EINTR )
+         continue;
+      if( n <= 0 )
+         _ooc_fail( "cannot read", path, n ? errno : 0 );
+      buf = (uint8_t*)buf + n;
+      size -= n;
+      offs += n;
+   }
+}
+
+void
+_write_at( int fd,
+           char const* path,
+           void const* buf,
+           size_t size,
+           off_t offs )
+{
+   ssize_t n;
+
+   while( size )
+   {
+      n = pwrite( fd, buf, size, offs );
+      if( n < 0 && errno == EINTR )
+         continue;
+      if( n <= 0 )
+         _ooc_fail( "cannot write", path, n ? errno : ENOSPC );
+      buf = (uint8_t const*)buf + n;
+      size -= n;
+      offs += n;
+   }
+}
+
+void
+_place_records( unsigned n_recs,
+                uint8_t const* recs,
+                MPI_Aint elem_size,
+                unsigned base,
+                unsigned n_out,
+                uint8_t* out )
+{
+   unsigned dst, ii;
+
+   for( ii = 0; ii < n_recs; ++ii, recs += sizeof(unsigned) + elem_size )
+   {
+      memcpy( &dst, recs, sizeof(unsigned) );
+      assert( dst >= base && dst < base + n_out );
+      memcpy( out + elem_size*(dst - base), recs + sizeof(unsigned), elem_size );
+   }
+}
+
+/* Each spilled block starts with a header linking it to the
+   previous block for the same destination, so only the last
+   block of each chain is held in memory. */
+struct ooc_block
+{
+   off_t    prev;
+   unsigned n_recs;
+};
+
+struct ooc_spill
+{
+   int         fd;
+   char const* path;
+   off_t       offs;
+   off_t*      tails;
+   unsigned*   cnts;
+};
+
+/* Blocks are written from a bucket slot whose first bytes are
+   left free for the header, so each block is a single write. */
+void
+_spill_block( struct ooc_spill* sp,
+              int dst,
+              uint8_t* slot,
+              unsigned n_recs,
+              size_t rec_size )
+{
+   struct ooc_block hdr;
+   size_t size = sizeof(struct ooc_block) + rec_size*n_recs;
+
+   hdr.prev = sp->tails[dst];
+   hdr.n_recs = n_recs;
+   memcpy( slot, &hdr, sizeof(struct ooc_block) );
+   _write_at( sp->fd, sp->path, slot, size, sp->offs );
+   sp->tails[dst] = sp->offs;
+   sp->offs += size;
+   sp->cnts[dst] += n_recs;
+}
+
+void
+ooc_permute_push( unsigned n_elems,
+                  unsigned n_local,
+                  char const* data_path,
+                  char const* dest_path,
+                  char const* out_path,
+                  char const* scratch_dir,
+                  size_t mem_limit,
+                  MPI_Datatype data_type,
+                  MPI_Comm comm )
+{
+   struct ooc_spill sp;
+   struct ooc_block hdr;
+   unsigned *bkt_cnts, *recv_cnts, *in_dests;
+   unsigned chunk, cap, min_recs, n_grp, done, n, n_out, base, ii;
+   uint8_t *buckets, *in_data, *send_buf, *recv_buf, *out = NULL, *ptr;
+   size_t rec_size, slot_size, recv_size, meta, half;
+   MPI_Aint lb, elem_size;
+   char path[4096];
+   int data_fd = -1, dest_fd = -1, out_fd, n_ranks, rank, dst, grp, rr;
+
+   assert( !n_local || (data_path && dest_path) );
+   assert( out_path && scratch_dir );
+
+   /* Private communicator, as for plans. */
+   MPI_OK( MPI_Comm_dup( comm, &comm ) );
+   MPI_OK( MPI_Comm_size( comm, &n_ranks ) );
+   MPI_OK( MPI_Comm_rank( comm, &rank ) );
+   MPI_OK( MPI_Type_get_extent( data_type, &lb, &elem_size ) );
+
+   /* Per destination bookkeeping comes out of the budget first.
+      Half the rest reads input, half holds the buckets. Each
+      record is a destination and an element. */
+   rec_size = sizeof(unsigned) + elem_size;
+   meta = n_ranks*(sizeof(off_t) + 3*sizeof(unsigned));
+   half = (mem_limit > meta) ? (mem_limit - meta)/2 : 0;
+   chunk = MAX( half/rec_size, 1 );
+
+   /* Blocks smaller than OOC_MIN_BLOCK make for slow scattered
+      writes. When the budget cannot hold a block that size for
+      every destination, the input is read once per group of
+      destinations that it can hold. */
+   min_recs = MAX( MIN( OOC_MIN_BLOCK, half )/rec_size, 1 );
+   n_grp = MAX( half/(rec_size*min_recs), 1 );
+   n_grp = MIN( n_grp, n_ranks );
+
+   /* A block goes out as one MPI_BYTE message, so its byte count
+      must fit in an int. */
+   cap = MIN( MAX( half/(rec_size*n_grp), min_recs ), INT_MAX/rec_size );
+   slot_size = sizeof(struct ooc_block) + rec_size*cap;
+
+   /* The spill file is unlinked straight away so it cannot be
+      left behind on scratch. */
+   snprintf( path, sizeof(path), "%s/cmpi_spill.%d.%d", scratch_dir, (int)getpid(), rank );
+   sp.fd = _open_file( path, O_RDWR | O_CREAT | O_TRUNC, 0600 );
+   sp.path = path;
+   unlink( path );
+   sp.offs = 0;
+   sp.tails = ALLOC( off_t, n_ranks );
+   sp.cnts = ALLOCZ( unsigned, n_ranks );
+   for( rr = 0; rr < n_ranks; ++rr )
+      sp.tails[rr] = -1;
+
+   /* Stream the input, bucketing records by owner and writing
+      out each bucket as it fills. */
+   buckets = ALLOC( uint8_t, slot_size*n_grp );
+   bkt_cnts = ALLOCZ( unsigned, n_grp );
+   in_data = ALLOC( uint8_t, elem_size*MIN( chunk, n_local ) );
+   in_dests = ALLOC( unsigned, MIN( chunk, n_local ) );
+   if( n_local )
+   {
+      data_fd = _open_file( data_path, O_RDONLY, 0 );
+      dest_fd = _open_file( dest_path, O_RDONLY, 0 );
+   }
+   for( grp = 0; grp < n_ranks; grp += n_grp )
+   {
+      for( done = 0; done < n_local; done += n )
+      {
+         n = MIN( chunk, n_local - done );
+         _read_at( data_fd, data_path, in_data, elem_size*n, (off_t)elem_size*done );
+         _read_at( dest_fd, dest_path, in_dests, sizeof(unsigned)*n, (off_t)sizeof(unsigned)*done );
+         for( ii = 0; ii < n; ++ii )
+         {
+            dst = locate_rank( n_elems, n_ranks, in_dests[ii] ) - grp;
+            if( dst < 0 || dst >= (int)n_grp )
+               continue;
+            ptr = buckets + slot_size*dst + sizeof(struct ooc_block) + rec_size*bkt_cnts[dst];
+            memcpy( ptr, in_dests + ii, sizeof(unsigned) );
+            memcpy( ptr + sizeof(unsigned), in_data + elem_size*ii, elem_size );
+            if( ++bkt_cnts[dst] == cap )
+            {
+               _spill_block( &sp, grp + dst, buckets + slot_size*dst, cap, rec_size );
+               bkt_cnts[dst] = 0;
+            }
+         }
+      }
+      for( rr = 0; rr < (int)n_grp && grp + rr < n_ranks; ++rr )
+      {
+         if( bkt_cnts[rr] )
+            _spill_block( &sp, grp + rr, buckets + slot_size*rr, bkt_cnts[rr], rec_size );
+         bkt_cnts[rr] = 0;
+      }
+   }
+   if( n_local )
+   {
+      close( data_fd );
+      close( dest_fd );
+   }
+   FREE( in_data );
+   FREE( in_dests );
+   FREE( buckets );
+   FREE( bkt_cnts );
+
+   /* Everyone learns how many records to expect. */
+   recv_cnts = ALLOC( unsigned, n_ranks );
+   MPI_OK( MPI_Alltoall( sp.cnts, 1, MPI_UNSIGNED, recv_cnts, 1, MPI_UNSIGNED, comm ) );
+
+   /* Map the output block. */
+   n_out = local_size( n_elems, n_ranks, rank );
+   MPI_OK( MPI_Scan( &n_out, &base, 1, MPI_UNSIGNED, MPI_SUM, comm ) );
+   base -= n_out;
+   out_fd = _open_file( out_path, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+   if( n_out )
+   {
+      if( ftruncate( out_fd, (off_t)elem_size*n_out ) )
+         _ooc_fail( "cannot size", out_path, errno );
+      out = (uint8_t*)mmap( NULL, elem_size*n_out, PROT_READ | PROT_WRITE, MAP_SHARED, out_fd, 0 );
+      if( out == MAP_FAILED )
+         _ooc_fail( "cannot map", out_path, errno );
+   }
+
+   /* Exchange buckets in rounds, sending to one rank while
+      receiving from another, a block at a time. Chains are
+      walked from their last block back. */
+   send_buf = ALLOC( uint8_t, rec_size*cap );
+   recv_size = 0;
+   recv_buf = NULL;
+   for( rr = 0; rr < n_ranks; ++rr )
+   {
+      int src = (rank - rr + n_ranks)%n_ranks;
+      unsigned n_sent = 0, n_recvd = 0;
+      off_t blk;
+
+      dst = (rank + rr)%n_ranks;
+      blk = sp.tails[dst];
+      while( n_sent < sp.cnts[dst] || n_recvd < recv_cnts[src] )
+      {
+         MPI_Request req = MPI_REQUEST_NULL;
+         MPI_Status status;
+         int len;
+
+         if( n_sent < sp.cnts[dst] )
+         {
+            assert( blk >= 0 );
+            _read_at( sp.fd, sp.path, &hdr, sizeof(struct ooc_block), blk );
+            _read_at( sp.fd, sp.path, send_buf, rec_size*hdr.n_recs, blk + sizeof(struct ooc_block) );
+            n_sent += hdr.n_recs;
+            blk = hdr.prev;
+            if( dst == rank )
+            {
+               _place_records( hdr.n_recs, send_buf, elem_size, base, n_out, out );
+               n_recvd += hdr.n_recs;
+               continue;
+            }
+            MPI_OK( MPI_Isend( send_buf, rec_size*hdr.n_recs, MPI_BYTE, dst, OOC_TAG, comm, &req ) );
+         }
+         if( n_recvd < recv_cnts[src] )
+         {
+            MPI_OK( MPI_Probe( src, OOC_TAG, comm, &status ) );
+            MPI_OK( MPI_Get_count( &status, MPI_BYTE, &len ) );
+            if( len > recv_size )
+            {
+               FREE( recv_buf );
+               recv_size = len;
+               recv_buf = ALLOC( uint8_t, recv_size );
+            }
+            MPI_OK( MPI_Recv( recv_buf, len, MPI_BYTE, src, OOC_TAG, comm, MPI_STATUS_IGNORE ) );
+            _place_records( len/rec_size, recv_buf, elem_size, base, n_out, out );
+            n_recvd += len/rec_size;
+         }
+         MPI_OK( MPI_Wait( &req, MPI_STATUS_IGNORE ) );
+      }
+   }
+   FREE( send_buf );
+   FREE( recv_buf );
+
+   if( n_out )
+      munmap( out, elem_size*n_out );
+   close( out_fd );
+   close( sp.fd );
+   FREE( sp.tails );
+   FREE( sp.cnts );
+   FREE( recv_cnts );
+   MPI_OK( MPI_Comm_free( &comm ) );
+}
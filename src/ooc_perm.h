@@ -0,0 +1,62 @@
+/*!
+** @file
+** @author Luke Hodkinson, 2014
+*/
+
+#ifndef ooc_perm_h
+#define ooc_perm_h
+
+#include <stddef.h>
+#include <mpi.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*!
+** Permute data too large to hold in memory. Each rank streams
+** its elements and their global destinations from files,
+** buckets the elements by owner into a spill file on local
+** scratch using large sequential writes, then exchanges the
+** buckets with every other rank in turn. Received elements are
+** written straight into a memory mapped output file, which ends
+** up holding this rank's block of the permuted array. At most
+** around mem_limit bytes, bookkeeping included, are resident at
+** once. Spilled blocks are kept to at least 64KB, within the
+** budget; when that many blocks for every rank do not fit, the
+** input is read again for each group of ranks that does.
+**
+** Element files hold raw records of the datatype's extent, and
+** destination files hold one unsigned per element. A pull style
+** index array, as given to permute, can be turned into
+** destinations by pushing the output positions themselves with
+** MPI_UNSIGNED elements. A file that cannot be opened, read or
+** written, or that is shorter than n_local says, is reported on
+** stderr and aborts the job.
+**
+** @param[in] n_elems     number of global data elements
+** @param[in] n_local     number of local elements in the files
+** @param[in] data_path   file of local data elements
+** @param[in] dest_path   file of global destination indices
+** @param[in] out_path    file to write the permuted block to
+** @param[in] scratch_dir directory for spill files
+** @param[in] mem_limit   memory budget in bytes
+** @param[in] data_type   MPI datatype of data elements
+** @param[in] comm        MPI communicator
+*/
+void
+ooc_permute_push( unsigned n_elems,
+                  unsigned n_local,
+                  char const* data_path,
+                  char const* dest_path,
+                  char const* out_path,
+                  char const* scratch_dir,
+                  size_t mem_limit,
+                  MPI_Datatype data_type,
+                  MPI_Comm comm );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
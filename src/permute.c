@@ -1,24 +1,109 @@
 #include <stdlib.h>
+#include <stdio.h>
 #include <stdint.h>
+#include <limits.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
 #include "permute.h"
+#include "fields.h"
+#include "replica.h"
+#include "kernels.h"
 #include "utils.h"
 
+#define SCATTER_TAG 3001
+#define PLAN_UPDATE_TAG 3002
+#define EXECV_UNIT 64
+
+static int shared_key = MPI_KEYVAL_INVALID;
+static pthread_once_t shared_once = PTHREAD_ONCE_INIT;
+
+int
+_shared_delete( MPI_Comm comm,
+                int key,
+                void* val,
+                void* extra )
+{
+   MPI_Comm shared = *(MPI_Comm*)val;
+
+   FREE( val );
+   return MPI_Comm_free( &shared );
+}
+
 void
-count_required( unsigned n_elems,
-                unsigned n_idxs,
-                unsigned const* idxs,
-                int n_ranks,
-                unsigned* req_cnts,
-                unsigned* req_displs )
+_shared_create( void )
+{
+   MPI_OK( MPI_Comm_create_keyval( MPI_COMM_NULL_COPY_FN, _shared_delete, &shared_key, NULL ) );
+}
+
+MPI_Comm
+_shared_comm( MPI_Comm comm )
+{
+   MPI_Comm* shared;
+   int found;
+
+   /* Duplicating costs far more than a small collective, so
+      single use plans share one duplicate per communicator,
+      stored on it and freed along with it. */
+   pthread_once( &shared_once, _shared_create );
+   MPI_OK( MPI_Comm_get_attr( comm, shared_key, &shared, &found ) );
+   if( !found )
+   {
+      shared = ALLOC( MPI_Comm, 1 );
+      MPI_OK( MPI_Comm_dup( comm, shared ) );
+      MPI_OK( MPI_Comm_set_attr( comm, shared_key, shared ) );
+   }
+   return *shared;
+}
+
+int
+_find_rank( unsigned const* displs,
+            int n_ranks,
+            unsigned pos )
+{
+   int lo = 0, hi = n_ranks - 1, mid;
+
+   /* Last rank whose displacement is not beyond the position. */
+   while( lo < hi )
+   {
+      mid = (lo + hi + 1)/2;
+      if( displs[mid] <= pos )
+         lo = mid;
+      else
+         hi = mid - 1;
+   }
+   return lo;
+}
+
+int
+_owner( unsigned n_elems,
+        unsigned const* dist,
+        int n_ranks,
+        unsigned idx )
+{
+   if( dist )
+   {
+      assert( idx < dist[n_ranks] );
+      return _find_rank( dist, n_ranks, idx );
+   }
+   return locate_rank( n_elems, n_ranks, idx );
+}
+
+void
+count_required_dist( unsigned n_elems,
+                     unsigned const* dist,
+                     unsigned n_idxs,
+                     unsigned const* idxs,
+                     int n_ranks,
+                     unsigned* req_cnts,
+                     unsigned* req_displs )
 {
    int rank;
    unsigned ii;
 
    for( ii = 0; ii < n_idxs; ++ii )
    {
-      rank = locate_rank( n_elems, n_ranks, idxs[ii] );
+      rank = _owner( n_elems, dist, n_ranks, idxs[ii] );
       assert( rank < n_ranks );
       ++req_cnts[rank];
    }
@@ -27,14 +112,26 @@ count_required( unsigned n_elems,
 }
 
 void
-make_required( unsigned n_elems,
-               unsigned n_idxs,
-               unsigned const* idxs,
-               int n_ranks,
-               unsigned* req_idxs,
-               unsigned* req_cnts,
-               unsigned const* req_displs,
-               unsigned* local )
+count_required( unsigned n_elems,
+                unsigned n_idxs,
+                unsigned const* idxs,
+                int n_ranks,
+                unsigned* req_cnts,
+                unsigned* req_displs )
+{
+   count_required_dist( n_elems, NULL, n_idxs, idxs, n_ranks, req_cnts, req_displs );
+}
+
+void
+make_required_dist( unsigned n_elems,
+                    unsigned const* dist,
+                    unsigned n_idxs,
+                    unsigned const* idxs,
+                    int n_ranks,
+                    unsigned* req_idxs,
+                    unsigned* req_cnts,
+                    unsigned const* req_displs,
+                    unsigned* local )
 {
    int rank;
    unsigned ii;
@@ -43,7 +140,7 @@ make_required( unsigned n_elems,
 
    for( ii = 0; ii < n_idxs; ++ii )
    {
-      rank = locate_rank( n_elems, n_ranks, idxs[ii] );
+      rank = _owner( n_elems, dist, n_ranks, idxs[ii] );
       assert( rank < n_ranks );
       req_idxs[req_displs[rank] + req_cnts[rank]] = idxs[ii];
       local[req_displs[rank] + req_cnts[rank]] = ii;
@@ -52,107 +149,407 @@ make_required( unsigned n_elems,
 }
 
 void
-scatter( unsigned n_elems,
-         unsigned n_idxs,
-         unsigned const* idxs,
-         void const* data,
-         void** recv_data,
-         MPI_Datatype data_type,
-         MPI_Comm comm )
+make_required( unsigned n_elems,
+               unsigned n_idxs,
+               unsigned const* idxs,
+               int n_ranks,
+               unsigned* req_idxs,
+               unsigned* req_cnts,
+               unsigned const* req_displs,
+               unsigned* local )
 {
-   MPI_Datatype *out_types, *inc_types;
-   unsigned *req_cnts, *req_displs, *req_idxs, *local;
-   unsigned *out_cnts, *out_displs, *out_idxs;
-   unsigned *ones, *zeros;
-   unsigned n_local_elems, base;
-   MPI_Aint elem_size;
-   void *inc_data;
-   int n_ranks, rank, ii, jj;
+   make_required_dist( n_elems, NULL, n_idxs, idxs, n_ranks, req_idxs, req_cnts, req_displs, local );
+}
 
-   assert( !n_elems || idxs );
-   assert( !n_elems || data );
+void
+_plan_init( scatter_plan_t* plan,
+            unsigned n_elems,
+            unsigned const* dist,
+            unsigned n_idxs,
+            unsigned const* idxs,
+            MPI_Comm comm,
+            int shared )
+{
+   unsigned *req_idxs;
+   unsigned n_out, ii;
+   int n_ranks, rank;
+
+   assert( plan );
+   assert( !n_idxs || idxs );
    assert( !n_elems || comm );
 
    MPI_OK( MPI_Comm_size( comm, &n_ranks ) );
    MPI_OK( MPI_Comm_rank( comm, &rank ) );
+   plan->n_ranks = n_ranks;
+   plan->rank = rank;
+   plan->n_elems = n_elems;
+   plan->n_idxs = n_idxs;
+   plan->dist = NULL;
+   if( dist )
+   {
+      plan->dist = ALLOC( unsigned, n_ranks + 1 );
+      memcpy( plan->dist, dist, sizeof(unsigned)*(n_ranks + 1) );
+   }
+
+   /* Every plan talks over its own communicator, so plans may
+      be executed from different threads at once without their
+      messages or collectives matching each other. */
+   plan->own_comm = !shared;
+   if( shared )
+      plan->comm = _shared_comm( comm );
+   else
+      MPI_OK( MPI_Comm_dup( comm, &plan->comm ) );
 
    /* Count the number of required elements coming from
       each processor, using a full array. */
-   req_cnts = ALLOCZ( unsigned, n_ranks );
-   req_displs = ALLOC( unsigned, n_ranks );
-   count_required( n_elems, n_idxs, idxs, n_ranks, req_cnts, req_displs );
+   plan->req_cnts = ALLOCZ( unsigned, n_ranks );
+   plan->req_displs = ALLOC( unsigned, n_ranks );
+   count_required_dist( n_elems, dist, n_idxs, idxs, n_ranks, plan->req_cnts, plan->req_displs );
 
    /* Calculate required indices. */
-   req_idxs = ALLOC( unsigned, req_displs[n_ranks - 1] + req_cnts[n_ranks - 1] );
-   local = ALLOC( unsigned, req_displs[n_ranks - 1] + req_cnts[n_ranks - 1] );
-   make_required( n_elems, n_idxs, idxs, n_ranks, req_idxs, req_cnts, req_displs, local );
+   req_idxs = ALLOC( unsigned, n_idxs );
+   plan->local = ALLOC( unsigned, n_idxs );
+   make_required_dist( n_elems, dist, n_idxs, idxs, n_ranks, req_idxs, plan->req_cnts, plan->req_displs,
+                       plan->local );
 
    /* Send information about sizes. */
-   out_cnts = ALLOC( unsigned, n_ranks );
-   out_displs = ALLOC( unsigned, n_ranks );
-   MPI_OK( MPI_Alltoall( req_cnts, 1, MPI_UNSIGNED, out_cnts, 1, MPI_UNSIGNED, comm ) );
-   make_displs( n_ranks, out_cnts, out_displs );
+   plan->out_cnts = ALLOC( unsigned, n_ranks );
+   plan->out_displs = ALLOC( unsigned, n_ranks );
+   MPI_OK( MPI_Alltoall( plan->req_cnts, 1, MPI_UNSIGNED, plan->out_cnts, 1, MPI_UNSIGNED, plan->comm ) );
+   make_displs( n_ranks, plan->out_cnts, plan->out_displs );
+   n_out = plan->out_displs[n_ranks - 1] + plan->out_cnts[n_ranks - 1];
 
    /* Send information about required indices. */
-   out_idxs = ALLOC( unsigned, out_displs[n_ranks - 1] + out_cnts[n_ranks - 1] );
-   MPI_OK( MPI_Alltoallv( req_idxs, (int*)req_cnts, (int*)req_displs, MPI_UNSIGNED,
-                          out_idxs, (int*)out_cnts, (int*)out_displs, MPI_UNSIGNED, comm ) );
+   plan->out_idxs = ALLOC( unsigned, n_out );
+   MPI_OK( MPI_Alltoallv( req_idxs, (int*)plan->req_cnts, (int*)plan->req_displs, MPI_UNSIGNED,
+                          plan->out_idxs, (int*)plan->out_cnts, (int*)plan->out_displs, MPI_UNSIGNED, plan->comm ) );
    FREE( req_idxs );
 
-   /* Use a scan to find my base. */
-   n_local_elems = local_size( n_elems, n_ranks, rank );
-   MPI_OK( MPI_Scan( &n_local_elems, &base, 1, MPI_UNSIGNED, MPI_SUM, comm ) );
-   base -= n_local_elems;
+   /* Use a scan to find my base, unless the distribution
+      says already. */
+   if( dist )
+   {
+      plan->n_local_elems = dist[rank + 1] - dist[rank];
+      plan->base = dist[rank];
+   }
+   else
+   {
+      plan->n_local_elems = local_size( n_elems, n_ranks, rank );
+      MPI_OK( MPI_Scan( &plan->n_local_elems, &plan->base, 1, MPI_UNSIGNED, MPI_SUM, plan->comm ) );
+      plan->base -= plan->n_local_elems;
+   }
 
    /* Ensure outgoing indices are local indices. */
-   for( ii = 0; ii < out_displs[n_ranks - 1] + out_cnts[n_ranks - 1]; ++ii )
+   for( ii = 0; ii < n_out; ++ii )
+   {
+      assert( plan->out_idxs[ii] >= plan->base && plan->out_idxs[ii] < plan->base + plan->n_local_elems );
+      plan->out_idxs[ii] -= plan->base;
+   }
+}
+
+void
+scatter_plan_init( scatter_plan_t* plan,
+                   unsigned n_elems,
+                   unsigned n_idxs,
+                   unsigned const* idxs,
+                   MPI_Comm comm )
+{
+   _plan_init( plan, n_elems, NULL, n_idxs, idxs, comm, 0 );
+}
+
+void
+scatter_plan_init_shared( scatter_plan_t* plan,
+                          unsigned n_elems,
+                          unsigned n_idxs,
+                          unsigned const* idxs,
+                          MPI_Comm comm )
+{
+   _plan_init( plan, n_elems, NULL, n_idxs, idxs, comm, 1 );
+}
+
+void
+scatter_plan_init_dist( scatter_plan_t* plan,
+                        unsigned const* dist,
+                        unsigned n_idxs,
+                        unsigned const* idxs,
+                        MPI_Comm comm )
+{
+   int n_ranks;
+
+   assert( dist );
+
+   MPI_OK( MPI_Comm_size( comm, &n_ranks ) );
+   _plan_init( plan, dist[n_ranks], dist, n_idxs, idxs, comm, 0 );
+}
+
+void
+scatter_plan_free( scatter_plan_t* plan )
+{
+   FREE( plan->dist );
+   FREE( plan->req_cnts );
+   FREE( plan->req_displs );
+   FREE( plan->local );
+   FREE( plan->out_cnts );
+   FREE( plan->out_displs );
+   FREE( plan->out_idxs );
+   if( plan->own_comm )
+      MPI_OK( MPI_Comm_free( &plan->comm ) );
+}
+
+void
+scatter_plan_update( scatter_plan_t* plan,
+                     unsigned n_removed,
+                     unsigned const* removed,
+                     unsigned n_added,
+                     unsigned const* added )
+{
+   int n_ranks = plan->n_ranks, rr;
+   unsigned *slots, *rm_slot, *new_pos, *rm_cnts, *add_cnts, *add_displs, *add_idxs, *add_local;
+   unsigned **msgs, *new_cnts, *new_displs, *new_local, *new_out;
+   unsigned n_idxs = plan->n_idxs, n_new, n_out, ii, jj, kk;
+   MPI_Request *send_reqs, barrier;
+   int n_sends, done, active, flag, src, len;
+   MPI_Status status;
+
+   assert( !n_removed || removed );
+   assert( !n_added || added );
+
+   /* Map request positions to their slots in the per rr lists,
+      and flag the slots being removed. */
+   slots = ALLOC( unsigned, n_idxs );
+   for( ii = 0; ii < n_idxs; ++ii )
+      slots[plan->local[ii]] = ii;
+   rm_slot = ALLOCZ( unsigned, n_idxs + 1 );
+   rm_cnts = ALLOCZ( unsigned, n_ranks );
+   for( ii = 0; ii < n_removed; ++ii )
+   {
+      assert( removed[ii] < n_idxs );
+      kk = slots[removed[ii]];
+      assert( !rm_slot[kk] );
+      rm_slot[kk] = 1;
+      ++rm_cnts[_find_rank( plan->req_displs, n_ranks, kk )];
+   }
+   FREE( slots );
+
+   /* Surviving requests close ranks; additions go on the end. */
+   new_pos = ALLOC( unsigned, n_idxs );
+   {
+      unsigned *rm_pos = ALLOCZ( unsigned, n_idxs );
+
+      for( ii = 0; ii < n_removed; ++ii )
+         rm_pos[removed[ii]] = 1;
+      for( ii = 0, kk = 0; ii < n_idxs; ++ii )
+      {
+         new_pos[ii] = ii - kk;
+         kk += rm_pos[ii];
+      }
+      FREE( rm_pos );
+   }
+   n_new = n_idxs - n_removed + n_added;
+
+   /* Group the additions by owner. */
+   add_cnts = ALLOCZ( unsigned, n_ranks );
+   add_displs = ALLOC( unsigned, n_ranks );
+   count_required_dist( plan->n_elems, plan->dist, n_added, added, n_ranks, add_cnts, add_displs );
+   add_idxs = ALLOC( unsigned, n_added );
+   add_local = ALLOC( unsigned, n_added );
+   make_required_dist( plan->n_elems, plan->dist, n_added, added, n_ranks, add_idxs, add_cnts, add_displs,
+                       add_local );
+
+   /* Tell each affected owner which of its slots to drop and which
+      indices to append. Only owners with changes get a message. */
+   msgs = ALLOC( unsigned*, n_ranks );
+   send_reqs = ALLOC( MPI_Request, n_ranks );
+   n_sends = 0;
+   for( rr = 0; rr < n_ranks; ++rr )
+   {
+      unsigned *msg;
+
+      msgs[rr] = NULL;
+      if( !rm_cnts[rr] && !add_cnts[rr] )
+         continue;
+      msg = msgs[rr] = ALLOC( unsigned, 2 + rm_cnts[rr] + add_cnts[rr] );
+      msg[0] = rm_cnts[rr];
+      for( ii = 0, kk = 1; ii < plan->req_cnts[rr]; ++ii )
+      {
+         if( rm_slot[plan->req_displs[rr] + ii] )
+            msg[kk++] = ii;
+      }
+      msg[kk++] = add_cnts[rr];
+      memcpy( msg + kk, add_idxs + add_displs[rr], sizeof(unsigned)*add_cnts[rr] );
+      MPI_OK( MPI_Issend( msg, 2 + rm_cnts[rr] + add_cnts[rr], MPI_UNSIGNED, rr,
+                          PLAN_UPDATE_TAG, plan->comm, send_reqs + n_sends++ ) );
+   }
+
+   /* Receive an unknown number of messages: keep probing until all
+      our sends are matched, then join a non-blocking barrier, and
+      stop once everyone has joined. */
    {
-      assert( out_idxs[ii] >= base && out_idxs[ii] < base + n_local_elems );
-      out_idxs[ii] -= base;
+      unsigned **inc = ALLOCZ( unsigned*, n_ranks );
+
+      active = 0;
+      done = 0;
+      while( !done )
+      {
+         MPI_OK( MPI_Iprobe( MPI_ANY_SOURCE, PLAN_UPDATE_TAG, plan->comm, &flag, &status ) );
+         if( flag )
+         {
+            src = status.MPI_SOURCE;
+            MPI_OK( MPI_Get_count( &status, MPI_UNSIGNED, &len ) );
+            inc[src] = ALLOC( unsigned, len );
+            MPI_OK( MPI_Recv( inc[src], len, MPI_UNSIGNED, src, PLAN_UPDATE_TAG, plan->comm,
+                              MPI_STATUS_IGNORE ) );
+         }
+         if( !active )
+         {
+            MPI_OK( MPI_Testall( n_sends, send_reqs, &flag, MPI_STATUSES_IGNORE ) );
+            if( flag )
+            {
+               MPI_OK( MPI_Ibarrier( plan->comm, &barrier ) );
+               active = 1;
+            }
+         }
+         else
+            MPI_OK( MPI_Test( &barrier, &done, MPI_STATUS_IGNORE ) );
+      }
+      for( rr = 0; rr < n_ranks; ++rr )
+      {
+         FREE( msgs[rr] );
+         msgs[rr] = inc[rr];
+      }
+      FREE( inc );
+   }
+   FREE( send_reqs );
+
+   /* Patch the outgoing lists. */
+   new_cnts = ALLOC( unsigned, n_ranks );
+   for( rr = 0; rr < n_ranks; ++rr )
+   {
+      new_cnts[rr] = plan->out_cnts[rr];
+      if( msgs[rr] )
+         new_cnts[rr] += msgs[rr][1 + msgs[rr][0]] - msgs[rr][0];
+   }
+   new_displs = ALLOC( unsigned, n_ranks );
+   make_displs( n_ranks, new_cnts, new_displs );
+   n_out = new_displs[n_ranks - 1] + new_cnts[n_ranks - 1];
+   new_out = ALLOC( unsigned, n_out );
+   for( rr = 0; rr < n_ranks; ++rr )
+   {
+      unsigned const *msg = msgs[rr], *old = plan->out_idxs + plan->out_displs[rr];
+      unsigned *dst = new_out + new_displs[rr];
+      unsigned n_rm = msg ? msg[0] : 0;
+
+      /* Removed slots arrive in ascending order. */
+      for( ii = 0, jj = 0, kk = 0; ii < plan->out_cnts[rr]; ++ii )
+      {
+         if( jj < n_rm && msg[1 + jj] == ii )
+            ++jj;
+         else
+            dst[kk++] = old[ii];
+      }
+      if( msg )
+      {
+         for( ii = 0; ii < msg[1 + n_rm]; ++ii )
+         {
+            unsigned idx = msg[2 + n_rm + ii];
+
+            assert( idx >= plan->base && idx < plan->base + plan->n_local_elems );
+            dst[kk++] = idx - plan->base;
+         }
+      }
+      assert( kk == new_cnts[rr] );
+      FREE( msgs[rr] );
    }
+   FREE( msgs );
+   FREE( plan->out_cnts );
+   FREE( plan->out_displs );
+   FREE( plan->out_idxs );
+   plan->out_cnts = new_cnts;
+   plan->out_displs = new_displs;
+   plan->out_idxs = new_out;
+
+   /* Patch the requested lists the same way. */
+   new_cnts = ALLOC( unsigned, n_ranks );
+   for( rr = 0; rr < n_ranks; ++rr )
+      new_cnts[rr] = plan->req_cnts[rr] - rm_cnts[rr] + add_cnts[rr];
+   new_displs = ALLOC( unsigned, n_ranks );
+   make_displs( n_ranks, new_cnts, new_displs );
+   new_local = ALLOC( unsigned, n_new );
+   for( rr = 0; rr < n_ranks; ++rr )
+   {
+      unsigned *dst = new_local + new_displs[rr];
+
+      for( ii = 0, kk = 0; ii < plan->req_cnts[rr]; ++ii )
+      {
+         jj = plan->req_displs[rr] + ii;
+         if( !rm_slot[jj] )
+            dst[kk++] = new_pos[plan->local[jj]];
+      }
+      for( ii = 0; ii < add_cnts[rr]; ++ii )
+         dst[kk++] = n_idxs - n_removed + add_local[add_displs[rr] + ii];
+      assert( kk == new_cnts[rr] );
+   }
+   FREE( plan->req_cnts );
+   FREE( plan->req_displs );
+   FREE( plan->local );
+   plan->req_cnts = new_cnts;
+   plan->req_displs = new_displs;
+   plan->local = new_local;
+   plan->n_idxs = n_new;
+
+   FREE( rm_slot );
+   FREE( rm_cnts );
+   FREE( new_pos );
+   FREE( add_cnts );
+   FREE( add_displs );
+   FREE( add_idxs );
+   FREE( add_local );
+}
+
+void
+scatter_plan_execute( scatter_plan_t const* plan,
+                      void const* data,
+                      void* recv_data,
+                      MPI_Datatype data_type )
+{
+   MPI_Datatype *out_types, *inc_types;
+   unsigned *ones, *zeros;
+   int n_ranks = plan->n_ranks, ii, jj;
 
    /* Create datatypes for outgoing information. */
    out_types = ALLOC( MPI_Datatype, n_ranks );
    for( ii = 0; ii < n_ranks; ++ii )
    {
-      ones = ALLOC( unsigned, out_cnts[ii] );
-      for( jj = 0; jj < out_cnts[ii]; ++jj )
+      ones = ALLOC( unsigned, plan->out_cnts[ii] );
+      for( jj = 0; jj < plan->out_cnts[ii]; ++jj )
          ones[jj] = 1;
-      MPI_OK( MPI_Type_indexed( out_cnts[ii], (int*)ones, (int*)(out_idxs + out_displs[ii]),
+      MPI_OK( MPI_Type_indexed( plan->out_cnts[ii], (int*)ones, (int*)(plan->out_idxs + plan->out_displs[ii]),
                                 data_type, out_types + ii ) );
       MPI_OK( MPI_Type_commit( out_types + ii ) );
       FREE( ones );
    }
-   FREE( out_cnts );
-   FREE( out_idxs );
-   FREE( out_displs );
 
    /* Create incoming datatypes to put information in the
       correct positions. */
    inc_types = ALLOC( MPI_Datatype, n_ranks );
    for( ii = 0; ii < n_ranks; ++ii )
    {
-      ones = ALLOC( unsigned, req_cnts[ii] );
-      for( jj = 0; jj < req_cnts[ii]; ++jj )
+      ones = ALLOC( unsigned, plan->req_cnts[ii] );
+      for( jj = 0; jj < plan->req_cnts[ii]; ++jj )
          ones[jj] = 1;
-      MPI_OK( MPI_Type_indexed( req_cnts[ii], (int*)ones, (int*)(local + req_displs[ii]),
+      MPI_OK( MPI_Type_indexed( plan->req_cnts[ii], (int*)ones, (int*)(plan->local + plan->req_displs[ii]),
                                 data_type, inc_types + ii ) );
       MPI_OK( MPI_Type_commit( inc_types + ii ) );
       FREE( ones );
    }
-   FREE( req_cnts );
-   FREE( local );
-   FREE( req_displs );
 
    /* Send/copy data. */
-   MPI_OK( MPI_Type_extent( data_type, &elem_size ) );
-   inc_data = (void*)ALLOC( uint8_t, n_idxs*elem_size );
    zeros = ALLOCZ( unsigned, n_ranks );
    ones = ALLOC( unsigned, n_ranks );
    for( ii = 0; ii < n_ranks; ++ii )
       ones[ii] = 1;
    MPI_OK( MPI_Alltoallw( (void*)data, (int*)ones, (int*)zeros, out_types,
-                          inc_data, (int*)ones, (int*)zeros, inc_types, comm ) );
+                          recv_data, (int*)ones, (int*)zeros, inc_types, plan->comm ) );
    FREE( zeros );
    FREE( ones );
 
@@ -164,188 +561,1087 @@ scatter( unsigned n_elems,
    }
    FREE( out_types );
    FREE( inc_types );
-
-   /* Store results. */
-   *recv_data = inc_data;
 }
 
 void
-scatterv( unsigned n_elems,
-          unsigned const* elem_displs,
-          unsigned n_idxs,
-          unsigned const* idxs,
-          void const* data,
-          void** recv_data,
-          unsigned** recv_displs,
-          MPI_Datatype data_type,
-          MPI_Comm comm )
+unpack_transform( unsigned n,
+                  unsigned const* idxs,
+                  size_t elem_size,
+                  size_t out_size,
+                  void const* src,
+                  void* dst,
+                  scatter_transform_t transform,
+                  void* ctx )
 {
-   MPI_Datatype *out_types, *inc_types;
-   unsigned *req_cnts, *req_displs, *req_idxs, *local;
-   unsigned *out_cnts, *out_displs, *out_idxs;
-   unsigned *ones, *zeros;
-   unsigned n_local_elems, base;
-   unsigned *elem_cnts, *inc_elem_displs, *inc_elem_cnts;
-   MPI_Aint elem_size;
-   void *inc_data;
-   int n_ranks, rank, ii, jj;
-
-   assert( !n_elems || idxs );
-   assert( !n_elems || data );
-   assert( !n_elems || comm );
-
-   MPI_OK( MPI_Comm_size( comm, &n_ranks ) );
-   MPI_OK( MPI_Comm_rank( comm, &rank ) );
-
-   /* Count the number of required elements coming from
-      each processor, using a full array. */
-   req_cnts = ALLOCZ( unsigned, n_ranks );
-   req_displs = ALLOC( unsigned, n_ranks );
-   count_required( n_elems, n_idxs, idxs, n_ranks, req_cnts, req_displs );
+   unsigned ii;
 
-   /* Calculate required indices. */
-   req_idxs = ALLOC( unsigned, req_displs[n_ranks - 1] + req_cnts[n_ranks - 1] );
-   local = ALLOC( unsigned, req_displs[n_ranks - 1] + req_cnts[n_ranks - 1] );
-   make_required( n_elems, n_idxs, idxs, n_ranks, req_idxs, req_cnts, req_displs, local );
+   if( !transform )
+   {
+      kernel_scatter( n, idxs, elem_size, src, dst );
+      return;
+   }
+   for( ii = 0; ii < n; ++ii )
+      transform( (uint8_t const*)src + ii*elem_size, (uint8_t*)dst + idxs[ii]*out_size, ctx );
+}
 
-   /* Send information about sizes. */
-   out_cnts = ALLOC( unsigned, n_ranks );
-   out_displs = ALLOC( unsigned, n_ranks );
-   MPI_OK( MPI_Alltoall( req_cnts, 1, MPI_UNSIGNED, out_cnts, 1, MPI_UNSIGNED, comm ) );
-   make_displs( n_ranks, out_cnts, out_displs );
+void
+scatter_plan_execute_transform( scatter_plan_t const* plan,
+                                void const* data,
+                                void* recv_data,
+                                MPI_Datatype data_type,
+                                size_t out_size,
+                                scatter_transform_t transform,
+                                void* ctx )
+{
+   MPI_Request *reqs;
+   MPI_Aint lb, elem_size;
+   uint8_t *out_buf, *inc_buf;
+   unsigned const *req_cnts = plan->req_cnts, *req_displs = plan->req_displs;
+   unsigned const *out_cnts = plan->out_cnts, *out_displs = plan->out_displs;
+   int *done;
+   int n_ranks = plan->n_ranks, rank = plan->rank, n_done;
+   int src, dst, ii, kk;
 
-   /* Send information about required indices. */
-   out_idxs = ALLOC( unsigned, out_displs[n_ranks - 1] + out_cnts[n_ranks - 1] );
-   MPI_OK( MPI_Alltoallv( req_idxs, (int*)req_cnts, (int*)req_displs, MPI_UNSIGNED,
-                          out_idxs, (int*)out_cnts, (int*)out_displs, MPI_UNSIGNED, comm ) );
-   FREE( req_idxs );
+   MPI_OK( MPI_Type_get_extent( data_type, &lb, &elem_size ) );
+   out_buf = ALLOC( uint8_t, elem_size*(out_displs[n_ranks - 1] + out_cnts[n_ranks - 1]) );
+   inc_buf = ALLOC( uint8_t, elem_size*plan->n_idxs );
+   done = ALLOC( int, n_ranks );
 
-   /* Use a scan to find my base. */
-   n_local_elems = local_size( n_elems, n_ranks, rank );
-   MPI_OK( MPI_Scan( &n_local_elems, &base, 1, MPI_UNSIGNED, MPI_SUM, comm ) );
-   base -= n_local_elems;
+   /* The first half of the requests are receives, indexed by
+      source rank, the second half sends, indexed by destination. */
+   reqs = ALLOC( MPI_Request, 2*n_ranks );
+   for( ii = 0; ii < 2*n_ranks; ++ii )
+      reqs[ii] = MPI_REQUEST_NULL;
 
-   /* Ensure outgoing indices are local indices. */
-   for( ii = 0; ii < out_displs[n_ranks - 1] + out_cnts[n_ranks - 1]; ++ii )
+   /* Post all receives up front, so nothing that arrives early
+      needs to be buffered by MPI. */
+   for( kk = 1; kk < n_ranks; ++kk )
    {
-      assert( out_idxs[ii] >= base && out_idxs[ii] < base + n_local_elems );
-      out_idxs[ii] -= base;
+      src = (rank - kk + n_ranks)%n_ranks;
+      if( req_cnts[src] )
+      {
+         MPI_OK( MPI_Irecv( inc_buf + elem_size*req_displs[src], req_cnts[src], data_type,
+                            src, SCATTER_TAG, plan->comm, reqs + src ) );
+      }
    }
 
-   /* Create datatypes for outgoing counts. */
-   out_types = ALLOC( MPI_Datatype, n_ranks );
-   for( ii = 0; ii < n_ranks; ++ii )
+   /* Our own elements never touch the network. */
+   if( !transform )
+      out_size = elem_size;
+   for( ii = 0; ii < out_cnts[rank]; ++ii )
    {
-      ones = ALLOC( unsigned, out_cnts[ii] );
-      for( jj = 0; jj < out_cnts[ii]; ++jj )
-         ones[jj] = 1;
-      MPI_OK( MPI_Type_indexed( out_cnts[ii], (int*)ones, (int*)(out_idxs + out_displs[ii]),
-                                MPI_UNSIGNED, out_types + ii ) );
-      MPI_OK( MPI_Type_commit( out_types + ii ) );
-      FREE( ones );
-   }
+      uint8_t const* elem = (uint8_t const*)data + elem_size*plan->out_idxs[out_displs[rank] + ii];
+      uint8_t* slot = (uint8_t*)recv_data + out_size*plan->local[req_displs[rank] + ii];
 
-   /* Create incoming datatypes to put counts int the
-      correct positions. */
-   inc_types = ALLOC( MPI_Datatype, n_ranks );
-   for( ii = 0; ii < n_ranks; ++ii )
-   {
-      ones = ALLOC( unsigned, req_cnts[ii] );
-      for( jj = 0; jj < req_cnts[ii]; ++jj )
-         ones[jj] = 1;
-      MPI_OK( MPI_Type_indexed( req_cnts[ii], (int*)ones, (int*)(local + req_displs[ii]),
-                                MPI_UNSIGNED, inc_types + ii ) );
-      MPI_OK( MPI_Type_commit( inc_types + ii ) );
-      FREE( ones );
+      if( transform )
+         transform( elem, slot, ctx );
+      else
+         memcpy( slot, elem, elem_size );
    }
 
-   /* Create element block counts and send. */
-   elem_cnts = ALLOC( unsigned, n_local_elems );
-   make_counts( n_local_elems, elem_displs, elem_cnts );
-   zeros = ALLOCZ( unsigned, n_ranks );
-   ones = ALLOC( unsigned, n_ranks );
-   for( ii = 0; ii < n_ranks; ++ii )
-      ones[ii] = 1;
-   inc_elem_cnts = ALLOC( unsigned, n_idxs );
-   MPI_OK( MPI_Alltoallw( elem_cnts, (int*)ones, (int*)zeros, out_types,
-                          inc_elem_cnts, (int*)ones, (int*)zeros, inc_types, comm ) );
-   inc_elem_displs = ALLOC( unsigned, n_idxs + 1 );
-   make_displs( n_idxs, inc_elem_cnts, inc_elem_displs );
-   inc_elem_displs[n_idxs] = inc_elem_displs[n_idxs - 1] + inc_elem_cnts[n_idxs - 1];
-
-   /* Create datatypes for outgoing data. */
-   for( ii = 0; ii < n_ranks; ++ii )
+   /* Walk the destinations pairwise, sending to rank + k while
+      rank - k is sending to us. Anything that has arrived while
+      we were packing is unpacked before moving on. */
+   for( kk = 1; kk < n_ranks; ++kk )
    {
-      unsigned *cnts, *displs;
-
-      cnts = ALLOC( unsigned, out_cnts[ii] );
-      displs = ALLOC( unsigned, out_cnts[ii] );
-      for( jj = 0; jj < out_cnts[ii]; ++jj )
+      dst = (rank + kk)%n_ranks;
+      if( out_cnts[dst] )
       {
-         displs[jj] = elem_displs[(out_idxs + out_displs[ii])[jj]];
-         cnts[jj] = elem_cnts[(out_idxs + out_displs[ii])[jj]];
+         kernel_gather( out_cnts[dst], plan->out_idxs + out_displs[dst], elem_size,
+                     data, out_buf + elem_size*out_displs[dst] );
+         MPI_OK( MPI_Isend( out_buf + elem_size*out_displs[dst], out_cnts[dst], data_type,
+                            dst, SCATTER_TAG, plan->comm, reqs + n_ranks + dst ) );
       }
 
-      MPI_OK( MPI_Type_free( out_types + ii ) );
-      MPI_OK( MPI_Type_indexed( out_cnts[ii], (int*)cnts, (int*)displs, data_type, out_types + ii ) );
-      MPI_OK( MPI_Type_commit( out_types + ii ) );
-
-      FREE( cnts );
-      FREE( displs );
+      MPI_OK( MPI_Testsome( n_ranks, reqs, &n_done, done, MPI_STATUSES_IGNORE ) );
+      for( ii = 0; ii < n_done && n_done != MPI_UNDEFINED; ++ii )
+      {
+         src = done[ii];
+         unpack_transform( req_cnts[src], plan->local + req_displs[src], elem_size, out_size,
+                           inc_buf + elem_size*req_displs[src], recv_data, transform, ctx );
+      }
    }
-   FREE( out_idxs );
-   FREE( out_cnts );
-   FREE( out_displs );
-   FREE( elem_cnts );
 
-   /* Create incoming datatypes to put counts int the
-      correct positions. */
-   for( ii = 0; ii < n_ranks; ++ii )
+   /* Drain the remaining receives as they complete. */
+   while( 1 )
    {
-      unsigned *cnts, *displs;
-
-      cnts = ALLOC( unsigned, req_cnts[ii] );
-      displs = ALLOC( unsigned, req_cnts[ii] );
-      for( jj = 0; jj < req_cnts[ii]; ++jj )
+      MPI_OK( MPI_Waitsome( n_ranks, reqs, &n_done, done, MPI_STATUSES_IGNORE ) );
+      if( n_done == MPI_UNDEFINED )
+         break;
+      for( ii = 0; ii < n_done; ++ii )
       {
-         displs[jj] = inc_elem_displs[(local + req_displs[ii])[jj]];
-         cnts[jj] = inc_elem_cnts[(local + req_displs[ii])[jj]];
+         src = done[ii];
+         unpack_transform( req_cnts[src], plan->local + req_displs[src], elem_size, out_size,
+                           inc_buf + elem_size*req_displs[src], recv_data, transform, ctx );
       }
+   }
+   MPI_OK( MPI_Waitall( n_ranks, reqs + n_ranks, MPI_STATUSES_IGNORE ) );
 
-      MPI_OK( MPI_Type_free( inc_types + ii ) );
-      MPI_OK( MPI_Type_indexed( req_cnts[ii], (int*)cnts, (int*)displs, data_type, inc_types + ii ) );
-      MPI_OK( MPI_Type_commit( inc_types + ii ) );
+   FREE( reqs );
+   FREE( done );
+   FREE( inc_buf );
+   FREE( out_buf );
+}
 
-      FREE( cnts );
-      FREE( displs );
-   }
-   FREE( req_cnts );
-   FREE( req_displs );
-   FREE( local );
+void
+scatter_plan_execute_pipelined( scatter_plan_t const* plan,
+                                void const* data,
+                                void* recv_data,
+                                MPI_Datatype data_type )
+{
+   scatter_plan_execute_transform( plan, data, recv_data, data_type, 0, NULL, NULL );
+}
 
-   /* Send/copy data. */
-   MPI_OK( MPI_Type_extent( data_type, &elem_size ) );
-   inc_data = (void*)ALLOC( uint8_t, elem_size*(inc_elem_displs[n_idxs - 1] + inc_elem_cnts[n_idxs - 1]) );
-   for( ii = 0; ii < n_ranks; ++ii )
-      ones[ii] = 1;
-   MPI_OK( MPI_Alltoallw( (void*)data, (int*)ones, (int*)zeros, out_types,
-                          inc_data, (int*)ones, (int*)zeros, inc_types, comm ) );
-   FREE( zeros );
-   FREE( ones );
-   FREE( inc_elem_cnts );
+void
+scatter_plan_execute_packed( scatter_plan_t const* plan,
+                             void const* data,
+                             void* recv_data,
+                             MPI_Datatype data_type )
+{
+   MPI_Aint lb, elem_size;
+   uint8_t *out_buf, *inc_buf;
+   unsigned n_out;
+   int n_ranks = plan->n_ranks;
 
-   /* Don't forget to free the types. */
-   for( ii = 0; ii < n_ranks; ++ii )
-   {
-      MPI_OK( MPI_Type_free( out_types + ii ) );
-      MPI_OK( MPI_Type_free( inc_types + ii ) );
+   /* Gather outgoing elements into a contiguous buffer
+      ordered by destination. */
+   MPI_OK( MPI_Type_get_extent( data_type, &lb, &elem_size ) );
+   n_out = plan->out_displs[n_ranks - 1] + plan->out_cnts[n_ranks - 1];
+   out_buf = ALLOC( uint8_t, elem_size*n_out );
+   kernel_gather( n_out, plan->out_idxs, elem_size, data, out_buf );
+
+   /* Exchange contiguous blocks. */
+   inc_buf = ALLOC( uint8_t, elem_size*plan->n_idxs );
+   MPI_OK( MPI_Alltoallv( out_buf, (int*)plan->out_cnts, (int*)plan->out_displs, data_type,
+                          inc_buf, (int*)plan->req_cnts, (int*)plan->req_displs, data_type, plan->comm ) );
+   FREE( out_buf );
+
+   /* Incoming blocks are in the same order as the local
+      array, so a single pass puts everything in place. */
+   kernel_scatter( plan->n_idxs, plan->local, elem_size, inc_buf, recv_data );
+   FREE( inc_buf );
+}
+
+void
+scatter_plan_execute_flat( scatter_plan_t const* plan,
+                           void const* data,
+                           void* recv_data,
+                           MPI_Datatype data_type )
+{
+   field_set_t const* fs;
+   MPI_Datatype rec_type;
+   MPI_Aint lb, extent;
+   uint8_t *out_buf, *inc_buf;
+   unsigned n_out;
+   int n_ranks = plan->n_ranks;
+
+   /* Predefined types have no holes. */
+   fs = field_set_cached( data_type );
+   if( !fs )
+   {
+      scatter_plan_execute_packed( plan, data, recv_data, data_type );
+      return;
    }
-   FREE( out_types );
-   FREE( inc_types );
 
-   /* Store results. */
+   /* Pack only the true bytes of each outgoing element. */
+   MPI_OK( MPI_Type_get_extent( data_type, &lb, &extent ) );
+   n_out = plan->out_displs[n_ranks - 1] + plan->out_cnts[n_ranks - 1];
+   out_buf = ALLOC( uint8_t, fs->size*n_out );
+   field_set_pack( fs, n_out, plan->out_idxs, extent, data, out_buf );
+
+   /* Exchange compact elements. */
+   MPI_OK( MPI_Type_contiguous( fs->size, MPI_BYTE, &rec_type ) );
+   MPI_OK( MPI_Type_commit( &rec_type ) );
+   inc_buf = ALLOC( uint8_t, fs->size*plan->n_idxs );
+   MPI_OK( MPI_Alltoallv( out_buf, (int*)plan->out_cnts, (int*)plan->out_displs, rec_type,
+                          inc_buf, (int*)plan->req_cnts, (int*)plan->req_displs, rec_type, plan->comm ) );
+   MPI_OK( MPI_Type_free( &rec_type ) );
+   FREE( out_buf );
+
+   field_set_unpack( fs, plan->n_idxs, plan->local, extent, inc_buf, recv_data );
+   FREE( inc_buf );
+}
+
+void
+scatter_plan_execute_grouped( scatter_plan_t const* plan,
+                              void const* data,
+                              void* recv_data,
+                              MPI_Datatype data_type )
+{
+   MPI_Aint lb, elem_size;
+   uint8_t *out_buf;
+   unsigned n_out;
+   int n_ranks = plan->n_ranks;
+
+   MPI_OK( MPI_Type_get_extent( data_type, &lb, &elem_size ) );
+   n_out = plan->out_displs[n_ranks - 1] + plan->out_cnts[n_ranks - 1];
+   out_buf = ALLOC( uint8_t, elem_size*n_out );
+   kernel_gather( n_out, plan->out_idxs, elem_size, data, out_buf );
+
+   /* Receive straight into the result; the blocks stay grouped
+      by source rank and plan->local says where each belongs. */
+   MPI_OK( MPI_Alltoallv( out_buf, (int*)plan->out_cnts, (int*)plan->out_displs, data_type,
+                          recv_data, (int*)plan->req_cnts, (int*)plan->req_displs, data_type, plan->comm ) );
+   FREE( out_buf );
+}
+
+void
+scatter_ungroup( unsigned n_idxs,
+                 unsigned const* local,
+                 void const* grouped,
+                 void* recv_data,
+                 MPI_Datatype data_type )
+{
+   MPI_Aint lb, elem_size;
+
+   assert( !n_idxs || (local && grouped && recv_data) );
+   MPI_OK( MPI_Type_get_extent( data_type, &lb, &elem_size ) );
+   kernel_scatter( n_idxs, local, elem_size, grouped, recv_data );
+}
+
+static char const* scatter_algo_names[SCATTER_N_ALGOS] = {
+   "indexed",
+   "packed",
+   "pipelined",
+   "flat"
+};
+
+static scatter_transport_t const scatter_transports[SCATTER_N_ALGOS] = {
+   scatter_plan_execute,
+   scatter_plan_execute_packed,
+   scatter_plan_execute_pipelined,
+   scatter_plan_execute_flat
+};
+
+void
+scatter_plan_stats( scatter_plan_t const* plan,
+                    MPI_Datatype data_type,
+                    scatter_stats_t* stats )
+{
+   MPI_Aint lb, elem_size;
+   double loc_sum[2], glob_sum[2], loc_max[2], glob_max[2];
+   unsigned n_partners = 0;
+   double bytes = 0.0;
+   int true_size, ii;
+
+   /* Only count off-rank traffic; local copies are cheap
+      regardless of the transport. */
+   MPI_OK( MPI_Type_get_extent( data_type, &lb, &elem_size ) );
+   MPI_OK( MPI_Type_size( data_type, &true_size ) );
+   for( ii = 0; ii < plan->n_ranks; ++ii )
+   {
+      if( ii == plan->rank || !plan->out_cnts[ii] )
+         continue;
+      ++n_partners;
+      bytes += (double)plan->out_cnts[ii]*(double)elem_size;
+   }
+
+   loc_sum[0] = loc_max[0] = n_partners;
+   loc_sum[1] = loc_max[1] = bytes;
+   MPI_OK( MPI_Allreduce( loc_sum, glob_sum, 2, MPI_DOUBLE, MPI_SUM, plan->comm ) );
+   MPI_OK( MPI_Allreduce( loc_max, glob_max, 2, MPI_DOUBLE, MPI_MAX, plan->comm ) );
+
+   stats->n_ranks = plan->n_ranks;
+   stats->elem_size = elem_size;
+   stats->true_size = true_size;
+   stats->max_partners = (unsigned)glob_max[0];
+   stats->total_bytes = glob_sum[1];
+   stats->bytes_per_pair = glob_sum[0] ? glob_sum[1]/glob_sum[0] : 0.0;
+   stats->skew = glob_sum[1] ? glob_max[1]/(glob_sum[1]/plan->n_ranks) : 1.0;
+}
+
+int
+scatter_select( scatter_stats_t const* stats )
+{
+   /* Nothing crosses the network; any transport will do, so
+      avoid creating datatypes and staging buffers. */
+   if( stats->total_bytes == 0.0 )
+      return SCATTER_ALGO_PACKED;
+
+   /* Sparse patterns: a full all-to-all pays latency to every
+      rank, while the pairwise schedule only touches partners. */
+   if( stats->max_partners < stats->n_ranks/4 )
+      return SCATTER_ALGO_PIPELINED;
+
+   /* Padded records waste staging memory and bandwidth; move
+      only their true bytes. */
+   if( 4*stats->true_size <= 3*stats->elem_size )
+      return SCATTER_ALGO_FLAT;
+
+   /* Latency bound messages are best left to the collective
+      algorithms of the MPI implementation. Large records are
+      moved by the datatype engine without staging copies. */
+   if( stats->bytes_per_pair < SCATTER_SMALL_PAIR_BYTES )
+   {
+      if( stats->elem_size >= SCATTER_LARGE_ELEM_BYTES )
+         return SCATTER_ALGO_INDEXED;
+      return SCATTER_ALGO_PACKED;
+   }
+
+   /* Bandwidth bound; overlap packing with communication. A
+      heavily skewed exchange is dominated by the busiest rank,
+      which benefits most from overlap anyway. */
+   return SCATTER_ALGO_PIPELINED;
+}
+
+char const*
+scatter_algo_name( int algo )
+{
+   assert( algo >= 0 && algo < SCATTER_N_ALGOS );
+   return scatter_algo_names[algo];
+}
+
+void
+scatter_tuner_init( scatter_tuner_t* tuner,
+                    char const* filename,
+                    int measure,
+                    MPI_Comm comm )
+{
+   int rank;
+   unsigned len;
+   char *buf = NULL;
+
+   assert( tuner );
+
+   tuner->n_entries = 0;
+   tuner->max_entries = 0;
+   tuner->keys = NULL;
+   tuner->algos = NULL;
+   tuner->filename = NULL;
+   tuner->measure = measure;
+   tuner->comm = comm;
+   pthread_mutex_init( &tuner->lock, NULL );
+   if( !filename )
+      return;
+   tuner->filename = ALLOC( char, strlen( filename ) + 1 );
+   strcpy( tuner->filename, filename );
+
+   /* Only the root touches the file, everyone else gets the
+      contents as a broadcast string so decisions match. */
+   MPI_OK( MPI_Comm_rank( comm, &rank ) );
+   len = 0;
+   if( rank == 0 )
+   {
+      FILE* file = fopen( filename, "r" );
+      if( file )
+      {
+         fseek( file, 0, SEEK_END );
+         len = ftell( file );
+         fseek( file, 0, SEEK_SET );
+         buf = ALLOC( char, len + 1 );
+         len = fread( buf, 1, len, file );
+         fclose( file );
+      }
+   }
+   MPI_OK( MPI_Bcast( &len, 1, MPI_UNSIGNED, 0, comm ) );
+   if( !len )
+   {
+      FREE( buf );
+      return;
+   }
+   if( rank != 0 )
+      buf = ALLOC( char, len + 1 );
+   MPI_OK( MPI_Bcast( buf, len, MPI_CHAR, 0, comm ) );
+   buf[len] = 0;
+
+   /* Each line holds "<key> <algorithm name>". */
+   {
+      char *line, *save, *sep;
+      int algo;
+
+      for( line = strtok_r( buf, "\n", &save ); line; line = strtok_r( NULL, "\n", &save ) )
+      {
+         sep = strrchr( line, ' ' );
+         if( !sep )
+            continue;
+         *sep++ = 0;
+         for( algo = 0; algo < SCATTER_N_ALGOS; ++algo )
+         {
+            if( !strcmp( sep, scatter_algo_names[algo] ) )
+            {
+               scatter_tuner_set( tuner, line, algo );
+               break;
+            }
+         }
+      }
+   }
+   FREE( buf );
+}
+
+void
+scatter_tuner_free( scatter_tuner_t* tuner )
+{
+   unsigned ii;
+   int rank;
+
+   if( tuner->filename )
+   {
+      MPI_OK( MPI_Comm_rank( tuner->comm, &rank ) );
+      if( rank == 0 )
+      {
+         FILE* file = fopen( tuner->filename, "w" );
+         if( file )
+         {
+            for( ii = 0; ii < tuner->n_entries; ++ii )
+               fprintf( file, "%s %s\n", tuner->keys[ii], scatter_algo_names[tuner->algos[ii]] );
+            fclose( file );
+         }
+      }
+      FREE( tuner->filename );
+   }
+   for( ii = 0; ii < tuner->n_entries; ++ii )
+      FREE( tuner->keys[ii] );
+   FREE( tuner->keys );
+   FREE( tuner->algos );
+   pthread_mutex_destroy( &tuner->lock );
+}
+
+int
+scatter_tuner_lookup( scatter_tuner_t* tuner,
+                      char const* key )
+{
+   unsigned ii;
+   int algo = -1;
+
+   pthread_mutex_lock( &tuner->lock );
+   for( ii = 0; ii < tuner->n_entries; ++ii )
+   {
+      if( !strcmp( tuner->keys[ii], key ) )
+      {
+         algo = tuner->algos[ii];
+         break;
+      }
+   }
+   pthread_mutex_unlock( &tuner->lock );
+   return algo;
+}
+
+void
+scatter_tuner_set( scatter_tuner_t* tuner,
+                   char const* key,
+                   int algo )
+{
+   unsigned ii;
+
+   assert( algo >= 0 && algo < SCATTER_N_ALGOS );
+   pthread_mutex_lock( &tuner->lock );
+   for( ii = 0; ii < tuner->n_entries; ++ii )
+   {
+      if( !strcmp( tuner->keys[ii], key ) )
+      {
+         tuner->algos[ii] = algo;
+         pthread_mutex_unlock( &tuner->lock );
+         return;
+      }
+   }
+
+   if( tuner->n_entries == tuner->max_entries )
+   {
+      tuner->max_entries = tuner->max_entries ? 2*tuner->max_entries : 8;
+      tuner->keys = (char**)realloc( tuner->keys, sizeof(char*)*tuner->max_entries );
+      tuner->algos = (int*)realloc( tuner->algos, sizeof(int)*tuner->max_entries );
+      assert( tuner->keys && tuner->algos );
+   }
+   tuner->keys[tuner->n_entries] = ALLOC( char, strlen( key ) + 1 );
+   strcpy( tuner->keys[tuner->n_entries], key );
+   tuner->algos[tuner->n_entries++] = algo;
+   pthread_mutex_unlock( &tuner->lock );
+}
+
+int
+scatter_plan_execute_auto( scatter_plan_t const* plan,
+                           void const* data,
+                           void* recv_data,
+                           MPI_Datatype data_type,
+                           scatter_tuner_t* tuner,
+                           char const* key )
+{
+   scatter_stats_t stats;
+   int algo = -1;
+
+   if( tuner && key )
+      algo = scatter_tuner_lookup( tuner, key );
+   if( algo >= 0 )
+   {
+      scatter_transports[algo]( plan, data, recv_data, data_type );
+      return algo;
+   }
+
+   if( tuner && key && tuner->measure )
+   {
+      double t, best_t = 0.0;
+      int ii;
+
+      /* Time every candidate on the real data. Each leaves a
+         complete result in recv_data, so the last run's output
+         is as good as any. The slowest rank decides. */
+      for( ii = 0; ii < SCATTER_N_ALGOS; ++ii )
+      {
+         MPI_OK( MPI_Barrier( plan->comm ) );
+         t = MPI_Wtime();
+         scatter_transports[ii]( plan, data, recv_data, data_type );
+         t = MPI_Wtime() - t;
+         MPI_OK( MPI_Allreduce( MPI_IN_PLACE, &t, 1, MPI_DOUBLE, MPI_MAX, plan->comm ) );
+         if( algo < 0 || t < best_t )
+         {
+            algo = ii;
+            best_t = t;
+         }
+      }
+   }
+   else
+   {
+      scatter_plan_stats( plan, data_type, &stats );
+      algo = scatter_select( &stats );
+      scatter_transports[algo]( plan, data, recv_data, data_type );
+   }
+
+   if( tuner && key )
+      scatter_tuner_set( tuner, key, algo );
+   return algo;
+}
+
+void
+scatter( unsigned n_elems,
+         unsigned n_idxs,
+         unsigned const* idxs,
+         void const* data,
+         void** recv_data,
+         MPI_Datatype data_type,
+         MPI_Comm comm )
+{
+   scatter_plan_t plan;
+   MPI_Aint lb, elem_size;
+
+   assert( !n_idxs || idxs );
+   assert( !n_elems || data );
+   assert( !n_elems || comm );
+
+   scatter_plan_init_shared( &plan, n_elems, n_idxs, idxs, comm );
+   MPI_OK( MPI_Type_get_extent( data_type, &lb, &elem_size ) );
+   *recv_data = (void*)ALLOC( uint8_t, n_idxs*elem_size );
+   scatter_plan_execute( &plan, data, *recv_data, data_type );
+   scatter_plan_free( &plan );
+}
+
+void
+scatter_pipelined( unsigned n_elems,
+                   unsigned n_idxs,
+                   unsigned const* idxs,
+                   void const* data,
+                   void** recv_data,
+                   MPI_Datatype data_type,
+                   MPI_Comm comm )
+{
+   scatter_plan_t plan;
+   MPI_Aint lb, elem_size;
+
+   assert( !n_idxs || idxs );
+   assert( !n_elems || data );
+   assert( !n_elems || comm );
+
+   scatter_plan_init_shared( &plan, n_elems, n_idxs, idxs, comm );
+   MPI_OK( MPI_Type_get_extent( data_type, &lb, &elem_size ) );
+   *recv_data = (void*)ALLOC( uint8_t, n_idxs*elem_size );
+   scatter_plan_execute_pipelined( &plan, data, *recv_data, data_type );
+   scatter_plan_free( &plan );
+}
+
+int
+scatter_should_replicate( unsigned n_elems,
+                          unsigned n_idxs,
+                          MPI_Datatype data_type,
+                          MPI_Comm comm )
+{
+   MPI_Aint lb, elem_size;
+   double total_idxs, n_ranks_d;
+   int n_ranks;
+
+   MPI_OK( MPI_Type_get_extent( data_type, &lb, &elem_size ) );
+   if( (double)n_elems*(double)elem_size <= SCATTER_REPLICATE_BYTES )
+      return 1;
+
+   /* When the mean rank requests so much that the pull exchange
+      (an index out, an index back and the element) would move as
+      many bytes as the whole array, replication is cheaper. */
+   MPI_OK( MPI_Comm_size( comm, &n_ranks ) );
+   total_idxs = n_idxs;
+   MPI_OK( MPI_Allreduce( MPI_IN_PLACE, &total_idxs, 1, MPI_DOUBLE, MPI_SUM, comm ) );
+   n_ranks_d = n_ranks;
+   return (total_idxs/n_ranks_d)*(double)(elem_size + 2*sizeof(unsigned)) >= (double)n_elems*(double)elem_size;
+}
+
+void
+scatter_replicated( unsigned n_elems,
+                    unsigned n_idxs,
+                    unsigned const* idxs,
+                    void const* data,
+                    void** recv_data,
+                    MPI_Datatype data_type,
+                    MPI_Comm comm )
+{
+   replica_t rep;
+
+   assert( !n_idxs || idxs );
+   assert( !n_elems || data );
+   assert( !n_elems || comm );
+
+   replica_init( &rep, n_elems, data, data_type, comm );
+   *recv_data = (void*)ALLOC( uint8_t, n_idxs*rep.elem_size );
+   replica_gather( &rep, n_idxs, idxs, *recv_data );
+   replica_free( &rep );
+}
+
+void
+scatter_auto( unsigned n_elems,
+              unsigned n_idxs,
+              unsigned const* idxs,
+              void const* data,
+              void** recv_data,
+              MPI_Datatype data_type,
+              MPI_Comm comm,
+              scatter_tuner_t* tuner,
+              char const* key )
+{
+   scatter_plan_t plan;
+   MPI_Aint lb, elem_size;
+
+   assert( !n_idxs || idxs );
+   assert( !n_elems || data );
+   assert( !n_elems || comm );
+
+   /* Small or densely requested arrays skip the index
+      exchange entirely. */
+   if( scatter_should_replicate( n_elems, n_idxs, data_type, comm ) )
+   {
+      scatter_replicated( n_elems, n_idxs, idxs, data, recv_data, data_type, comm );
+      return;
+   }
+
+   scatter_plan_init_shared( &plan, n_elems, n_idxs, idxs, comm );
+   MPI_OK( MPI_Type_get_extent( data_type, &lb, &elem_size ) );
+   *recv_data = (void*)ALLOC( uint8_t, n_idxs*elem_size );
+   scatter_plan_execute_auto( &plan, data, *recv_data, data_type, tuner, key );
+   scatter_plan_free( &plan );
+}
+
+void
+scatter_plan_executev( scatter_plan_t const* plan,
+                       unsigned const* elem_displs,
+                       void const* data,
+                       void** recv_data,
+                       unsigned** recv_displs,
+                       MPI_Datatype data_type )
+{
+   unsigned const *out_cnts = plan->out_cnts, *out_displs = plan->out_displs, *out_idxs = plan->out_idxs;
+   unsigned const *req_cnts = plan->req_cnts, *req_displs = plan->req_displs, *local = plan->local;
+   unsigned *out_items, *inc_items, *out_units, *inc_units, *out_offs, *inc_offs;
+   unsigned *inc_elem_cnts, *inc_elem_displs;
+   unsigned row, n_items, ii, jj;
+   MPI_Datatype unit_type;
+   MPI_Aint lb, elem_size;
+   uint8_t *out_buf, *inc_buf, *ptr;
+   int n_ranks = plan->n_ranks;
+
+   MPI_OK( MPI_Type_get_extent( data_type, &lb, &elem_size ) );
+
+   /* Sum the number of items in the rows going to each rank. This
+      small message is all the receiver needs to size its buffers. */
+   out_items = ALLOCZ( unsigned, n_ranks );
+   for( ii = 0; ii < n_ranks; ++ii )
+   {
+      for( jj = 0; jj < out_cnts[ii]; ++jj )
+      {
+         row = out_idxs[out_displs[ii] + jj];
+         out_items[ii] += elem_displs[row + 1] - elem_displs[row];
+      }
+   }
+   inc_items = ALLOC( unsigned, n_ranks );
+   MPI_OK( MPI_Alltoall( out_items, 1, MPI_UNSIGNED, inc_items, 1, MPI_UNSIGNED, plan->comm ) );
+
+   /* Each rank's message is a header of row lengths followed by
+      the rows' items, padded to whole units. Counting in units
+      rather than bytes keeps large payloads within int counts,
+      and keeps the next header aligned. */
+   out_units = ALLOC( unsigned, n_ranks );
+   out_offs = ALLOC( unsigned, n_ranks );
+   inc_units = ALLOC( unsigned, n_ranks );
+   inc_offs = ALLOC( unsigned, n_ranks );
+   for( ii = 0; ii < n_ranks; ++ii )
+   {
+      size_t out_size = sizeof(unsigned)*(size_t)out_cnts[ii] + elem_size*(size_t)out_items[ii];
+      size_t inc_size = sizeof(unsigned)*(size_t)req_cnts[ii] + elem_size*(size_t)inc_items[ii];
+
+      assert( (out_size + EXECV_UNIT - 1)/EXECV_UNIT <= INT_MAX );
+      assert( (inc_size + EXECV_UNIT - 1)/EXECV_UNIT <= INT_MAX );
+      out_units[ii] = (out_size + EXECV_UNIT - 1)/EXECV_UNIT;
+      inc_units[ii] = (inc_size + EXECV_UNIT - 1)/EXECV_UNIT;
+   }
+   make_displs( n_ranks, out_units, out_offs );
+   make_displs( n_ranks, inc_units, inc_offs );
+   assert( (size_t)out_offs[n_ranks - 1] + out_units[n_ranks - 1] <= INT_MAX );
+   assert( (size_t)inc_offs[n_ranks - 1] + inc_units[n_ranks - 1] <= INT_MAX );
+   FREE( out_items );
+
+   /* Pack headers and payload. */
+   out_buf = ALLOC( uint8_t, (size_t)EXECV_UNIT*(out_offs[n_ranks - 1] + out_units[n_ranks - 1]) );
+   for( ii = 0; ii < n_ranks; ++ii )
+   {
+      unsigned* hdr = (unsigned*)(out_buf + (size_t)EXECV_UNIT*out_offs[ii]);
+
+      ptr = (uint8_t*)hdr + sizeof(unsigned)*out_cnts[ii];
+      for( jj = 0; jj < out_cnts[ii]; ++jj )
+      {
+         row = out_idxs[out_displs[ii] + jj];
+         n_items = elem_displs[row + 1] - elem_displs[row];
+         hdr[jj] = n_items;
+         memcpy( ptr, (uint8_t const*)data + elem_size*elem_displs[row], elem_size*n_items );
+         ptr += elem_size*n_items;
+      }
+   }
+
+   /* One exchange moves both row lengths and payload. */
+   inc_buf = ALLOC( uint8_t, (size_t)EXECV_UNIT*(inc_offs[n_ranks - 1] + inc_units[n_ranks - 1]) );
+   MPI_OK( MPI_Type_contiguous( EXECV_UNIT, MPI_BYTE, &unit_type ) );
+   MPI_OK( MPI_Type_commit( &unit_type ) );
+   MPI_OK( MPI_Alltoallv( out_buf, (int*)out_units, (int*)out_offs, unit_type,
+                          inc_buf, (int*)inc_units, (int*)inc_offs, unit_type, plan->comm ) );
+   MPI_OK( MPI_Type_free( &unit_type ) );
+   FREE( out_buf );
+   FREE( out_units );
+   FREE( out_offs );
+   FREE( inc_items );
+
+   /* Rebuild displacements in request order from the headers. */
+   inc_elem_cnts = ALLOC( unsigned, plan->n_idxs );
+   for( ii = 0; ii < n_ranks; ++ii )
+   {
+      unsigned const* hdr = (unsigned const*)(inc_buf + (size_t)EXECV_UNIT*inc_offs[ii]);
+
+      for( jj = 0; jj < req_cnts[ii]; ++jj )
+         inc_elem_cnts[local[req_displs[ii] + jj]] = hdr[jj];
+   }
+   inc_elem_displs = ALLOC( unsigned, plan->n_idxs + 1 );
+   inc_elem_displs[0] = 0;
+   make_displs2( plan->n_idxs, inc_elem_cnts, inc_elem_displs );
+   FREE( inc_elem_cnts );
+
+   /* Unpack rows into their final positions. */
+   *recv_data = (void*)ALLOC( uint8_t, elem_size*inc_elem_displs[plan->n_idxs] );
+   for( ii = 0; ii < n_ranks; ++ii )
+   {
+      unsigned const* hdr = (unsigned const*)(inc_buf + (size_t)EXECV_UNIT*inc_offs[ii]);
+
+      ptr = (uint8_t*)hdr + sizeof(unsigned)*req_cnts[ii];
+      for( jj = 0; jj < req_cnts[ii]; ++jj )
+      {
+         row = local[req_displs[ii] + jj];
+         memcpy( (uint8_t*)*recv_data + elem_size*inc_elem_displs[row], ptr, elem_size*hdr[jj] );
+         ptr += elem_size*hdr[jj];
+      }
+   }
+   FREE( inc_buf );
+   FREE( inc_units );
+   FREE( inc_offs );
+
    *recv_displs = inc_elem_displs;
-   *recv_data = inc_data;
+}
+
+void
+scatter_transform( unsigned n_elems,
+                   unsigned n_idxs,
+                   unsigned const* idxs,
+                   void const* data,
+                   void** recv_data,
+                   MPI_Datatype data_type,
+                   size_t out_size,
+                   scatter_transform_t transform,
+                   void* ctx,
+                   MPI_Comm comm )
+{
+   scatter_plan_t plan;
+
+   assert( !n_idxs || idxs );
+   assert( !n_elems || data );
+   assert( !n_elems || comm );
+   assert( transform );
+
+   scatter_plan_init_shared( &plan, n_elems, n_idxs, idxs, comm );
+   *recv_data = (void*)ALLOC( uint8_t, n_idxs*out_size );
+   scatter_plan_execute_transform( &plan, data, *recv_data, data_type, out_size, transform, ctx );
+   scatter_plan_free( &plan );
+}
+
+void
+scatter_grouped( unsigned n_elems,
+                 unsigned n_idxs,
+                 unsigned const* idxs,
+                 void const* data,
+                 void** recv_data,
+                 unsigned** local,
+                 unsigned** recv_cnts,
+                 MPI_Datatype data_type,
+                 MPI_Comm comm )
+{
+   scatter_plan_t plan;
+   MPI_Aint lb, elem_size;
+
+   assert( !n_idxs || idxs );
+   assert( !n_elems || data );
+   assert( !n_elems || comm );
+   assert( local );
+
+   scatter_plan_init_shared( &plan, n_elems, n_idxs, idxs, comm );
+   MPI_OK( MPI_Type_get_extent( data_type, &lb, &elem_size ) );
+   *recv_data = (void*)ALLOC( uint8_t, n_idxs*elem_size );
+   scatter_plan_execute_grouped( &plan, data, *recv_data, data_type );
+
+   /* Hand over the pieces of the plan the caller keeps. */
+   *local = plan.local;
+   plan.local = NULL;
+   if( recv_cnts )
+   {
+      *recv_cnts = plan.req_cnts;
+      plan.req_cnts = NULL;
+   }
+   scatter_plan_free( &plan );
+}
+
+void
+scatter_batch_begin( scatter_batch_t* batch,
+                     MPI_Comm comm )
+{
+   assert( batch );
+
+   batch->n_ops = 0;
+   batch->max_ops = 0;
+   batch->ops = NULL;
+
+   /* As with plans, a private communicator lets batches begun
+      in turn be executed from different threads. */
+   MPI_OK( MPI_Comm_dup( comm, &batch->comm ) );
+}
+
+void
+scatter_batch_add( scatter_batch_t* batch,
+                   unsigned n_elems,
+                   unsigned n_idxs,
+                   unsigned const* idxs,
+                   void const* data,
+                   void** recv_data,
+                   MPI_Datatype data_type )
+{
+   scatter_batch_op_t* op;
+   MPI_Aint lb;
+
+   assert( !n_idxs || idxs );
+   assert( recv_data );
+
+   if( batch->n_ops == batch->max_ops )
+   {
+      batch->max_ops = batch->max_ops ? 2*batch->max_ops : 8;
+      batch->ops = (scatter_batch_op_t*)realloc( batch->ops, sizeof(scatter_batch_op_t)*batch->max_ops );
+      assert( batch->ops );
+   }
+   op = batch->ops + batch->n_ops++;
+   op->n_elems = n_elems;
+   op->n_idxs = n_idxs;
+   op->idxs = idxs;
+   op->data = data;
+   op->recv_data = recv_data;
+   op->data_type = data_type;
+   MPI_OK( MPI_Type_get_extent( data_type, &lb, &op->elem_size ) );
+}
+
+void
+scatter_batch_execute( scatter_batch_t* batch )
+{
+   scatter_batch_op_t* ops = batch->ops;
+   unsigned n_ops = batch->n_ops;
+   unsigned **req_cnts, **req_displs, **locals, **op_idxs;
+   unsigned *cnts, *inc_cnts, *idx_cnts, *idx_displs, *inc_idx_cnts, *inc_idx_displs;
+   unsigned *req_idxs, *out_idxs, *bytes, *byte_displs, *inc_bytes, *inc_byte_displs;
+   unsigned *n_locals, *bases, n_out, ii, oo;
+   uint8_t *out_buf, *inc_buf, *ptr;
+   int n_ranks, rank, rr;
+
+   MPI_OK( MPI_Comm_size( batch->comm, &n_ranks ) );
+   MPI_OK( MPI_Comm_rank( batch->comm, &rank ) );
+
+   /* Group each operation's indices by owner. */
+   req_cnts = ALLOC( unsigned*, n_ops );
+   req_displs = ALLOC( unsigned*, n_ops );
+   locals = ALLOC( unsigned*, n_ops );
+   op_idxs = ALLOC( unsigned*, n_ops );
+   for( oo = 0; oo < n_ops; ++oo )
+   {
+      req_cnts[oo] = ALLOCZ( unsigned, n_ranks );
+      req_displs[oo] = ALLOC( unsigned, n_ranks );
+      count_required( ops[oo].n_elems, ops[oo].n_idxs, ops[oo].idxs, n_ranks, req_cnts[oo], req_displs[oo] );
+      op_idxs[oo] = ALLOC( unsigned, ops[oo].n_idxs );
+      locals[oo] = ALLOC( unsigned, ops[oo].n_idxs );
+      make_required( ops[oo].n_elems, ops[oo].n_idxs, ops[oo].idxs, n_ranks, op_idxs[oo],
+                     req_cnts[oo], req_displs[oo], locals[oo] );
+   }
+
+   /* One count exchange: each rank gets a count per operation. */
+   cnts = ALLOC( unsigned, n_ranks*n_ops );
+   inc_cnts = ALLOC( unsigned, n_ranks*n_ops );
+   for( rr = 0; rr < n_ranks; ++rr )
+   {
+      for( oo = 0; oo < n_ops; ++oo )
+         cnts[rr*n_ops + oo] = req_cnts[oo][rr];
+   }
+   MPI_OK( MPI_Alltoall( cnts, n_ops, MPI_UNSIGNED, inc_cnts, n_ops, MPI_UNSIGNED, batch->comm ) );
+
+   /* One index exchange: per destination, the indices of every
+      operation one after another. */
+   idx_cnts = ALLOCZ( unsigned, n_ranks );
+   inc_idx_cnts = ALLOCZ( unsigned, n_ranks );
+   idx_displs = ALLOC( unsigned, n_ranks );
+   inc_idx_displs = ALLOC( unsigned, n_ranks );
+   for( rr = 0; rr < n_ranks; ++rr )
+   {
+      for( oo = 0; oo < n_ops; ++oo )
+      {
+         idx_cnts[rr] += cnts[rr*n_ops + oo];
+         inc_idx_cnts[rr] += inc_cnts[rr*n_ops + oo];
+      }
+   }
+   make_displs( n_ranks, idx_cnts, idx_displs );
+   make_displs( n_ranks, inc_idx_cnts, inc_idx_displs );
+   req_idxs = ALLOC( unsigned, idx_displs[n_ranks - 1] + idx_cnts[n_ranks - 1] );
+   for( rr = 0, ptr = (uint8_t*)req_idxs; rr < n_ranks; ++rr )
+   {
+      for( oo = 0; oo < n_ops; ++oo )
+      {
+         memcpy( ptr, op_idxs[oo] + req_displs[oo][rr], sizeof(unsigned)*req_cnts[oo][rr] );
+         ptr += sizeof(unsigned)*req_cnts[oo][rr];
+      }
+   }
+   n_out = inc_idx_displs[n_ranks - 1] + inc_idx_cnts[n_ranks - 1];
+   out_idxs = ALLOC( unsigned, n_out );
+   MPI_OK( MPI_Alltoallv( req_idxs, (int*)idx_cnts, (int*)idx_displs, MPI_UNSIGNED,
+                          out_idxs, (int*)inc_idx_cnts, (int*)inc_idx_displs, MPI_UNSIGNED, batch->comm ) );
+   FREE( req_idxs );
+   for( oo = 0; oo < n_ops; ++oo )
+      FREE( op_idxs[oo] );
+   FREE( op_idxs );
+
+   /* Size the single data exchange in bytes, since each operation
+      has its own datatype. */
+   bytes = ALLOCZ( unsigned, n_ranks );
+   inc_bytes = ALLOCZ( unsigned, n_ranks );
+   byte_displs = ALLOC( unsigned, n_ranks );
+   inc_byte_displs = ALLOC( unsigned, n_ranks );
+   for( rr = 0; rr < n_ranks; ++rr )
+   {
+      for( oo = 0; oo < n_ops; ++oo )
+      {
+         bytes[rr] += ops[oo].elem_size*inc_cnts[rr*n_ops + oo];
+         inc_bytes[rr] += ops[oo].elem_size*cnts[rr*n_ops + oo];
+      }
+   }
+   make_displs( n_ranks, bytes, byte_displs );
+   make_displs( n_ranks, inc_bytes, inc_byte_displs );
+
+   /* Use a scan to find my base in every operation. */
+   n_locals = ALLOC( unsigned, n_ops );
+   bases = ALLOC( unsigned, n_ops );
+   for( oo = 0; oo < n_ops; ++oo )
+      n_locals[oo] = local_size( ops[oo].n_elems, n_ranks, rank );
+   MPI_OK( MPI_Scan( n_locals, bases, n_ops, MPI_UNSIGNED, MPI_SUM, batch->comm ) );
+   for( oo = 0; oo < n_ops; ++oo )
+      bases[oo] -= n_locals[oo];
+
+   /* Pack outgoing elements of all operations. */
+   out_buf = ALLOC( uint8_t, byte_displs[n_ranks - 1] + bytes[n_ranks - 1] );
+   ptr = out_buf;
+   for( rr = 0, ii = 0; rr < n_ranks; ++rr )
+   {
+      for( oo = 0; oo < n_ops; ++oo )
+      {
+         unsigned n = inc_cnts[rr*n_ops + oo], jj;
+
+         for( jj = 0; jj < n; ++jj, ++ii )
+         {
+            assert( out_idxs[ii] >= bases[oo] && out_idxs[ii] < bases[oo] + n_locals[oo] );
+            memcpy( ptr, (uint8_t const*)ops[oo].data + ops[oo].elem_size*(out_idxs[ii] - bases[oo]),
+                    ops[oo].elem_size );
+            ptr += ops[oo].elem_size;
+         }
+      }
+   }
+   FREE( out_idxs );
+   FREE( n_locals );
+   FREE( bases );
+
+   /* One data exchange. */
+   inc_buf = ALLOC( uint8_t, inc_byte_displs[n_ranks - 1] + inc_bytes[n_ranks - 1] );
+   MPI_OK( MPI_Alltoallv( out_buf, (int*)bytes, (int*)byte_displs, MPI_BYTE,
+                          inc_buf, (int*)inc_bytes, (int*)inc_byte_displs, MPI_BYTE, batch->comm ) );
+   FREE( out_buf );
+
+   /* Unpack each operation's elements into place. */
+   for( oo = 0; oo < n_ops; ++oo )
+      *ops[oo].recv_data = (void*)ALLOC( uint8_t, ops[oo].elem_size*ops[oo].n_idxs );
+   ptr = inc_buf;
+   for( rr = 0; rr < n_ranks; ++rr )
+   {
+      for( oo = 0; oo < n_ops; ++oo )
+      {
+         kernel_scatter( req_cnts[oo][rr], locals[oo] + req_displs[oo][rr], ops[oo].elem_size,
+                         ptr, *ops[oo].recv_data );
+         ptr += ops[oo].elem_size*req_cnts[oo][rr];
+      }
+   }
+   FREE( inc_buf );
+
+   for( oo = 0; oo < n_ops; ++oo )
+   {
+      FREE( req_cnts[oo] );
+      FREE( req_displs[oo] );
+      FREE( locals[oo] );
+   }
+   FREE( req_cnts );
+   FREE( req_displs );
+   FREE( locals );
+   FREE( cnts );
+   FREE( inc_cnts );
+   FREE( idx_cnts );
+   FREE( idx_displs );
+   FREE( inc_idx_cnts );
+   FREE( inc_idx_displs );
+   FREE( bytes );
+   FREE( byte_displs );
+   FREE( inc_bytes );
+   FREE( inc_byte_displs );
+   FREE( batch->ops );
+   batch->ops = NULL;
+   batch->n_ops = batch->max_ops = 0;
+   MPI_OK( MPI_Comm_free( &batch->comm ) );
+}
+
+void
+scatterv( unsigned n_elems,
+          unsigned const* elem_displs,
+          unsigned n_idxs,
+          unsigned const* idxs,
+          void const* data,
+          void** recv_data,
+          unsigned** recv_displs,
+          MPI_Datatype data_type,
+          MPI_Comm comm )
+{
+   scatter_plan_t plan;
+
+   assert( !n_idxs || idxs );
+   assert( !n_elems || data );
+   assert( !n_elems || comm );
+
+   scatter_plan_init_shared( &plan, n_elems, n_idxs, idxs, comm );
+   scatter_plan_executev( &plan, elem_displs, data, recv_data, recv_displs, data_type );
+   scatter_plan_free( &plan );
 }
 
 void
@@ -381,3 +1677,839 @@ permutev( unsigned n_elems,
    *data = recv_data;
    *elem_displs = recv_displs;
 }
+
+void
+permutev_balanced( unsigned n_elems,
+                   unsigned const* src_dist,
+                   unsigned** elem_displs,
+                   unsigned n_idxs,
+                   unsigned const* idxs,
+                   void** data,
+                   MPI_Datatype data_type,
+                   unsigned** dist,
+                   MPI_Comm comm )
+{
+   scatter_plan_t plan;
+   unsigned *lens, *weights, *cnts, *idx_dist, *pos, *new_idxs, *recv_displs;
+   unsigned n_rows, n_new, ii;
+   double sum, prefix, total, mid;
+   MPI_Aint lb, elem_size;
+   void *recv_data;
+   int n_ranks, rank, rr;
+
+   assert( !n_idxs || idxs );
+   assert( dist );
+
+   MPI_OK( MPI_Comm_size( comm, &n_ranks ) );
+   MPI_OK( MPI_Comm_rank( comm, &rank ) );
+   MPI_OK( MPI_Type_get_extent( data_type, &lb, &elem_size ) );
+   n_rows = src_dist ? src_dist[rank + 1] - src_dist[rank] : local_size( n_elems, n_ranks, rank );
+
+   /* Fetch the length of every requested row. */
+   lens = ALLOC( unsigned, n_rows );
+   for( ii = 0; ii < n_rows; ++ii )
+      lens[ii] = (*elem_displs)[ii + 1] - (*elem_displs)[ii];
+   weights = ALLOC( unsigned, n_idxs );
+   if( src_dist )
+      _plan_init( &plan, src_dist[n_ranks], src_dist, n_idxs, idxs, comm, 1 );
+   else
+      scatter_plan_init_shared( &plan, n_elems, n_idxs, idxs, comm );
+   scatter_plan_execute( &plan, lens, weights, MPI_UNSIGNED );
+   scatter_plan_free( &plan );
+   FREE( lens );
+
+   /* Requested rows, taken in rank order, form one sequence. A
+      row goes to the rank whose equal share of the total bytes
+      holds the row's midpoint, so ranks get contiguous runs. */
+   for( ii = 0, sum = 0.0; ii < n_idxs; ++ii )
+      sum += sizeof(unsigned) + (double)elem_size*weights[ii];
+   MPI_OK( MPI_Exscan( &sum, &prefix, 1, MPI_DOUBLE, MPI_SUM, comm ) );
+   if( rank == 0 )
+      prefix = 0.0;
+   MPI_OK( MPI_Allreduce( &sum, &total, 1, MPI_DOUBLE, MPI_SUM, comm ) );
+   cnts = ALLOCZ( unsigned, n_ranks );
+   for( ii = 0; ii < n_idxs; ++ii )
+   {
+      double w = sizeof(unsigned) + (double)elem_size*weights[ii];
+
+      mid = prefix + 0.5*w;
+      prefix += w;
+      rr = (int)(mid*n_ranks/total);
+      ++cnts[MIN( rr, n_ranks - 1 )];
+   }
+   FREE( weights );
+   MPI_OK( MPI_Allreduce( MPI_IN_PLACE, cnts, n_ranks, MPI_UNSIGNED, MPI_SUM, comm ) );
+   *dist = ALLOC( unsigned, n_ranks + 1 );
+   make_displs2( n_ranks, cnts, *dist );
+   FREE( cnts );
+
+   /* Fetch the source indices of my run from whoever requested
+      them, then pull the rows themselves. */
+   idx_dist = ALLOC( unsigned, n_ranks + 1 );
+   MPI_OK( MPI_Allgather( &n_idxs, 1, MPI_UNSIGNED, idx_dist + 1, 1, MPI_UNSIGNED, comm ) );
+   for( rr = 0, idx_dist[0] = 0; rr < n_ranks; ++rr )
+      idx_dist[rr + 1] += idx_dist[rr];
+   n_new = (*dist)[rank + 1] - (*dist)[rank];
+   pos = ALLOC( unsigned, n_new );
+   for( ii = 0; ii < n_new; ++ii )
+      pos[ii] = (*dist)[rank] + ii;
+   new_idxs = ALLOC( unsigned, n_new );
+   _plan_init( &plan, idx_dist[n_ranks], idx_dist, n_new, pos, comm, 1 );
+   scatter_plan_execute( &plan, idxs, new_idxs, MPI_UNSIGNED );
+   scatter_plan_free( &plan );
+   FREE( pos );
+   FREE( idx_dist );
+
+   if( src_dist )
+      _plan_init( &plan, src_dist[n_ranks], src_dist, n_new, new_idxs, comm, 1 );
+   else
+      scatter_plan_init_shared( &plan, n_elems, n_new, new_idxs, comm );
+   scatter_plan_executev( &plan, *elem_displs, *data, &recv_data, &recv_displs, data_type );
+   scatter_plan_free( &plan );
+   FREE( new_idxs );
+
+   free( *data );
+   free( *elem_displs );
+   *data = recv_data;
+   *elem_displs = recv_displs;
+}
+
+void
+scatterv_segmented( unsigned n_elems,
+                    unsigned const* elem_displs,
+                    unsigned n_idxs,
+                    unsigned const* idxs,
+                    void const* data,
+                    void** recv_data,
+                    scatter_segs_t* segs,
+                    MPI_Datatype data_type,
+                    MPI_Comm comm )
+{
+   scatter_plan_t plan;
+   MPI_Datatype desc_type, pair_type;
+   unsigned *lens, *weights, *item_dist, *seg_cnts, *seg_displs, *inc_seg_cnts, *inc_seg_displs;
+   unsigned *out_desc, *inc_desc, *req_pairs, *out_pairs, *out_bytes, *out_offs, *inc_bytes, *inc_offs;
+   unsigned n_rows, n_items, n_segs, n_out, base, total, start, end, phase, ii, jj, kk;
+   MPI_Aint lb, elem_size;
+   uint8_t *out_buf, *inc_buf, *ptr;
+   int n_ranks, rank, rr;
+
+   assert( !n_idxs || idxs );
+   assert( segs );
+
+   MPI_OK( MPI_Comm_size( comm, &n_ranks ) );
+   MPI_OK( MPI_Comm_rank( comm, &rank ) );
+   MPI_OK( MPI_Type_get_extent( data_type, &lb, &elem_size ) );
+   n_rows = local_size( n_elems, n_ranks, rank );
+
+   /* Fetch the length of every requested row. */
+   lens = ALLOC( unsigned, n_rows );
+   for( ii = 0; ii < n_rows; ++ii )
+      lens[ii] = elem_displs[ii + 1] - elem_displs[ii];
+   weights = ALLOC( unsigned, n_idxs );
+   scatter_plan_init_shared( &plan, n_elems, n_idxs, idxs, comm );
+   scatter_plan_execute( &plan, lens, weights, MPI_UNSIGNED );
+   scatter_plan_free( &plan );
+   FREE( lens );
+
+   /* The items of the requested rows, in rank order, are split
+      evenly over ranks regardless of row boundaries. */
+   for( ii = 0, n_items = 0; ii < n_idxs; ++ii )
+      n_items += weights[ii];
+   MPI_OK( MPI_Scan( &n_items, &base, 1, MPI_UNSIGNED, MPI_SUM, comm ) );
+   base -= n_items;
+   MPI_OK( MPI_Allreduce( &n_items, &total, 1, MPI_UNSIGNED, MPI_SUM, comm ) );
+   item_dist = ALLOC( unsigned, n_ranks + 1 );
+   for( rr = 0, item_dist[0] = 0; rr < n_ranks; ++rr )
+      item_dist[rr + 1] = item_dist[rr] + local_size( total, n_ranks, rr );
+
+   /* Cut each row at rank boundaries into (row, offset, count)
+      descriptors for the ranks receiving the pieces. Empty rows
+      still travel, as a single empty segment. */
+   seg_cnts = ALLOCZ( unsigned, n_ranks );
+   seg_displs = ALLOC( unsigned, n_ranks );
+   out_desc = NULL;
+   for( phase = 0; phase < 2; ++phase )
+   {
+      if( phase == 1 )
+      {
+         make_displs( n_ranks, seg_cnts, seg_displs );
+         out_desc = ALLOC( unsigned, 3*(seg_displs[n_ranks - 1] + seg_cnts[n_ranks - 1]) );
+         memset( seg_cnts, 0, sizeof(unsigned)*n_ranks );
+      }
+      for( ii = 0, start = base; ii < n_idxs; start = end, ++ii )
+      {
+         end = start + weights[ii];
+         for( rr = _find_rank( item_dist, n_ranks, start ); rr < n_ranks; ++rr )
+         {
+            unsigned lo = MAX( start, item_dist[rr] ), hi = MIN( end, item_dist[rr + 1] );
+
+            if( hi > lo || start == end )
+            {
+               if( phase == 1 )
+               {
+                  kk = 3*(seg_displs[rr] + seg_cnts[rr]);
+                  out_desc[kk + 0] = idxs[ii];
+                  out_desc[kk + 1] = lo - start;
+                  out_desc[kk + 2] = hi - lo;
+               }
+               ++seg_cnts[rr];
+            }
+            if( end <= item_dist[rr + 1] )
+               break;
+         }
+      }
+   }
+   FREE( weights );
+   FREE( item_dist );
+
+   /* Send the descriptors to their receivers. */
+   inc_seg_cnts = ALLOC( unsigned, n_ranks );
+   inc_seg_displs = ALLOC( unsigned, n_ranks );
+   MPI_OK( MPI_Alltoall( seg_cnts, 1, MPI_UNSIGNED, inc_seg_cnts, 1, MPI_UNSIGNED, comm ) );
+   make_displs( n_ranks, inc_seg_cnts, inc_seg_displs );
+   n_segs = inc_seg_displs[n_ranks - 1] + inc_seg_cnts[n_ranks - 1];
+   inc_desc = ALLOC( unsigned, 3*n_segs );
+   MPI_OK( MPI_Type_contiguous( 3, MPI_UNSIGNED, &desc_type ) );
+   MPI_OK( MPI_Type_commit( &desc_type ) );
+   MPI_OK( MPI_Alltoallv( out_desc, (int*)seg_cnts, (int*)seg_displs, desc_type,
+                          inc_desc, (int*)inc_seg_cnts, (int*)inc_seg_displs, desc_type, comm ) );
+   MPI_OK( MPI_Type_free( &desc_type ) );
+   FREE( out_desc );
+   FREE( seg_cnts );
+   FREE( seg_displs );
+   FREE( inc_seg_cnts );
+   FREE( inc_seg_displs );
+
+   segs->n_segs = n_segs;
+   segs->rows = ALLOC( unsigned, n_segs );
+   segs->offs = ALLOC( unsigned, n_segs );
+   segs->displs = ALLOC( unsigned, n_segs + 1 );
+   segs->displs[0] = 0;
+   for( ii = 0; ii < n_segs; ++ii )
+   {
+      segs->rows[ii] = inc_desc[3*ii + 0];
+      segs->offs[ii] = inc_desc[3*ii + 1];
+      segs->displs[ii + 1] = segs->displs[ii] + inc_desc[3*ii + 2];
+   }
+   FREE( inc_desc );
+
+   /* Ask the owners of the rows for just the pieces. */
+   scatter_plan_init_shared( &plan, n_elems, n_segs, segs->rows, comm );
+   req_pairs = ALLOC( unsigned, 2*n_segs );
+   for( ii = 0; ii < n_segs; ++ii )
+   {
+      kk = plan.local[ii];
+      req_pairs[2*ii + 0] = segs->offs[kk];
+      req_pairs[2*ii + 1] = segs->displs[kk + 1] - segs->displs[kk];
+   }
+   n_out = plan.out_displs[n_ranks - 1] + plan.out_cnts[n_ranks - 1];
+   out_pairs = ALLOC( unsigned, 2*n_out );
+   MPI_OK( MPI_Type_contiguous( 2, MPI_UNSIGNED, &pair_type ) );
+   MPI_OK( MPI_Type_commit( &pair_type ) );
+   MPI_OK( MPI_Alltoallv( req_pairs, (int*)plan.req_cnts, (int*)plan.req_displs, pair_type,
+                          out_pairs, (int*)plan.out_cnts, (int*)plan.out_displs, pair_type, plan.comm ) );
+   MPI_OK( MPI_Type_free( &pair_type ) );
+
+   /* Owners pack the pieces; receivers know the sizes already. */
+   out_bytes = ALLOCZ( unsigned, n_ranks );
+   out_offs = ALLOC( unsigned, n_ranks );
+   inc_bytes = ALLOCZ( unsigned, n_ranks );
+   inc_offs = ALLOC( unsigned, n_ranks );
+   for( rr = 0; rr < n_ranks; ++rr )
+   {
+      for( jj = 0; jj < plan.out_cnts[rr]; ++jj )
+         out_bytes[rr] += elem_size*out_pairs[2*(plan.out_displs[rr] + jj) + 1];
+      for( jj = 0; jj < plan.req_cnts[rr]; ++jj )
+         inc_bytes[rr] += elem_size*req_pairs[2*(plan.req_displs[rr] + jj) + 1];
+   }
+   make_displs( n_ranks, out_bytes, out_offs );
+   make_displs( n_ranks, inc_bytes, inc_offs );
+   out_buf = ALLOC( uint8_t, out_offs[n_ranks - 1] + out_bytes[n_ranks - 1] );
+   for( ii = 0, ptr = out_buf; ii < n_out; ++ii )
+   {
+      unsigned row = plan.out_idxs[ii], cnt = out_pairs[2*ii + 1];
+
+      assert( out_pairs[2*ii] + cnt <= elem_displs[row + 1] - elem_displs[row] );
+      memcpy( ptr, (uint8_t const*)data + elem_size*(elem_displs[row] + out_pairs[2*ii]), elem_size*cnt );
+      ptr += elem_size*cnt;
+   }
+   FREE( out_pairs );
+   inc_buf = ALLOC( uint8_t, inc_offs[n_ranks - 1] + inc_bytes[n_ranks - 1] );
+   MPI_OK( MPI_Alltoallv( out_buf, (int*)out_bytes, (int*)out_offs, MPI_BYTE,
+                          inc_buf, (int*)inc_bytes, (int*)inc_offs, MPI_BYTE, plan.comm ) );
+   FREE( out_buf );
+
+   /* Place pieces in segment order. */
+   *recv_data = (void*)ALLOC( uint8_t, elem_size*segs->displs[n_segs] );
+   for( ii = 0, ptr = inc_buf; ii < n_segs; ++ii )
+   {
+      kk = plan.local[ii];
+      memcpy( (uint8_t*)*recv_data + elem_size*segs->displs[kk], ptr, elem_size*req_pairs[2*ii + 1] );
+      ptr += elem_size*req_pairs[2*ii + 1];
+   }
+   FREE( inc_buf );
+   FREE( req_pairs );
+   FREE( out_bytes );
+   FREE( out_offs );
+   FREE( inc_bytes );
+   FREE( inc_offs );
+   scatter_plan_free( &plan );
+}
+
+void
+scatter_segs_free( scatter_segs_t* segs )
+{
+   FREE( segs->rows );
+   FREE( segs->offs );
+   FREE( segs->displs );
+}
+
+void
+_reduce_ordered( void const* in,
+                 void* inout,
+                 void* tmp,
+                 MPI_Aint elem_size,
+                 MPI_Datatype data_type,
+                 MPI_Op op )
+{
+   /* MPI_Reduce_local puts in on the left; keep item order for
+      operations that do not commute. */
+   memcpy( tmp, in, elem_size );
+   MPI_OK( MPI_Reduce_local( inout, tmp, 1, data_type, op ) );
+   memcpy( inout, tmp, elem_size );
+}
+
+void
+scatter_segs_reduce( scatter_segs_t const* segs,
+                     void const* data,
+                     void* result,
+                     MPI_Datatype data_type,
+                     MPI_Op op,
+                     MPI_Comm comm )
+{
+   MPI_Aint lb, elem_size;
+   unsigned ii, jj, last;
+   uint8_t *parts, *tmp;
+   int *info, n_ranks, rank, rr;
+
+   MPI_OK( MPI_Comm_size( comm, &n_ranks ) );
+   MPI_OK( MPI_Comm_rank( comm, &rank ) );
+   MPI_OK( MPI_Type_get_extent( data_type, &lb, &elem_size ) );
+
+   /* Reduce every segment locally. */
+   tmp = ALLOC( uint8_t, elem_size );
+   for( ii = 0; ii < segs->n_segs; ++ii )
+   {
+      uint8_t const* src = (uint8_t const*)data + elem_size*segs->displs[ii];
+      uint8_t* dst = (uint8_t*)result + elem_size*ii;
+
+      if( segs->displs[ii + 1] == segs->displs[ii] )
+         continue;
+      memcpy( dst, src, elem_size );
+      for( jj = segs->displs[ii] + 1; jj < segs->displs[ii + 1]; ++jj )
+         _reduce_ordered( (uint8_t const*)data + elem_size*jj, dst, tmp, elem_size, data_type, op );
+   }
+
+   /* A rank holds at most one continued segment, its first, so
+      one value per rank is enough to finish split rows. Everyone
+      shares whether its first segment continues a row, how many
+      segments it holds, and that segment's partial value. */
+   info = ALLOC( int, 2*n_ranks );
+   info[2*rank + 0] = segs->n_segs && segs->offs[0] > 0;
+   info[2*rank + 1] = segs->n_segs;
+   MPI_OK( MPI_Allgather( MPI_IN_PLACE, 2, MPI_INT, info, 2, MPI_INT, comm ) );
+   parts = ALLOC( uint8_t, elem_size*n_ranks );
+   if( info[2*rank] )
+      memcpy( parts + elem_size*rank, result, elem_size );
+   MPI_OK( MPI_Allgather( MPI_IN_PLACE, 1, data_type, parts, 1, data_type, comm ) );
+
+   /* Fold following ranks' continuations into my last row if I
+      hold its start. */
+   if( segs->n_segs && segs->offs[segs->n_segs - 1] == 0 )
+   {
+      last = segs->n_segs - 1;
+      for( rr = rank + 1; rr < n_ranks; ++rr )
+      {
+         if( !info[2*rr + 1] )
+            continue;
+         if( !info[2*rr] )
+            break;
+         _reduce_ordered( parts + elem_size*rr, (uint8_t*)result + elem_size*last, tmp, elem_size, data_type, op );
+         if( info[2*rr + 1] > 1 )
+            break;
+      }
+   }
+   FREE( info );
+   FREE( parts );
+   FREE( tmp );
+}
+
+void
+_dist_range( unsigned const* dist,
+             unsigned n_elems,
+             int n_ranks,
+             int rank,
+             unsigned* lo,
+             unsigned* hi )
+{
+   /* A missing distribution means blocks. */
+   if( dist )
+   {
+      *lo = dist[rank];
+      *hi = dist[rank + 1];
+   }
+   else
+   {
+      unsigned n = n_elems/n_ranks, rem = n_elems%n_ranks;
+
+      *lo = rank*n + MIN( rank, rem );
+      *hi = *lo + local_size( n_elems, n_ranks, rank );
+   }
+}
+
+void
+redistribute( unsigned const* src_dist,
+              unsigned const* dst_dist,
+              void** data,
+              MPI_Datatype data_type,
+              MPI_Comm comm )
+{
+   unsigned *send_cnts, *send_displs, *recv_cnts, *recv_displs;
+   unsigned src_lo, src_hi, dst_lo, dst_hi, lo, hi, n_elems;
+   MPI_Aint lb, elem_size;
+   uint8_t *recv_data;
+   int n_ranks, rank, rr;
+
+   assert( src_dist || dst_dist );
+   assert( data );
+
+   MPI_OK( MPI_Comm_size( comm, &n_ranks ) );
+   MPI_OK( MPI_Comm_rank( comm, &rank ) );
+   MPI_OK( MPI_Type_get_extent( data_type, &lb, &elem_size ) );
+   n_elems = src_dist ? src_dist[n_ranks] : dst_dist[n_ranks];
+   assert( !src_dist || !dst_dist || dst_dist[n_ranks] == n_elems );
+   _dist_range( src_dist, n_elems, n_ranks, rank, &src_lo, &src_hi );
+   _dist_range( dst_dist, n_elems, n_ranks, rank, &dst_lo, &dst_hi );
+
+   /* Each pair of ranks shares the intersection of one's source
+      interval and the other's destination interval. Slices go
+      straight from the array, without packing. */
+   send_cnts = ALLOC( unsigned, n_ranks );
+   send_displs = ALLOC( unsigned, n_ranks );
+   recv_cnts = ALLOC( unsigned, n_ranks );
+   recv_displs = ALLOC( unsigned, n_ranks );
+   for( rr = 0; rr < n_ranks; ++rr )
+   {
+      _dist_range( dst_dist, n_elems, n_ranks, rr, &lo, &hi );
+      lo = MAX( lo, src_lo );
+      hi = MIN( hi, src_hi );
+      send_cnts[rr] = (hi > lo) ? hi - lo : 0;
+      send_displs[rr] = (hi > lo) ? lo - src_lo : 0;
+      _dist_range( src_dist, n_elems, n_ranks, rr, &lo, &hi );
+      lo = MAX( lo, dst_lo );
+      hi = MIN( hi, dst_hi );
+      recv_cnts[rr] = (hi > lo) ? hi - lo : 0;
+      recv_displs[rr] = (hi > lo) ? lo - dst_lo : 0;
+   }
+
+   /* What stays here is moved locally; if my interval is
+      unchanged nothing moves at all. */
+   recv_data = NULL;
+   if( src_lo != dst_lo || src_hi != dst_hi )
+   {
+      recv_data = ALLOC( uint8_t, elem_size*(dst_hi - dst_lo) );
+      if( send_cnts[rank] )
+      {
+         memcpy( recv_data + elem_size*recv_displs[rank], (uint8_t*)*data + elem_size*send_displs[rank],
+                 elem_size*send_cnts[rank] );
+      }
+   }
+   send_cnts[rank] = recv_cnts[rank] = 0;
+
+   MPI_OK( MPI_Alltoallv( *data, (int*)send_cnts, (int*)send_displs, data_type,
+                          recv_data, (int*)recv_cnts, (int*)recv_displs, data_type, comm ) );
+   if( recv_data )
+   {
+      free( *data );
+      *data = recv_data;
+   }
+
+   FREE( send_cnts );
+   FREE( send_displs );
+   FREE( recv_cnts );
+   FREE( recv_displs );
+}
+
+void
+perm_reverse( perm_desc_t* perm,
+              unsigned n_elems )
+{
+   perm->kind = PERM_REVERSE;
+   perm->n_elems = n_elems;
+   perm->shift = 0;
+   perm->rows = perm->cols = perm->block = 1;
+}
+
+void
+perm_shift( perm_desc_t* perm,
+            unsigned n_elems,
+            unsigned shift )
+{
+   perm->kind = PERM_SHIFT;
+   perm->n_elems = n_elems;
+   perm->shift = n_elems ? shift%n_elems : 0;
+   perm->rows = perm->cols = perm->block = 1;
+}
+
+void
+perm_stride( perm_desc_t* perm,
+             unsigned n_elems,
+             unsigned stride )
+{
+   /* Gathering with a stride is transposing the array viewed as
+      rows of stride elements. */
+   assert( stride && n_elems%stride == 0 );
+   perm_transpose( perm, n_elems/stride, stride, 1 );
+}
+
+void
+perm_transpose( perm_desc_t* perm,
+                unsigned rows,
+                unsigned cols,
+                unsigned block )
+{
+   perm->kind = PERM_TRANSPOSE;
+   perm->n_elems = rows*cols*block;
+   perm->shift = 0;
+   perm->rows = rows;
+   perm->cols = cols;
+   perm->block = block;
+}
+
+unsigned
+perm_src( perm_desc_t const* perm,
+          unsigned idx )
+{
+   unsigned unit, off;
+
+   assert( idx < perm->n_elems );
+   switch( perm->kind )
+   {
+      case PERM_REVERSE:
+         return perm->n_elems - 1 - idx;
+      case PERM_SHIFT:
+         return (idx < perm->n_elems - perm->shift) ? idx + perm->shift : idx - (perm->n_elems - perm->shift);
+      default:
+         unit = idx/perm->block;
+         off = idx%perm->block;
+         return ((unit%perm->rows)*perm->cols + unit/perm->rows)*perm->block + off;
+   }
+}
+
+unsigned
+perm_dst( perm_desc_t const* perm,
+          unsigned idx )
+{
+   unsigned unit, off;
+
+   assert( idx < perm->n_elems );
+   switch( perm->kind )
+   {
+      case PERM_REVERSE:
+         return perm->n_elems - 1 - idx;
+      case PERM_SHIFT:
+         return (idx >= perm->shift) ? idx - perm->shift : idx + (perm->n_elems - perm->shift);
+      default:
+         unit = idx/perm->block;
+         off = idx%perm->block;
+         return ((unit%perm->cols)*perm->rows + unit/perm->cols)*perm->block + off;
+   }
+}
+
+/* Local positions [k0, k1) partnered with the global elements
+   c + k, or c - k when down. Each rank's share is one slice,
+   displaced by its first position. My own share is copied
+   straight into self when given. */
+void
+_analytic_runs( unsigned const* offs,
+                int n_ranks,
+                int rank,
+                unsigned k0,
+                unsigned k1,
+                long c,
+                int down,
+                unsigned* cnts,
+                unsigned* displs,
+                uint8_t const* src,
+                uint8_t* self,
+                MPI_Aint elem_size )
+{
+   unsigned end;
+   long g;
+   int rr;
+
+   assert( !down || !self );
+
+   while( k0 < k1 )
+   {
+      g = down ? c - (long)k0 : c + (long)k0;
+      rr = _find_rank( offs, n_ranks, g );
+      end = down ? (unsigned)(c - (long)offs[rr] + 1) : (unsigned)((long)offs[rr + 1] - c);
+      end = MIN( end, k1 );
+      if( rr == rank )
+      {
+         if( self )
+            memcpy( self + elem_size*(g - offs[rank]), src + elem_size*k0, elem_size*(end - k0) );
+      }
+      else
+      {
+         assert( !cnts[rr] || displs[rr] + cnts[rr] == k0 );
+         if( !cnts[rr] )
+            displs[rr] = k0;
+         cnts[rr] += end - k0;
+      }
+      k0 = end;
+   }
+}
+
+/* Walk my output blocks of a transpose in order, counting what
+   comes from each other rank, or when inc is given, placing it
+   using cnts as cursors. */
+void
+_transpose_recv( perm_desc_t const* perm,
+                 unsigned const* offs,
+                 int n_ranks,
+                 int rank,
+                 unsigned* cnts,
+                 unsigned const* displs,
+                 uint8_t const* inc,
+                 uint8_t* out,
+                 MPI_Aint elem_size )
+{
+   unsigned blk = perm->block, lo = offs[rank], hi = offs[rank + 1], v, a, b, m, src;
+   int rr;
+
+   for( v = lo/blk; v*blk < hi; ++v )
+   {
+      a = MAX( v*blk, lo );
+      b = MIN( (v + 1)*blk, hi );
+      src = ((v%perm->rows)*perm->cols + v/perm->rows)*blk + a - v*blk;
+      while( a < b )
+      {
+         rr = _find_rank( offs, n_ranks, src );
+         m = MIN( b - a, offs[rr + 1] - src );
+         if( rr != rank )
+         {
+            if( inc )
+               memcpy( out + elem_size*(a - lo), inc + elem_size*(displs[rr] + cnts[rr]), elem_size*m );
+            cnts[rr] += m;
+         }
+         a += m;
+         src += m;
+      }
+   }
+}
+
+void
+permute_analytic( perm_desc_t const* perm,
+                  void** data,
+                  MPI_Datatype data_type,
+                  MPI_Comm comm )
+{
+   unsigned *offs, *send_cnts, *send_displs, *recv_cnts, *recv_displs;
+   unsigned n_elems = perm->n_elems, shift = perm->shift, n_local, lo, hi, ii, kk;
+   MPI_Aint lb, elem_size;
+   uint8_t *in = (uint8_t*)*data, *send_buf, *recv_buf, *out;
+   int n_ranks, rank, rr;
+
+   assert( data );
+
+   MPI_OK( MPI_Comm_size( comm, &n_ranks ) );
+   MPI_OK( MPI_Comm_rank( comm, &rank ) );
+   MPI_OK( MPI_Type_get_extent( data_type, &lb, &elem_size ) );
+   offs = ALLOC( unsigned, n_ranks + 1 );
+   for( rr = 0, offs[0] = 0; rr < n_ranks; ++rr )
+      offs[rr + 1] = offs[rr] + local_size( n_elems, n_ranks, rr );
+   lo = offs[rank];
+   hi = offs[rank + 1];
+   n_local = hi - lo;
+
+   send_cnts = ALLOCZ( unsigned, n_ranks );
+   send_displs = ALLOCZ( unsigned, n_ranks );
+   recv_cnts = ALLOCZ( unsigned, n_ranks );
+   recv_displs = ALLOCZ( unsigned, n_ranks );
+   out = ALLOC( uint8_t, elem_size*n_local );
+   send_buf = in;
+   recv_buf = out;
+
+   /* Both sides work out the same slices, so only the payload
+      moves. Elements staying here are copied directly. */
+   switch( perm->kind )
+   {
+      case PERM_REVERSE:
+         /* Reversed, my block is in order of destination. */
+         send_buf = ALLOC( uint8_t, elem_size*n_local );
+         for( ii = 0; ii < n_local; ++ii )
+            memcpy( send_buf + elem_size*ii, in + elem_size*(n_local - 1 - ii), elem_size );
+         _analytic_runs( offs, n_ranks, rank, 0, n_local, n_elems - hi, 0, send_cnts, send_displs,
+                         send_buf, out, elem_size );
+         _analytic_runs( offs, n_ranks, rank, 0, n_local, n_elems - 1 - lo, 1, recv_cnts, recv_displs,
+                         NULL, NULL, elem_size );
+         break;
+
+      case PERM_SHIFT:
+         /* Elements before the shift wrap to the end and the rest
+            move down by it; both runs keep their order. */
+         kk = MIN( MAX( shift, lo ), hi ) - lo;
+         _analytic_runs( offs, n_ranks, rank, 0, kk, (long)lo + n_elems - shift, 0, send_cnts, send_displs,
+                         in, out, elem_size );
+         _analytic_runs( offs, n_ranks, rank, kk, n_local, (long)lo - shift, 0, send_cnts, send_displs,
+                         in, out, elem_size );
+         kk = MIN( MAX( n_elems - shift, lo ), hi ) - lo;
+         _analytic_runs( offs, n_ranks, rank, 0, kk, (long)lo + shift, 0, recv_cnts, recv_displs,
+                         NULL, NULL, elem_size );
+         _analytic_runs( offs, n_ranks, rank, kk, n_local, (long)lo + shift - n_elems, 0, recv_cnts, recv_displs,
+                         NULL, NULL, elem_size );
+         break;
+
+      default:
+         /* Taking my blocks column by column puts them in order
+            of destination. */
+         {
+            unsigned blk = perm->block, row = perm->cols*blk, col, r, a, b, m, dst, pos = 0;
+
+            send_buf = ALLOC( uint8_t, elem_size*n_local );
+            for( col = 0; col < perm->cols && n_local; ++col )
+            {
+               for( r = lo/row; r*row < hi; ++r )
+               {
+                  a = MAX( r*row + col*blk, lo );
+                  b = MIN( r*row + (col + 1)*blk, hi );
+                  if( a >= b )
+                     continue;
+                  dst = (col*perm->rows + r)*blk + a - (r*row + col*blk);
+                  while( a < b )
+                  {
+                     rr = _find_rank( offs, n_ranks, dst );
+                     m = MIN( b - a, offs[rr + 1] - dst );
+                     if( rr == rank )
+                        memcpy( out + elem_size*(dst - lo), in + elem_size*(a - lo), elem_size*m );
+                     else
+                     {
+                        if( !send_cnts[rr] )
+                           send_displs[rr] = pos;
+                        memcpy( send_buf + elem_size*pos, in + elem_size*(a - lo), elem_size*m );
+                        send_cnts[rr] += m;
+                        pos += m;
+                     }
+                     a += m;
+                     dst += m;
+                  }
+               }
+            }
+            _transpose_recv( perm, offs, n_ranks, rank, recv_cnts, NULL, NULL, NULL, elem_size );
+            make_displs( n_ranks, recv_cnts, recv_displs );
+            recv_buf = ALLOC( uint8_t, elem_size*(recv_displs[n_ranks - 1] + recv_cnts[n_ranks - 1]) );
+         }
+         break;
+   }
+
+   MPI_OK( MPI_Alltoallv( send_buf, (int*)send_cnts, (int*)send_displs, data_type,
+                          recv_buf, (int*)recv_cnts, (int*)recv_displs, data_type, comm ) );
+   if( recv_buf != out )
+   {
+      memset( recv_cnts, 0, sizeof(unsigned)*n_ranks );
+      _transpose_recv( perm, offs, n_ranks, rank, recv_cnts, recv_displs, recv_buf, out, elem_size );
+      FREE( recv_buf );
+   }
+   if( send_buf != in )
+      FREE( send_buf );
+   free( *data );
+   *data = out;
+
+   FREE( offs );
+   FREE( send_cnts );
+   FREE( send_displs );
+   FREE( recv_cnts );
+   FREE( recv_displs );
+}
+
+void
+permute_push( unsigned n_elems,
+              unsigned n_local,
+              unsigned const* dest_idxs,
+              void** data,
+              MPI_Datatype data_type,
+              MPI_Comm comm )
+{
+   unsigned *dst_cnts, *dst_displs, *dst_idxs, *local;
+   unsigned *inc_cnts, *inc_displs, *inc_idxs;
+   unsigned n_local_elems, base, n_inc, ii;
+   MPI_Request reqs[2];
+   MPI_Aint lb, elem_size;
+   uint8_t *out_data, *inc_data, *perm_data;
+   int n_ranks, rank;
+
+   assert( !n_local || dest_idxs );
+   assert( !n_local || data );
+   assert( !n_elems || comm );
+
+   MPI_OK( MPI_Comm_size( comm, &n_ranks ) );
+   MPI_OK( MPI_Comm_rank( comm, &rank ) );
+   MPI_OK( MPI_Type_get_extent( data_type, &lb, &elem_size ) );
+
+   /* Group elements by the rank owning their destination; this
+      is exactly the grouping of required indices in a pull. */
+   dst_cnts = ALLOCZ( unsigned, n_ranks );
+   dst_displs = ALLOC( unsigned, n_ranks );
+   count_required( n_elems, n_local, dest_idxs, n_ranks, dst_cnts, dst_displs );
+   dst_idxs = ALLOC( unsigned, n_local );
+   local = ALLOC( unsigned, n_local );
+   make_required( n_elems, n_local, dest_idxs, n_ranks, dst_idxs, dst_cnts, dst_displs, local );
+   out_data = ALLOC( uint8_t, elem_size*n_local );
+   kernel_gather( n_local, local, elem_size, *data, out_data );
+   FREE( local );
+
+   /* Send information about sizes. */
+   inc_cnts = ALLOC( unsigned, n_ranks );
+   inc_displs = ALLOC( unsigned, n_ranks );
+   MPI_OK( MPI_Alltoall( dst_cnts, 1, MPI_UNSIGNED, inc_cnts, 1, MPI_UNSIGNED, comm ) );
+   make_displs( n_ranks, inc_cnts, inc_displs );
+   n_inc = inc_displs[n_ranks - 1] + inc_cnts[n_ranks - 1];
+
+   /* Destinations and elements travel together; neither
+      exchange waits on the other. */
+   inc_idxs = ALLOC( unsigned, n_inc );
+   inc_data = ALLOC( uint8_t, elem_size*n_inc );
+   MPI_OK( MPI_Ialltoallv( dst_idxs, (int*)dst_cnts, (int*)dst_displs, MPI_UNSIGNED,
+                           inc_idxs, (int*)inc_cnts, (int*)inc_displs, MPI_UNSIGNED, comm, reqs + 0 ) );
+   MPI_OK( MPI_Ialltoallv( out_data, (int*)dst_cnts, (int*)dst_displs, data_type,
+                           inc_data, (int*)inc_cnts, (int*)inc_displs, data_type, comm, reqs + 1 ) );
+   MPI_OK( MPI_Waitall( 2, reqs, MPI_STATUSES_IGNORE ) );
+   FREE( dst_cnts );
+   FREE( dst_displs );
+   FREE( dst_idxs );
+   FREE( inc_cnts );
+   FREE( inc_displs );
+   FREE( out_data );
+
+   /* Use a scan to find my base. */
+   n_local_elems = local_size( n_elems, n_ranks, rank );
+   MPI_OK( MPI_Scan( &n_local_elems, &base, 1, MPI_UNSIGNED, MPI_SUM, comm ) );
+   base -= n_local_elems;
+
+   /* Place each element in its final position. */
+   for( ii = 0; ii < n_inc; ++ii )
+   {
+      assert( inc_idxs[ii] >= base && inc_idxs[ii] < base + n_local_elems );
+      inc_idxs[ii] -= base;
+   }
+   perm_data = ALLOC( uint8_t, elem_size*n_local_elems );
+   kernel_scatter( n_inc, inc_idxs, elem_size, inc_data, perm_data );
+   FREE( inc_idxs );
+   FREE( inc_data );
+
+   free( *data );
+   *data = perm_data;
+}
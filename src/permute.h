@@ -1,13 +1,482 @@
 /*!
 ** @file
 ** @author Luke Hodkinson, 2014
+**
+** Thread safety: the only process wide mutable state is the
+** atomic kernel level (see kernels.h), and all scratch storage
+** belongs to a single call. Under MPI_THREAD_MULTIPLE, calls
+** that take a communicator are collective over it, so threads
+** issuing them concurrently must use distinct communicators.
+** Plans, batches and ghost sets own a duplicate of their
+** communicator; once built, several may be executed from
+** different threads at once. One plan must not be executed from
+** two threads at the same time. Single use calls, such as
+** scatter, share one duplicate per communicator, kept as an
+** attribute of it and freed with it.
 */
 
 #ifndef permute_h
 #define permute_h
 
+#include <stddef.h>
+#include <pthread.h>
 #include <mpi.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*!
+** A scatter plan. Holds the result of negotiating which
+** elements each rank requires from every other rank, so
+** the same exchange can be executed with different
+** transports, or repeatedly for different data arrays
+** sharing the same indices. Source elements are either block
+** distributed or, when dist is set, distributed as given by
+** its n_ranks + 1 offsets.
+*/
+struct scatter_plan
+{
+   int       n_ranks;
+   int       rank;
+   unsigned  n_elems;
+   unsigned  n_idxs;
+   unsigned  n_local_elems;
+   unsigned  base;
+   unsigned* req_cnts;
+   unsigned* req_displs;
+   unsigned* local;
+   unsigned* out_cnts;
+   unsigned* out_displs;
+   unsigned* out_idxs;
+   unsigned* dist;
+   MPI_Comm  comm;
+   int       own_comm;
+};
+typedef struct scatter_plan scatter_plan_t;
+
+/*!
+** Build a scatter plan. Exchanges the desired indices with
+** their owners. The plan keeps a private duplicate of the
+** communicator, so different plans may be executed from
+** different threads at the same time. Must be called
+** collectively.
+**
+** @param[out] plan    scatter plan to initialise
+** @param[in]  n_elems number of global data elements
+** @param[in]  n_idxs  number of local desired indices
+** @param[in]  idxs    array of desired local indices
+** @param[in]  comm    MPI communicator
+*/
+void
+scatter_plan_init( scatter_plan_t* plan,
+                   unsigned n_elems,
+                   unsigned n_idxs,
+                   unsigned const* idxs,
+                   MPI_Comm comm );
+
+/*!
+** Build a scatter plan for a single use. Instead of a private
+** duplicate, the plan talks over one duplicate of the
+** communicator that is made on first use and kept with it
+** for all such plans, which saves a duplication per call.
+** Plans built this way on the same communicator must not be
+** executed at the same time. Must be called collectively.
+**
+** @param[out] plan    scatter plan to initialise
+** @param[in]  n_elems number of global data elements
+** @param[in]  n_idxs  number of local desired indices
+** @param[in]  idxs    array of desired local indices
+** @param[in]  comm    MPI communicator
+*/
+void
+scatter_plan_init_shared( scatter_plan_t* plan,
+                          unsigned n_elems,
+                          unsigned n_idxs,
+                          unsigned const* idxs,
+                          MPI_Comm comm );
+
+/*!
+** Build a scatter plan over an irregularly distributed array,
+** where rank r owns elements dist[r] up to dist[r + 1]. Must
+** be called collectively.
+**
+** @param[out] plan   scatter plan to initialise
+** @param[in]  dist   element offsets of every rank, n_ranks + 1
+** @param[in]  n_idxs number of local desired indices
+** @param[in]  idxs   array of desired global indices
+** @param[in]  comm   MPI communicator
+*/
+void
+scatter_plan_init_dist( scatter_plan_t* plan,
+                        unsigned const* dist,
+                        unsigned n_idxs,
+                        unsigned const* idxs,
+                        MPI_Comm comm );
+
+/*!
+** Release the storage held by a scatter plan. Must be called
+** collectively, as it frees the plan's communicator when the
+** plan has its own.
+**
+** @param[inout] plan scatter plan
+*/
+void
+scatter_plan_free( scatter_plan_t* plan );
+
+/*!
+** Update a scatter plan for a slightly changed set of indices.
+** The new request order is the old one with the removed
+** positions taken out, followed by the added indices. Only the
+** changes are sent, and only to the owners they affect, so the
+** communication is proportional to the size of the change.
+** Must be called collectively.
+**
+** @param[inout] plan      scatter plan
+** @param[in]    n_removed number of request positions to remove
+** @param[in]    removed   request positions to remove
+** @param[in]    n_added   number of indices to append
+** @param[in]    added     indices to append
+*/
+void
+scatter_plan_update( scatter_plan_t* plan,
+                     unsigned n_removed,
+                     unsigned const* removed,
+                     unsigned n_added,
+                     unsigned const* added );
+
+/*!
+** Execute a scatter plan using a single all-to-all with
+** indexed datatypes.
+**
+** @param[in]  plan      scatter plan
+** @param[in]  data      array of local data elements
+** @param[out] recv_data preallocated array of n_idxs elements
+** @param[in]  data_type MPI datatype of data elements
+*/
+void
+scatter_plan_execute( scatter_plan_t const* plan,
+                      void const* data,
+                      void* recv_data,
+                      MPI_Datatype data_type );
+
+/*!
+** Execute a scatter plan using a pairwise pipelined schedule.
+** All receives are posted up front, then at step k elements are
+** packed and sent to rank + k while rank - k is sending to us.
+** Each source is unpacked as soon as it arrives, so packing,
+** communication and unpacking overlap.
+**
+** @param[in]  plan      scatter plan
+** @param[in]  data      array of local data elements
+** @param[out] recv_data preallocated array of n_idxs elements
+** @param[in]  data_type MPI datatype of data elements
+*/
+void
+scatter_plan_execute_pipelined( scatter_plan_t const* plan,
+                                void const* data,
+                                void* recv_data,
+                                MPI_Datatype data_type );
+
+/*!
+** Element transform applied while unpacking. Called once for
+** each received element with a pointer to the element and to
+** its final slot in the output.
+*/
+typedef void (*scatter_transform_t)( void const* elem,
+                                     void* out,
+                                     void* ctx );
+
+/*!
+** Execute a scatter plan using the pipelined schedule, passing
+** each element through a transform as it is unpacked into its
+** final slot. The output need not have the same element size
+** as the input, so transforms may narrow or convert types.
+**
+** @param[in]  plan      scatter plan
+** @param[in]  data      array of local data elements
+** @param[out] recv_data preallocated array of n_idxs outputs
+** @param[in]  data_type MPI datatype of data elements
+** @param[in]  out_size  size of each output, ignored without transform
+** @param[in]  transform element transform, may be NULL
+** @param[in]  ctx       user context passed to the transform
+*/
+void
+scatter_plan_execute_transform( scatter_plan_t const* plan,
+                                void const* data,
+                                void* recv_data,
+                                MPI_Datatype data_type,
+                                size_t out_size,
+                                scatter_transform_t transform,
+                                void* ctx );
+
+/*!
+** Execute a scatter plan by packing outgoing elements into
+** a contiguous buffer and exchanging with MPI_Alltoallv.
+**
+** @param[in]  plan      scatter plan
+** @param[in]  data      array of local data elements
+** @param[out] recv_data preallocated array of n_idxs elements
+** @param[in]  data_type MPI datatype of data elements
+*/
+void
+scatter_plan_execute_packed( scatter_plan_t const* plan,
+                             void const* data,
+                             void* recv_data,
+                             MPI_Datatype data_type );
+
+/*!
+** Execute a scatter plan on CSR data. Row lengths travel in a
+** header ahead of each rank's payload, so after a count-only
+** message sizing the receive buffers a single exchange moves
+** everything. Displacements are rebuilt from the headers.
+**
+** @param[in]  plan        scatter plan
+** @param[in]  elem_displs displacements of local data elements
+** @param[in]  data        array of local data elements
+** @param[out] recv_data   resulting data elements
+** @param[out] recv_displs resulting data element displacements
+** @param[in]  data_type   MPI datatype of data elements
+*/
+void
+scatter_plan_executev( scatter_plan_t const* plan,
+                       unsigned const* elem_displs,
+                       void const* data,
+                       void** recv_data,
+                       unsigned** recv_displs,
+                       MPI_Datatype data_type );
+
+/*!
+** Execute a scatter plan moving only the true bytes of each
+** element. The datatype is flattened into its data ranges once
+** and cached on the datatype, so padding never reaches staging
+** buffers or the network.
+**
+** @param[in]  plan      scatter plan
+** @param[in]  data      array of local data elements
+** @param[out] recv_data preallocated array of n_idxs elements
+** @param[in]  data_type MPI datatype of data elements
+*/
+void
+scatter_plan_execute_flat( scatter_plan_t const* plan,
+                           void const* data,
+                           void* recv_data,
+                           MPI_Datatype data_type );
+
+/*!
+** Execute a scatter plan leaving results grouped by source
+** rank instead of in request order. Element i of the result
+** belongs at position plan->local[i] of the request order.
+** Skips the scattered writes of the unpack entirely.
+**
+** @param[in]  plan      scatter plan
+** @param[in]  data      array of local data elements
+** @param[out] recv_data preallocated array of n_idxs elements
+** @param[in]  data_type MPI datatype of data elements
+*/
+void
+scatter_plan_execute_grouped( scatter_plan_t const* plan,
+                              void const* data,
+                              void* recv_data,
+                              MPI_Datatype data_type );
+
+/*!
+** Reorder grouped results into request order.
+**
+** @param[in]  n_idxs    number of elements
+** @param[in]  local     request order position of each element
+** @param[in]  grouped   elements grouped by source rank
+** @param[out] recv_data preallocated array of n_idxs elements
+** @param[in]  data_type MPI datatype of data elements
+*/
+void
+scatter_ungroup( unsigned n_idxs,
+                 unsigned const* local,
+                 void const* grouped,
+                 void* recv_data,
+                 MPI_Datatype data_type );
+
+/*!
+** Signature shared by all scatter plan transports.
+*/
+typedef void (*scatter_transport_t)( scatter_plan_t const*,
+                                     void const*,
+                                     void*,
+                                     MPI_Datatype );
+
+/*!
+** Available scatter transports, used for automatic selection.
+*/
+enum scatter_algo
+{
+   SCATTER_ALGO_INDEXED,
+   SCATTER_ALGO_PACKED,
+   SCATTER_ALGO_PIPELINED,
+   SCATTER_ALGO_FLAT,
+   SCATTER_N_ALGOS
+};
+
+/*!
+** Cost model thresholds. Pairs exchanging fewer bytes than
+** SCATTER_SMALL_PAIR_BYTES are considered latency bound.
+** Elements of at least SCATTER_LARGE_ELEM_BYTES are left to
+** the datatype engine rather than being staged.
+*/
+#define SCATTER_SMALL_PAIR_BYTES 4096
+#define SCATTER_LARGE_ELEM_BYTES 256
+
+/*!
+** Global arrays no larger than this many bytes are always
+** replicated rather than scattered.
+*/
+#define SCATTER_REPLICATE_BYTES (8*1024*1024)
+
+/*!
+** Produce a call site key for use with the scatter tuner.
+*/
+#define SCATTER_SITE_STR2( x ) #x
+#define SCATTER_SITE_STR( x ) SCATTER_SITE_STR2( x )
+#define SCATTER_SITE __FILE__ ":" SCATTER_SITE_STR( __LINE__ )
+
+/*!
+** Global statistics of a scatter plan, identical on all ranks.
+*/
+struct scatter_stats
+{
+   int      n_ranks;
+   MPI_Aint elem_size;
+   int      true_size;
+   unsigned max_partners;
+   double   total_bytes;
+   double   bytes_per_pair;
+   double   skew;
+};
+typedef struct scatter_stats scatter_stats_t;
+
+/*!
+** Remembers the transport chosen for each call site. If a
+** filename is given the decisions are loaded on initialisation
+** and saved when freed, so later runs skip the selection.
+** Lookups and updates are locked, so worker threads may share
+** one tuner.
+*/
+struct scatter_tuner
+{
+   unsigned        n_entries;
+   unsigned        max_entries;
+   char**          keys;
+   int*            algos;
+   char*           filename;
+   int             measure;
+   MPI_Comm        comm;
+   pthread_mutex_t lock;
+};
+typedef struct scatter_tuner scatter_tuner_t;
+
+/*!
+** Gather statistics of a scatter plan: the largest number of
+** remote partners any rank sends to, the mean bytes per
+** communicating pair, and the skew (busiest rank's bytes
+** over the mean). Must be called collectively.
+**
+** @param[in]  plan      scatter plan
+** @param[in]  data_type MPI datatype of data elements
+** @param[out] stats     resulting statistics
+*/
+void
+scatter_plan_stats( scatter_plan_t const* plan,
+                    MPI_Datatype data_type,
+                    scatter_stats_t* stats );
+
+/*!
+** Select a transport from plan statistics using the
+** built-in cost model.
+**
+** @param[in] stats plan statistics
+** @returns One of the scatter_algo values.
+*/
+int
+scatter_select( scatter_stats_t const* stats );
+
+/*!
+** Name of a transport, as stored in tuner files.
+**
+** @param[in] algo one of the scatter_algo values
+*/
+char const*
+scatter_algo_name( int algo );
+
+/*!
+** Initialise a scatter tuner. Must be called collectively.
+**
+** @param[out] tuner    tuner to initialise
+** @param[in]  filename decision cache file, may be NULL
+** @param[in]  measure  time all transports on first use of a
+**                      key instead of using the cost model
+** @param[in]  comm     MPI communicator
+*/
+void
+scatter_tuner_init( scatter_tuner_t* tuner,
+                    char const* filename,
+                    int measure,
+                    MPI_Comm comm );
+
+/*!
+** Free a scatter tuner, saving decisions if it has a file.
+** Must be called collectively.
+**
+** @param[inout] tuner scatter tuner
+*/
+void
+scatter_tuner_free( scatter_tuner_t* tuner );
+
+/*!
+** Find the transport recorded for a call site. Takes the
+** tuner's lock, so the tuner is not const.
+**
+** @param[inout] tuner scatter tuner
+** @param[in]    key   call site key
+** @returns The recorded transport, or -1.
+*/
+int
+scatter_tuner_lookup( scatter_tuner_t* tuner,
+                      char const* key );
+
+/*!
+** Record the transport for a call site.
+**
+** @param[inout] tuner scatter tuner
+** @param[in]    key   call site key
+** @param[in]    algo  one of the scatter_algo values
+*/
+void
+scatter_tuner_set( scatter_tuner_t* tuner,
+                   char const* key,
+                   int algo );
+
+/*!
+** Execute a scatter plan with an automatically selected
+** transport. A decision recorded in the tuner for the key is
+** reused. Otherwise either all transports are timed (if the
+** tuner measures) or the cost model decides, and the choice is
+** recorded. Must be called collectively with the same key.
+**
+** @param[in]    plan      scatter plan
+** @param[in]    data      array of local data elements
+** @param[out]   recv_data preallocated array of n_idxs elements
+** @param[in]    data_type MPI datatype of data elements
+** @param[inout] tuner     scatter tuner, may be NULL
+** @param[in]    key       call site key, may be NULL
+** @returns The transport used.
+*/
+int
+scatter_plan_execute_auto( scatter_plan_t const* plan,
+                           void const* data,
+                           void* recv_data,
+                           MPI_Datatype data_type,
+                           scatter_tuner_t* tuner,
+                           char const* key );
+
 /*!
 ** Send/recv indexed data. Using an array of desired indices,
 ** scatter the implicitly ordered data to the appropriate
@@ -30,6 +499,225 @@ scatter( unsigned n_elems,
          MPI_Datatype data_type,
          MPI_Comm comm );
 
+/*!
+** Send/recv indexed data using the pairwise pipelined schedule.
+** Identical to scatter, but overlaps packing and unpacking with
+** communication; best suited to bandwidth bound exchanges.
+**
+** @param[in]  n_elems   number of global data elements
+** @param[in]  n_idxs    number of local desired indices
+** @param[in]  idxs      array of desired local indices
+** @param[in]  data      array of local data elements
+** @param[out] recv_data resulting data elements
+** @param[in]  data_type MPI datatype of data elements
+** @param[in]  comm      MPI communicator
+*/
+void
+scatter_pipelined( unsigned n_elems,
+                   unsigned n_idxs,
+                   unsigned const* idxs,
+                   void const* data,
+                   void** recv_data,
+                   MPI_Datatype data_type,
+                   MPI_Comm comm );
+
+/*!
+** Send/recv indexed data using an automatically selected
+** transport. Arrays for which scatter_should_replicate holds
+** are replicated, otherwise see scatter_plan_execute_auto.
+**
+** @param[in]    n_elems   number of global data elements
+** @param[in]    n_idxs    number of local desired indices
+** @param[in]    idxs      array of desired local indices
+** @param[in]    data      array of local data elements
+** @param[out]   recv_data resulting data elements
+** @param[in]    data_type MPI datatype of data elements
+** @param[in]    comm      MPI communicator
+** @param[inout] tuner     scatter tuner, may be NULL
+** @param[in]    key       call site key, e.g. SCATTER_SITE
+*/
+void
+scatter_auto( unsigned n_elems,
+              unsigned n_idxs,
+              unsigned const* idxs,
+              void const* data,
+              void** recv_data,
+              MPI_Datatype data_type,
+              MPI_Comm comm,
+              scatter_tuner_t* tuner,
+              char const* key );
+
+/*!
+** Decide whether replicating the whole array is cheaper than
+** scattering it: true when the array is no larger than
+** SCATTER_REPLICATE_BYTES, or when ranks request, on average,
+** enough elements that the index exchange alone would move as
+** much data. Must be called collectively.
+**
+** @param[in] n_elems   number of global data elements
+** @param[in] n_idxs    number of local desired indices
+** @param[in] data_type MPI datatype of data elements
+** @param[in] comm      MPI communicator
+** @returns Non-zero if replication should be used, identically
+**          on all ranks.
+*/
+int
+scatter_should_replicate( unsigned n_elems,
+                          unsigned n_idxs,
+                          MPI_Datatype data_type,
+                          MPI_Comm comm );
+
+/*!
+** Send/recv indexed data by replicating the whole array with
+** an all-gather (into node shared memory where possible) and
+** gathering the desired indices locally. No indices are
+** exchanged.
+**
+** @param[in]  n_elems   number of global data elements
+** @param[in]  n_idxs    number of local desired indices
+** @param[in]  idxs      array of desired local indices
+** @param[in]  data      array of local data elements
+** @param[out] recv_data resulting data elements
+** @param[in]  data_type MPI datatype of data elements
+** @param[in]  comm      MPI communicator
+*/
+void
+scatter_replicated( unsigned n_elems,
+                    unsigned n_idxs,
+                    unsigned const* idxs,
+                    void const* data,
+                    void** recv_data,
+                    MPI_Datatype data_type,
+                    MPI_Comm comm );
+
+/*!
+** Send/recv indexed data, transforming each element as it is
+** placed in the result. Saves a second pass over the output
+** for conversions such as IDs to local offsets or narrowing.
+**
+** @param[in]  n_elems   number of global data elements
+** @param[in]  n_idxs    number of local desired indices
+** @param[in]  idxs      array of desired local indices
+** @param[in]  data      array of local data elements
+** @param[out] recv_data resulting transformed elements
+** @param[in]  data_type MPI datatype of data elements
+** @param[in]  out_size  size of each transformed element
+** @param[in]  transform element transform
+** @param[in]  ctx       user context passed to the transform
+** @param[in]  comm      MPI communicator
+*/
+void
+scatter_transform( unsigned n_elems,
+                   unsigned n_idxs,
+                   unsigned const* idxs,
+                   void const* data,
+                   void** recv_data,
+                   MPI_Datatype data_type,
+                   size_t out_size,
+                   scatter_transform_t transform,
+                   void* ctx,
+                   MPI_Comm comm );
+
+/*!
+** Send/recv indexed data, leaving the results grouped by the
+** rank they came from. Useful when the order does not matter,
+** e.g. for reductions, or when reordering can be deferred with
+** scatter_ungroup. The local array and counts must be freed.
+**
+** @param[in]  n_elems   number of global data elements
+** @param[in]  n_idxs    number of local desired indices
+** @param[in]  idxs      array of desired local indices
+** @param[in]  data      array of local data elements
+** @param[out] recv_data resulting data elements, grouped by rank
+** @param[out] local     request order position of each element
+** @param[out] recv_cnts number of elements from each rank, may be NULL
+** @param[in]  data_type MPI datatype of data elements
+** @param[in]  comm      MPI communicator
+*/
+void
+scatter_grouped( unsigned n_elems,
+                 unsigned n_idxs,
+                 unsigned const* idxs,
+                 void const* data,
+                 void** recv_data,
+                 unsigned** local,
+                 unsigned** recv_cnts,
+                 MPI_Datatype data_type,
+                 MPI_Comm comm );
+
+/*!
+** A scatter operation waiting in a batch.
+*/
+struct scatter_batch_op
+{
+   unsigned        n_elems;
+   unsigned        n_idxs;
+   unsigned const* idxs;
+   void const*     data;
+   void**          recv_data;
+   MPI_Datatype    data_type;
+   MPI_Aint        elem_size;
+};
+typedef struct scatter_batch_op scatter_batch_op_t;
+
+/*!
+** A batch of independent scatters executed together, with a
+** single count, index and data exchange for the lot.
+*/
+struct scatter_batch
+{
+   unsigned            n_ops;
+   unsigned            max_ops;
+   scatter_batch_op_t* ops;
+   MPI_Comm            comm;
+};
+typedef struct scatter_batch scatter_batch_t;
+
+/*!
+** Begin a batch of scatters. Must be called collectively,
+** as the batch duplicates the communicator.
+**
+** @param[out] batch batch to initialise
+** @param[in]  comm  MPI communicator
+*/
+void
+scatter_batch_begin( scatter_batch_t* batch,
+                     MPI_Comm comm );
+
+/*!
+** Add a scatter to a batch. Arguments are as for scatter; the
+** arrays must remain valid until the batch is executed, at
+** which point recv_data is filled in. All ranks must add the
+** same sequence of operations.
+**
+** @param[inout] batch     scatter batch
+** @param[in]    n_elems   number of global data elements
+** @param[in]    n_idxs    number of local desired indices
+** @param[in]    idxs      array of desired local indices
+** @param[in]    data      array of local data elements
+** @param[out]   recv_data resulting data elements
+** @param[in]    data_type MPI datatype of data elements
+*/
+void
+scatter_batch_add( scatter_batch_t* batch,
+                   unsigned n_elems,
+                   unsigned n_idxs,
+                   unsigned const* idxs,
+                   void const* data,
+                   void** recv_data,
+                   MPI_Datatype data_type );
+
+/*!
+** Execute all scatters in a batch, sending one message per
+** destination rank for each of the count, index and data
+** exchanges. The batch is finished afterwards; begin it
+** again to reuse it. Must be called collectively.
+**
+** @param[inout] batch scatter batch
+*/
+void
+scatter_batch_execute( scatter_batch_t* batch );
+
 /*!
 ** Send/recv indexed CSR data. Using an array of desired indices,
 ** scatter the implicitly ordered data to the appropriate
@@ -56,6 +744,146 @@ scatterv( unsigned n_elems,
           MPI_Datatype data_type,
           MPI_Comm comm );
 
+/*!
+** Move a distributed array from one distribution to another.
+** Each distribution is given as n_ranks + 1 element offsets,
+** or NULL for the block distribution; at most one may be NULL.
+** Only the slices that change owner are sent, straight from
+** the array, and a rank whose interval is unchanged keeps its
+** array as is. Must be called collectively.
+**
+** @param[in]    src_dist  current element offsets, or NULL
+** @param[in]    dst_dist  desired element offsets, or NULL
+** @param[inout] data      array of local data elements
+** @param[in]    data_type MPI datatype of data elements
+** @param[in]    comm      MPI communicator
+*/
+void
+redistribute( unsigned const* src_dist,
+              unsigned const* dst_dist,
+              void** data,
+              MPI_Datatype data_type,
+              MPI_Comm comm );
+
+/*!
+** Kinds of analytic permutation.
+*/
+enum perm_kind
+{
+   PERM_REVERSE,
+   PERM_SHIFT,
+   PERM_TRANSPOSE
+};
+
+/*!
+** A permutation given in closed form instead of by an index
+** array. Like permute, it pulls: output element i takes input
+** element src(i). A transpose views the input as a row major
+** rows by cols matrix of blocks, each of block elements, and
+** produces the cols by rows matrix.
+*/
+struct perm_desc
+{
+   int      kind;
+   unsigned n_elems;
+   unsigned shift;
+   unsigned rows;
+   unsigned cols;
+   unsigned block;
+};
+typedef struct perm_desc perm_desc_t;
+
+/*!
+** Describe a reversal, taking input n_elems - 1 - i.
+**
+** @param[out] perm    permutation descriptor
+** @param[in]  n_elems number of global data elements
+*/
+void
+perm_reverse( perm_desc_t* perm,
+              unsigned n_elems );
+
+/*!
+** Describe a cyclic shift, taking input (i + shift)%n_elems.
+**
+** @param[out] perm    permutation descriptor
+** @param[in]  n_elems number of global data elements
+** @param[in]  shift   distance to shift by
+*/
+void
+perm_shift( perm_desc_t* perm,
+            unsigned n_elems,
+            unsigned shift );
+
+/*!
+** Describe a strided permutation, gathering every stride-th
+** element starting from 0, then from 1, and so on. The stride
+** must divide the number of elements.
+**
+** @param[out] perm    permutation descriptor
+** @param[in]  n_elems number of global data elements
+** @param[in]  stride  gather stride
+*/
+void
+perm_stride( perm_desc_t* perm,
+             unsigned n_elems,
+             unsigned stride );
+
+/*!
+** Describe a transpose of a matrix of blocks.
+**
+** @param[out] perm  permutation descriptor
+** @param[in]  rows  number of block rows of the input
+** @param[in]  cols  number of block columns of the input
+** @param[in]  block elements per block
+*/
+void
+perm_transpose( perm_desc_t* perm,
+                unsigned rows,
+                unsigned cols,
+                unsigned block );
+
+/*!
+** Input element taken by an output element.
+**
+** @param[in] perm permutation descriptor
+** @param[in] idx  global output index
+** @returns Global input index.
+*/
+unsigned
+perm_src( perm_desc_t const* perm,
+          unsigned idx );
+
+/*!
+** Output element receiving an input element.
+**
+** @param[in] perm permutation descriptor
+** @param[in] idx  global input index
+** @returns Global output index.
+*/
+unsigned
+perm_dst( perm_desc_t const* perm,
+          unsigned idx );
+
+/*!
+** Permute block distributed data with an analytic permutation.
+** Every rank works out from the descriptor alone which slices
+** it sends, how much it receives from each rank and where that
+** goes, so neither indices nor counts are exchanged; only the
+** payload moves. The local array is replaced. Must be called
+** collectively.
+**
+** @param[in]    perm      permutation descriptor
+** @param[inout] data      array of local data elements
+** @param[in]    data_type MPI datatype of data elements
+** @param[in]    comm      MPI communicator
+*/
+void
+permute_analytic( perm_desc_t const* perm,
+                  void** data,
+                  MPI_Datatype data_type,
+                  MPI_Comm comm );
+
 /*!
 ** Permute indexed data. Using an array of desired indices,
 ** permute the implicitly ordered data to the appropriate
@@ -98,4 +926,135 @@ permutev( unsigned n_elems,
           MPI_Datatype data_type,
           MPI_Comm comm );
 
+/*!
+** Permute indexed CSR data, balancing the result by bytes
+** rather than rows. The requested rows, taken in rank order,
+** are split into contiguous runs so each rank receives
+** roughly the same payload. The resulting row distribution is
+** returned as n_ranks + 1 offsets, which may be passed back
+** as src_dist or to scatter_plan_init_dist in later calls.
+**
+** @param[in]    n_elems     number of global rows, if src_dist is NULL
+** @param[in]    src_dist    row offsets of the source, or NULL for blocks
+** @param[inout] elem_displs displacements of local data elements
+** @param[in]    n_idxs      number of desired indices
+** @param[in]    idxs        array of desired global row indices
+** @param[inout] data        array of local data elements
+** @param[in]    data_type   MPI datatype of data elements
+** @param[out]   dist        resulting row offsets, to be freed
+** @param[in]    comm        MPI communicator
+*/
+void
+permutev_balanced( unsigned n_elems,
+                   unsigned const* src_dist,
+                   unsigned** elem_displs,
+                   unsigned n_idxs,
+                   unsigned const* idxs,
+                   void** data,
+                   MPI_Datatype data_type,
+                   unsigned** dist,
+                   MPI_Comm comm );
+
+/*!
+** Row segments received by a segmented scatter. Segment s holds
+** items displs[s] up to displs[s + 1] of the result, taken from
+** offset offs[s] within global row rows[s].
+*/
+struct scatter_segs
+{
+   unsigned  n_segs;
+   unsigned* rows;
+   unsigned* offs;
+   unsigned* displs;
+};
+typedef struct scatter_segs scatter_segs_t;
+
+/*!
+** Send/recv indexed CSR data, splitting rows across ranks. The
+** items of the requested rows, taken in rank order, are divided
+** evenly over ranks without regard to row boundaries, so a row
+** larger than a rank's share lands on consecutive ranks as
+** segments. Each rank receives a contiguous run of segments;
+** only its first can continue a row and only its last can be
+** continued. Must be called collectively.
+**
+** @param[in]  n_elems     number of global rows
+** @param[in]  elem_displs displacements of local data elements
+** @param[in]  n_idxs      number of desired indices
+** @param[in]  idxs        array of desired global row indices
+** @param[in]  data        array of local data elements
+** @param[out] recv_data   resulting data elements
+** @param[out] segs        resulting segments
+** @param[in]  data_type   MPI datatype of data elements
+** @param[in]  comm        MPI communicator
+*/
+void
+scatterv_segmented( unsigned n_elems,
+                    unsigned const* elem_displs,
+                    unsigned n_idxs,
+                    unsigned const* idxs,
+                    void const* data,
+                    void** recv_data,
+                    scatter_segs_t* segs,
+                    MPI_Datatype data_type,
+                    MPI_Comm comm );
+
+/*!
+** Release the storage held by row segments.
+**
+** @param[inout] segs row segments
+*/
+void
+scatter_segs_free( scatter_segs_t* segs );
+
+/*!
+** Reduce each row of segmented data, finishing rows split over
+** several ranks. Afterwards result holds the reduction of the
+** whole row for every segment at offset zero, and partial
+** values elsewhere. Items are combined in order. Entries for
+** empty segments are left untouched. Must be called
+** collectively.
+**
+** @param[in]  segs      row segments
+** @param[in]  data      segmented data elements
+** @param[out] result    one value per segment
+** @param[in]  data_type MPI datatype of data elements
+** @param[in]  op        MPI reduction operation
+** @param[in]  comm      MPI communicator
+*/
+void
+scatter_segs_reduce( scatter_segs_t const* segs,
+                     void const* data,
+                     void* result,
+                     MPI_Datatype data_type,
+                     MPI_Op op,
+                     MPI_Comm comm );
+
+/*!
+** Permute data by destination. The opposite of permute: each
+** rank knows where its own elements must go, so elements are
+** sent directly to the owner of their destination without an
+** index request round trip. Afterwards each rank holds its
+** block of the n_elems global elements. Destinations should
+** form a permutation; unreached positions are undefined.
+**
+** @param[in]    n_elems   number of global data elements
+** @param[in]    n_local   number of local data elements
+** @param[in]    dest_idxs global destination of each local element
+** @param[inout] data      array of local data elements
+** @param[in]    data_type MPI datatype of data elements
+** @param[in]    comm      MPI communicator
+*/
+void
+permute_push( unsigned n_elems,
+              unsigned n_local,
+              unsigned const* dest_idxs,
+              void** data,
+              MPI_Datatype data_type,
+              MPI_Comm comm );
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,286 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include "read_cache.h"
+#include "utils.h"
+
+void
+_cache_block( read_cache_t const* rc,
+              int n_ranks,
+              unsigned idx,
+              int* owner,
+              unsigned* start,
+              unsigned* len )
+{
+   unsigned upp = rc->n_elems/n_ranks, rem = rc->n_elems%n_ranks, base, end;
+
+   /* Blocks are aligned to their owner's first element so each
+      lives on a single rank. */
+   *owner = locate_rank( rc->n_elems, n_ranks, idx );
+   base = (*owner)*upp + MIN( *owner, rem );
+   end = base + local_size( rc->n_elems, n_ranks, *owner );
+   *start = base + ((idx - base)/rc->block)*rc->block;
+   *len = MIN( rc->block, end - *start );
+}
+
+void
+_cache_insert( read_cache_t* rc,
+               unsigned key,
+               void const* blk,
+               unsigned len )
+{
+   unsigned slot;
+
+   if( !rc->n_slots )
+      return;
+
+   /* CLOCK: pass over recently used slots, clearing their mark,
+      and take the first one that was not. */
+   while( rc->refs[rc->hand] )
+   {
+      rc->refs[rc->hand] = 0;
+      rc->hand = (rc->hand + 1)%rc->n_slots;
+   }
+   slot = rc->hand;
+   rc->hand = (rc->hand + 1)%rc->n_slots;
+   if( rc->keys[slot] != HASH_INVALID )
+      hash_remove( rc->map, rc->keys[slot] );
+   rc->keys[slot] = key;
+   rc->refs[slot] = 1;
+   memcpy( (uint8_t*)rc->slots + rc->elem_size*rc->block*slot, blk, rc->elem_size*len );
+   hash_insert( rc->map, key, slot );
+}
+
+int
+_cmp_keys( void const* a,
+           void const* b )
+{
+   unsigned x = *(unsigned const*)a, y = *(unsigned const*)b;
+
+   return (x > y) - (x < y);
+}
+
+void
+read_cache_init( read_cache_t* rc,
+                 unsigned n_elems,
+                 void const* data,
+                 MPI_Datatype data_type,
+                 unsigned block,
+                 unsigned n_slots,
+                 MPI_Comm comm )
+{
+   unsigned ii;
+   int n_ranks, rank;
+   MPI_Aint lb;
+
+   assert( rc );
+   assert( block > 0 );
+
+   MPI_OK( MPI_Comm_dup( comm, &rc->comm ) );
+   MPI_OK( MPI_Comm_size( rc->comm, &n_ranks ) );
+   MPI_OK( MPI_Comm_rank( rc->comm, &rank ) );
+   MPI_OK( MPI_Type_get_extent( data_type, &lb, &rc->elem_size ) );
+   rc->n_elems = n_elems;
+   rc->data = data;
+   rc->n_local = local_size( n_elems, n_ranks, rank );
+   MPI_OK( MPI_Scan( &rc->n_local, &rc->base, 1, MPI_UNSIGNED, MPI_SUM, rc->comm ) );
+   rc->base -= rc->n_local;
+   assert( !rc->n_local || data );
+
+   rc->block = block;
+   rc->n_slots = n_slots;
+   rc->hand = 0;
+   rc->keys = ALLOC( unsigned, n_slots );
+   rc->refs = ALLOCZ( char, n_slots );
+   rc->slots = ALLOC( uint8_t, rc->elem_size*block*n_slots );
+   for( ii = 0; ii < n_slots; ++ii )
+      rc->keys[ii] = HASH_INVALID;
+   rc->map = hash_new( n_slots ? n_slots : 1 );
+   memset( &rc->stats, 0, sizeof(read_cache_stats_t) );
+}
+
+void
+read_cache_free( read_cache_t* rc )
+{
+   FREE( rc->keys );
+   FREE( rc->refs );
+   FREE( rc->slots );
+   hash_delete( rc->map );
+   MPI_OK( MPI_Comm_free( &rc->comm ) );
+}
+
+void
+read_cache_get( read_cache_t* rc,
+                unsigned n_idxs,
+                unsigned const* idxs,
+                void* recv_data )
+{
+   unsigned *miss_pos, *keys, *lens, *blk_offs, *cnts, *displs, *inc_cnts, *inc_displs, *inc_keys;
+   unsigned *out_bytes, *out_offs, *inc_bytes, *inc_offs;
+   unsigned n_miss = 0, n_blks, n_inc, start, len, slot, ii, kk;
+   MPI_Aint es = rc->elem_size;
+   uint8_t *out_buf, *inc_buf, *ptr;
+   int n_ranks, owner, rr;
+
+   assert( !n_idxs || (idxs && recv_data) );
+
+   MPI_OK( MPI_Comm_size( rc->comm, &n_ranks ) );
+
+   /* Serve what we can, remembering the misses. */
+   miss_pos = ALLOC( unsigned, n_idxs );
+   keys = ALLOC( unsigned, n_idxs );
+   for( ii = 0; ii < n_idxs; ++ii )
+   {
+      uint8_t* dst = (uint8_t*)recv_data + es*ii;
+
+      assert( idxs[ii] < rc->n_elems );
+      if( idxs[ii] >= rc->base && idxs[ii] < rc->base + rc->n_local )
+      {
+         memcpy( dst, (uint8_t const*)rc->data + es*(idxs[ii] - rc->base), es );
+         ++rc->stats.n_local;
+         continue;
+      }
+      _cache_block( rc, n_ranks, idxs[ii], &owner, &start, &len );
+      slot = hash_lookup( rc->map, start );
+      if( slot != HASH_INVALID )
+      {
+         rc->refs[slot] = 1;
+         memcpy( dst, (uint8_t*)rc->slots + es*(rc->block*slot + idxs[ii] - start), es );
+         ++rc->stats.n_hits;
+         continue;
+      }
+      keys[n_miss] = start;
+      miss_pos[n_miss++] = ii;
+   }
+   rc->stats.n_lookups += n_idxs;
+   rc->stats.n_misses += n_miss;
+
+   /* Each missing block is fetched once. Sorted block starts are
+      grouped by owner already. */
+   qsort( keys, n_miss, sizeof(unsigned), _cmp_keys );
+   for( ii = 0, n_blks = 0; ii < n_miss; ++ii )
+   {
+      if( !n_blks || keys[ii] != keys[n_blks - 1] )
+         keys[n_blks++] = keys[ii];
+   }
+   cnts = ALLOCZ( unsigned, n_ranks );
+   displs = ALLOC( unsigned, n_ranks );
+   lens = ALLOC( unsigned, n_blks );
+   blk_offs = ALLOC( unsigned, n_blks );
+   for( ii = 0, kk = 0; ii < n_blks; ++ii )
+   {
+      _cache_block( rc, n_ranks, keys[ii], &owner, &start, lens + ii );
+      ++cnts[owner];
+      blk_offs[ii] = kk;
+      kk += lens[ii];
+   }
+   make_displs( n_ranks, cnts, displs );
+
+   /* One exchange of block starts, one of block contents. */
+   inc_cnts = ALLOC( unsigned, n_ranks );
+   inc_displs = ALLOC( unsigned, n_ranks );
+   MPI_OK( MPI_Alltoall( cnts, 1, MPI_UNSIGNED, inc_cnts, 1, MPI_UNSIGNED, rc->comm ) );
+   make_displs( n_ranks, inc_cnts, inc_displs );
+   n_inc = inc_displs[n_ranks - 1] + inc_cnts[n_ranks - 1];
+   inc_keys = ALLOC( unsigned, n_inc );
+   MPI_OK( MPI_Alltoallv( keys, (int*)cnts, (int*)displs, MPI_UNSIGNED,
+                          inc_keys, (int*)inc_cnts, (int*)inc_displs, MPI_UNSIGNED, rc->comm ) );
+
+   out_bytes = ALLOCZ( unsigned, n_ranks );
+   out_offs = ALLOC( unsigned, n_ranks );
+   inc_bytes = ALLOCZ( unsigned, n_ranks );
+   inc_offs = ALLOC( unsigned, n_ranks );
+   for( rr = 0; rr < n_ranks; ++rr )
+   {
+      for( ii = inc_displs[rr]; ii < inc_displs[rr] + inc_cnts[rr]; ++ii )
+      {
+         _cache_block( rc, n_ranks, inc_keys[ii], &owner, &start, &len );
+         out_bytes[rr] += es*len;
+      }
+      for( ii = displs[rr]; ii < displs[rr] + cnts[rr]; ++ii )
+         inc_bytes[rr] += es*lens[ii];
+   }
+   make_displs( n_ranks, out_bytes, out_offs );
+   make_displs( n_ranks, inc_bytes, inc_offs );
+   out_buf = ALLOC( uint8_t, out_offs[n_ranks - 1] + out_bytes[n_ranks - 1] );
+   for( ii = 0, ptr = out_buf; ii < n_inc; ++ii )
+   {
+      _cache_block( rc, n_ranks, inc_keys[ii], &owner, &start, &len );
+      assert( start >= rc->base && start + len <= rc->base + rc->n_local );
+      memcpy( ptr, (uint8_t const*)rc->data + es*(start - rc->base), es*len );
+      ptr += es*len;
+   }
+   inc_buf = ALLOC( uint8_t, inc_offs[n_ranks - 1] + inc_bytes[n_ranks - 1] );
+   MPI_OK( MPI_Alltoallv( out_buf, (int*)out_bytes, (int*)out_offs, MPI_BYTE,
+                          inc_buf, (int*)inc_bytes, (int*)inc_offs, MPI_BYTE, rc->comm ) );
+   FREE( out_buf );
+   FREE( inc_keys );
+
+   /* Fill the misses from the fetched blocks, then cache them. */
+   for( ii = 0; ii < n_miss; ++ii )
+   {
+      unsigned idx = idxs[miss_pos[ii]], *found;
+
+      _cache_block( rc, n_ranks, idx, &owner, &start, &len );
+      found = (unsigned*)bsearch( &start, keys, n_blks, sizeof(unsigned), _cmp_keys );
+      assert( found );
+      kk = found - keys;
+      memcpy( (uint8_t*)recv_data + es*miss_pos[ii], inc_buf + es*(blk_offs[kk] + idx - start), es );
+   }
+   for( ii = 0; ii < n_blks; ++ii )
+      _cache_insert( rc, keys[ii], inc_buf + es*blk_offs[ii], lens[ii] );
+
+   /* Without the cache every remote lookup would have sent an
+      index and received an element. */
+   {
+      double fetched = (double)sizeof(unsigned)*n_blks + (double)es*(n_blks ? blk_offs[n_blks - 1] + lens[n_blks - 1] : 0);
+      double plain = 0.0;
+
+      for( ii = 0; ii < n_idxs; ++ii )
+      {
+         if( idxs[ii] < rc->base || idxs[ii] >= rc->base + rc->n_local )
+            plain += sizeof(unsigned) + es;
+      }
+      rc->stats.n_blocks += n_blks;
+      rc->stats.bytes_fetched += fetched;
+      rc->stats.bytes_saved += plain - fetched;
+   }
+
+   FREE( inc_buf );
+   FREE( miss_pos );
+   FREE( keys );
+   FREE( lens );
+   FREE( blk_offs );
+   FREE( cnts );
+   FREE( displs );
+   FREE( inc_cnts );
+   FREE( inc_displs );
+   FREE( out_bytes );
+   FREE( out_offs );
+   FREE( inc_bytes );
+   FREE( inc_offs );
+}
+
+void
+read_cache_clear( read_cache_t* rc )
+{
+   unsigned ii;
+
+   for( ii = 0; ii < rc->n_slots; ++ii )
+   {
+      if( rc->keys[ii] != HASH_INVALID )
+         hash_remove( rc->map, rc->keys[ii] );
+      rc->keys[ii] = HASH_INVALID;
+      rc->refs[ii] = 0;
+   }
+   rc->hand = 0;
+}
+
+void
+read_cache_stats( read_cache_t const* rc,
+                  read_cache_stats_t* stats )
+{
+   MPI_OK( MPI_Allreduce( (void*)&rc->stats, stats, sizeof(read_cache_stats_t)/sizeof(double), MPI_DOUBLE,
+                          MPI_SUM, rc->comm ) );
+}
@@ -0,0 +1,131 @@
+/*!
+** @file
+** @author Luke Hodkinson, 2014
+*/
+
+#ifndef read_cache_h
+#define read_cache_h
+
+#include <mpi.h>
+#include "hash.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*!
+** Counters kept by a read cache. Bytes saved compares the
+** traffic of fetching every remote lookup with a scatter, an
+** index out and an element back, against the traffic actually
+** spent fetching blocks.
+*/
+struct read_cache_stats
+{
+   double n_lookups;
+   double n_local;
+   double n_hits;
+   double n_misses;
+   double n_blocks;
+   double bytes_fetched;
+   double bytes_saved;
+};
+typedef struct read_cache_stats read_cache_stats_t;
+
+/*!
+** A per rank cache of remote elements of a block distributed
+** array that is read repeatedly, such as during tree walks.
+** Remote elements are fetched in blocks of consecutive
+** elements from their owner, so nearby lookups hit, and blocks
+** are evicted with the CLOCK algorithm.
+*/
+struct read_cache
+{
+   unsigned           n_elems;
+   MPI_Aint           elem_size;
+   void const*        data;
+   unsigned           base;
+   unsigned           n_local;
+   unsigned           block;
+   unsigned           n_slots;
+   unsigned           hand;
+   unsigned*          keys;
+   char*              refs;
+   void*              slots;
+   hash_t*            map;
+   read_cache_stats_t stats;
+   MPI_Comm           comm;
+};
+typedef struct read_cache read_cache_t;
+
+/*!
+** Create a read cache over a block distributed array. The local
+** array is referenced, not copied, and must stay valid and
+** unchanged while the cache is in use. Must be called
+** collectively.
+**
+** @param[out] rc        read cache to initialise
+** @param[in]  n_elems   number of global data elements
+** @param[in]  data      array of local data elements
+** @param[in]  data_type MPI datatype of data elements
+** @param[in]  block     number of elements fetched together
+** @param[in]  n_slots   number of blocks the cache holds
+** @param[in]  comm      MPI communicator
+*/
+void
+read_cache_init( read_cache_t* rc,
+                 unsigned n_elems,
+                 void const* data,
+                 MPI_Datatype data_type,
+                 unsigned block,
+                 unsigned n_slots,
+                 MPI_Comm comm );
+
+/*!
+** Release a read cache. Must be called collectively.
+**
+** @param[inout] rc read cache
+*/
+void
+read_cache_free( read_cache_t* rc );
+
+/*!
+** Read elements by global index. Local elements and cached
+** blocks are served directly; the blocks of all misses are
+** fetched in a single exchange and then cached. Must be
+** called collectively, even by ranks with nothing to read.
+**
+** @param[inout] rc        read cache
+** @param[in]    n_idxs    number of indices to read
+** @param[in]    idxs      global indices to read
+** @param[out]   recv_data elements read, in index order
+*/
+void
+read_cache_get( read_cache_t* rc,
+                unsigned n_idxs,
+                unsigned const* idxs,
+                void* recv_data );
+
+/*!
+** Drop all cached blocks, for when the underlying array has
+** changed. Statistics are kept.
+**
+** @param[inout] rc read cache
+*/
+void
+read_cache_clear( read_cache_t* rc );
+
+/*!
+** Sum the statistics of all ranks. Must be called collectively.
+**
+** @param[in]  rc    read cache
+** @param[out] stats global statistics
+*/
+void
+read_cache_stats( read_cache_t const* rc,
+                  read_cache_stats_t* stats );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,159 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "relabel.h"
+#include "permute.h"
+#include "utils.h"
+
+void
+relabel_by_access( unsigned n_elems,
+                   unsigned n_idxs,
+                   unsigned const* idxs,
+                   unsigned* dests,
+                   unsigned* new_idxs,
+                   MPI_Comm comm )
+{
+   unsigned *cnts, *displs, *inc_cnts, *inc_displs, *req_idxs, *inc_idxs;
+   unsigned *hits, *best, *prefs, *want, *offs, *total, *starts, *fill;
+   unsigned n_local, base, n_inc, n_over, over_offs, room, ii;
+   void* recv_data;
+   int n_ranks, rank, phase, rr;
+
+   assert( !n_idxs || idxs );
+
+   MPI_OK( MPI_Comm_size( comm, &n_ranks ) );
+   MPI_OK( MPI_Comm_rank( comm, &rank ) );
+   n_local = local_size( n_elems, n_ranks, rank );
+   MPI_OK( MPI_Scan( &n_local, &base, 1, MPI_UNSIGNED, MPI_SUM, comm ) );
+   base -= n_local;
+   assert( !n_local || dests );
+
+   /* Tell each owner who reads which of its elements. */
+   cnts = ALLOCZ( unsigned, n_ranks );
+   displs = ALLOC( unsigned, n_ranks );
+   req_idxs = ALLOC( unsigned, n_idxs );
+   for( phase = 0; phase < 2; ++phase )
+   {
+      for( ii = 0; ii < n_idxs; ++ii )
+      {
+         assert( idxs[ii] < n_elems );
+         rr = locate_rank( n_elems, n_ranks, idxs[ii] );
+         if( phase == 0 )
+            ++cnts[rr];
+         else
+            req_idxs[displs[rr]++] = idxs[ii];
+      }
+      make_displs( n_ranks, cnts, displs );
+   }
+   inc_cnts = ALLOC( unsigned, n_ranks );
+   inc_displs = ALLOC( unsigned, n_ranks );
+   MPI_OK( MPI_Alltoall( cnts, 1, MPI_UNSIGNED, inc_cnts, 1, MPI_UNSIGNED, comm ) );
+   make_displs( n_ranks, inc_cnts, inc_displs );
+   n_inc = inc_displs[n_ranks - 1] + inc_cnts[n_ranks - 1];
+   inc_idxs = ALLOC( unsigned, n_inc );
+   MPI_OK( MPI_Alltoallv( req_idxs, (int*)cnts, (int*)displs, MPI_UNSIGNED,
+                          inc_idxs, (int*)inc_cnts, (int*)inc_displs, MPI_UNSIGNED, comm ) );
+   FREE( req_idxs );
+
+   /* Prefer the rank reading each element most, one reader at a
+      time so counts need only be kept per element. */
+   hits = ALLOCZ( unsigned, n_local );
+   best = ALLOCZ( unsigned, n_local );
+   prefs = ALLOC( unsigned, n_local );
+   for( ii = 0; ii < n_local; ++ii )
+      prefs[ii] = rank;
+   for( rr = 0; rr < n_ranks; ++rr )
+   {
+      unsigned* first = inc_idxs + inc_displs[rr];
+      unsigned* last = first + inc_cnts[rr];
+      unsigned* ptr;
+
+      for( ptr = first; ptr < last; ++ptr )
+         ++hits[*ptr - base];
+      for( ptr = first; ptr < last; ++ptr )
+      {
+         unsigned elem = *ptr - base;
+
+         if( !hits[elem] )
+            continue;
+         if( hits[elem] > best[elem] || (hits[elem] == best[elem] && rr == rank) )
+         {
+            best[elem] = hits[elem];
+            prefs[elem] = rr;
+         }
+         hits[elem] = 0;
+      }
+   }
+   FREE( hits );
+   FREE( best );
+   FREE( inc_idxs );
+
+   /* Position of my preferring elements among all that prefer
+      each rank, taken in rank order. */
+   want = ALLOCZ( unsigned, n_ranks );
+   offs = ALLOC( unsigned, n_ranks );
+   total = ALLOC( unsigned, n_ranks );
+   starts = ALLOC( unsigned, n_ranks );
+   fill = ALLOC( unsigned, n_ranks );
+   for( ii = 0; ii < n_local; ++ii )
+      ++want[prefs[ii]];
+   MPI_OK( MPI_Scan( want, offs, n_ranks, MPI_UNSIGNED, MPI_SUM, comm ) );
+   MPI_OK( MPI_Allreduce( want, total, n_ranks, MPI_UNSIGNED, MPI_SUM, comm ) );
+   for( rr = 0; rr < n_ranks; ++rr )
+   {
+      offs[rr] -= want[rr];
+      fill[rr] = local_size( n_elems, n_ranks, rr );
+   }
+   make_displs( n_ranks, fill, starts );
+
+   /* Elements fitting in their preferred block go there; the
+      rest are numbered in rank order and fill the room left. */
+   n_over = 0;
+   for( ii = 0; ii < n_local; ++ii )
+   {
+      rr = prefs[ii];
+      if( offs[rr] < fill[rr] )
+         dests[ii] = starts[rr] + offs[rr];
+      else
+      {
+         dests[ii] = n_elems;
+         ++n_over;
+      }
+      ++offs[rr];
+   }
+   MPI_OK( MPI_Scan( &n_over, &over_offs, 1, MPI_UNSIGNED, MPI_SUM, comm ) );
+   over_offs -= n_over;
+   for( ii = 0, rr = 0; ii < n_local; ++ii )
+   {
+      if( dests[ii] < n_elems )
+         continue;
+      for( ; ; ++rr )
+      {
+         assert( rr < n_ranks );
+         room = fill[rr] - MIN( total[rr], fill[rr] );
+         if( over_offs < room )
+            break;
+         over_offs -= room;
+      }
+      dests[ii] = starts[rr] + MIN( total[rr], fill[rr] ) + over_offs++;
+   }
+
+   /* Relabel the requests themselves. */
+   if( new_idxs )
+   {
+      scatter( n_elems, n_idxs, idxs, dests, &recv_data, MPI_UNSIGNED, comm );
+      memcpy( new_idxs, recv_data, sizeof(unsigned)*n_idxs );
+      FREE( recv_data );
+   }
+
+   FREE( cnts );
+   FREE( displs );
+   FREE( inc_cnts );
+   FREE( inc_displs );
+   FREE( prefs );
+   FREE( want );
+   FREE( offs );
+   FREE( total );
+   FREE( starts );
+   FREE( fill );
+}
@@ -0,0 +1,47 @@
+/*!
+** @file
+** @author Luke Hodkinson, 2014
+*/
+
+#ifndef relabel_h
+#define relabel_h
+
+#include <mpi.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*!
+** Compute a new global numbering that places elements on the
+** ranks that read them. Each element is given to the rank that
+** requests it most often, its owner winning ties, as long as
+** that rank's block has room; the rest fill the remaining room
+** in order. Within a block, the elements preferring it keep
+** their relative order and come before those placed there for
+** lack of room elsewhere. The resulting destinations can be
+** passed to permute_push to reorder the data once, after which
+** scatters of the relabelled indices are mostly rank local.
+** Requests from several scatters may be concatenated; repeated
+** indices count as heavier use. Must be called collectively.
+**
+** @param[in]  n_elems  number of global data elements
+** @param[in]  n_idxs   number of local requested indices
+** @param[in]  idxs     requested global indices
+** @param[out] dests    new global index of each local element
+** @param[out] new_idxs requested indices relabelled, may be NULL
+** @param[in]  comm     MPI communicator
+*/
+void
+relabel_by_access( unsigned n_elems,
+                   unsigned n_idxs,
+                   unsigned const* idxs,
+                   unsigned* dests,
+                   unsigned* new_idxs,
+                   MPI_Comm comm );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
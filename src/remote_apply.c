@@ -0,0 +1,266 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include "remote_apply.h"
+#include "utils.h"
+
+void
+remote_apply_init( remote_apply_t* ra,
+                   unsigned n_elems,
+                   void* data,
+                   MPI_Datatype data_type,
+                   MPI_Comm comm )
+{
+   int n_ranks, rank;
+   MPI_Aint lb;
+
+   assert( ra );
+
+   /* Private communicator, as for plans. */
+   MPI_OK( MPI_Comm_dup( comm, &ra->comm ) );
+   MPI_OK( MPI_Comm_size( ra->comm, &n_ranks ) );
+   MPI_OK( MPI_Comm_rank( ra->comm, &rank ) );
+   MPI_OK( MPI_Type_get_extent( data_type, &lb, &ra->elem_size ) );
+   ra->n_elems = n_elems;
+   ra->data = data;
+   ra->n_local = local_size( n_elems, n_ranks, rank );
+   MPI_OK( MPI_Scan( &ra->n_local, &ra->base, 1, MPI_UNSIGNED, MPI_SUM, ra->comm ) );
+   ra->base -= ra->n_local;
+   assert( !ra->n_local || data );
+
+   ra->n_handlers = ra->max_handlers = 0;
+   ra->handlers = NULL;
+   ra->n_calls = ra->max_calls = 0;
+   ra->calls = NULL;
+   ra->args_size = ra->max_args = 0;
+   ra->args = NULL;
+}
+
+void
+remote_apply_free( remote_apply_t* ra )
+{
+   FREE( ra->handlers );
+   FREE( ra->calls );
+   FREE( ra->args );
+   MPI_OK( MPI_Comm_free( &ra->comm ) );
+}
+
+unsigned
+remote_apply_register( remote_apply_t* ra,
+                       remote_func_t func,
+                       size_t arg_size,
+                       size_t res_size,
+                       void* ctx )
+{
+   remote_handler_t* hd;
+
+   assert( func );
+
+   if( ra->n_handlers == ra->max_handlers )
+   {
+      ra->max_handlers = ra->max_handlers ? 2*ra->max_handlers : 4;
+      ra->handlers = (remote_handler_t*)realloc( ra->handlers, sizeof(remote_handler_t)*ra->max_handlers );
+      assert( ra->handlers );
+   }
+   hd = ra->handlers + ra->n_handlers;
+   hd->func = func;
+   hd->arg_size = arg_size;
+   hd->res_size = res_size;
+   hd->ctx = ctx;
+   return ra->n_handlers++;
+}
+
+void
+remote_apply_add( remote_apply_t* ra,
+                  unsigned hid,
+                  unsigned idx,
+                  void const* args,
+                  void* result )
+{
+   remote_call_t* call;
+   size_t arg_size;
+
+   assert( hid < ra->n_handlers );
+   assert( idx < ra->n_elems );
+   arg_size = ra->handlers[hid].arg_size;
+   assert( !arg_size || args );
+
+   if( ra->n_calls == ra->max_calls )
+   {
+      ra->max_calls = ra->max_calls ? 2*ra->max_calls : 64;
+      ra->calls = (remote_call_t*)realloc( ra->calls, sizeof(remote_call_t)*ra->max_calls );
+      assert( ra->calls );
+   }
+   if( ra->args_size + arg_size > ra->max_args )
+   {
+      ra->max_args = MAX( 2*ra->max_args, ra->args_size + arg_size );
+      ra->args = realloc( ra->args, ra->max_args );
+      assert( ra->args );
+   }
+   call = ra->calls + ra->n_calls++;
+   call->idx = idx;
+   call->hid = hid;
+   call->arg_offs = ra->args_size;
+   call->result = result;
+   memcpy( (uint8_t*)ra->args + ra->args_size, args, arg_size );
+   ra->args_size += arg_size;
+}
+
+void
+remote_apply_execute( remote_apply_t* ra )
+{
+   remote_call_t* calls = ra->calls;
+   unsigned *order, *cnts, *displs, *bytes, *byte_displs, *inc_bytes, *inc_byte_displs;
+   unsigned *res_bytes, *res_displs, *ret_bytes, *ret_displs;
+   unsigned hdr[3], ii, n_inc;
+   uint8_t *out_buf, *inc_buf, *ret_buf = NULL, *res_buf, *ptr, *end;
+   size_t max_arg = 0, max_res = 0;
+   void *arg_tmp, *res_tmp;
+   int *owners, n_ranks, phase, rr;
+
+   MPI_OK( MPI_Comm_size( ra->comm, &n_ranks ) );
+
+   /* Order calls by owner, keeping queue order within each, and
+      size what goes to and comes back from every owner. A call
+      travels as its index, handler and result flag followed by
+      its arguments. */
+   owners = ALLOC( int, ra->n_calls );
+   order = ALLOC( unsigned, ra->n_calls );
+   cnts = ALLOCZ( unsigned, n_ranks );
+   displs = ALLOC( unsigned, n_ranks );
+   bytes = ALLOCZ( unsigned, n_ranks );
+   byte_displs = ALLOC( unsigned, n_ranks );
+   res_bytes = ALLOCZ( unsigned, n_ranks );
+   res_displs = ALLOC( unsigned, n_ranks );
+   for( ii = 0; ii < ra->n_calls; ++ii )
+   {
+      remote_handler_t const* hd = ra->handlers + calls[ii].hid;
+
+      owners[ii] = locate_rank( ra->n_elems, n_ranks, calls[ii].idx );
+      ++cnts[owners[ii]];
+      bytes[owners[ii]] += sizeof(hdr) + hd->arg_size;
+      if( calls[ii].result )
+         res_bytes[owners[ii]] += hd->res_size;
+   }
+   make_displs( n_ranks, cnts, displs );
+   make_displs( n_ranks, bytes, byte_displs );
+   make_displs( n_ranks, res_bytes, res_displs );
+   for( ii = 0; ii < ra->n_calls; ++ii )
+      order[displs[owners[ii]]++] = ii;
+
+   out_buf = ALLOC( uint8_t, byte_displs[n_ranks - 1] + bytes[n_ranks - 1] );
+   for( ii = 0, ptr = out_buf; ii < ra->n_calls; ++ii )
+   {
+      remote_call_t const* call = calls + order[ii];
+      size_t arg_size = ra->handlers[call->hid].arg_size;
+
+      hdr[0] = call->idx;
+      hdr[1] = call->hid;
+      hdr[2] = call->result ? 1 : 0;
+      memcpy( ptr, hdr, sizeof(hdr) );
+      memcpy( ptr + sizeof(hdr), (uint8_t*)ra->args + call->arg_offs, arg_size );
+      ptr += sizeof(hdr) + arg_size;
+   }
+
+   inc_bytes = ALLOC( unsigned, n_ranks );
+   inc_byte_displs = ALLOC( unsigned, n_ranks );
+   MPI_OK( MPI_Alltoall( bytes, 1, MPI_UNSIGNED, inc_bytes, 1, MPI_UNSIGNED, ra->comm ) );
+   make_displs( n_ranks, inc_bytes, inc_byte_displs );
+   n_inc = inc_byte_displs[n_ranks - 1] + inc_bytes[n_ranks - 1];
+   inc_buf = ALLOC( uint8_t, n_inc );
+   MPI_OK( MPI_Alltoallv( out_buf, (int*)bytes, (int*)byte_displs, MPI_BYTE,
+                          inc_buf, (int*)inc_bytes, (int*)inc_byte_displs, MPI_BYTE, ra->comm ) );
+   FREE( out_buf );
+
+   /* Arguments and results pass through aligned scratch, as they
+      sit at arbitrary offsets in the message buffers. */
+   for( ii = 0; ii < ra->n_handlers; ++ii )
+   {
+      max_arg = MAX( max_arg, ra->handlers[ii].arg_size );
+      max_res = MAX( max_res, ra->handlers[ii].res_size );
+   }
+   arg_tmp = ALLOC( uint8_t, MAX( max_arg, 1 ) );
+   res_tmp = ALLOC( uint8_t, MAX( max_res, 1 ) );
+
+   /* Size the results owed to each caller, then run the calls. */
+   ret_bytes = ALLOCZ( unsigned, n_ranks );
+   ret_displs = ALLOC( unsigned, n_ranks );
+   for( phase = 0; phase < 2; ++phase )
+   {
+      uint8_t* ret = ret_buf;
+
+      for( rr = 0; rr < n_ranks; ++rr )
+      {
+         ptr = inc_buf + inc_byte_displs[rr];
+         end = ptr + inc_bytes[rr];
+         while( ptr < end )
+         {
+            remote_handler_t const* hd;
+
+            memcpy( hdr, ptr, sizeof(hdr) );
+            assert( hdr[1] < ra->n_handlers );
+            hd = ra->handlers + hdr[1];
+            if( phase == 0 )
+            {
+               if( hdr[2] )
+                  ret_bytes[rr] += hd->res_size;
+            }
+            else
+            {
+               assert( hdr[0] >= ra->base && hdr[0] < ra->base + ra->n_local );
+               memcpy( arg_tmp, ptr + sizeof(hdr), hd->arg_size );
+               hd->func( hdr[0], (uint8_t*)ra->data + ra->elem_size*(hdr[0] - ra->base),
+                         arg_tmp, hd->res_size ? res_tmp : NULL, hd->ctx );
+               if( hdr[2] )
+               {
+                  memcpy( ret, res_tmp, hd->res_size );
+                  ret += hd->res_size;
+               }
+            }
+            ptr += sizeof(hdr) + hd->arg_size;
+         }
+      }
+      if( phase == 0 )
+      {
+         make_displs( n_ranks, ret_bytes, ret_displs );
+         ret_buf = ALLOC( uint8_t, ret_displs[n_ranks - 1] + ret_bytes[n_ranks - 1] );
+      }
+   }
+   FREE( inc_buf );
+
+   /* Results come back in the order the calls were sent. */
+   res_buf = ALLOC( uint8_t, res_displs[n_ranks - 1] + res_bytes[n_ranks - 1] );
+   MPI_OK( MPI_Alltoallv( ret_buf, (int*)ret_bytes, (int*)ret_displs, MPI_BYTE,
+                          res_buf, (int*)res_bytes, (int*)res_displs, MPI_BYTE, ra->comm ) );
+   for( ii = 0, ptr = res_buf; ii < ra->n_calls; ++ii )
+   {
+      remote_call_t const* call = calls + order[ii];
+      size_t res_size = ra->handlers[call->hid].res_size;
+
+      if( call->result )
+      {
+         memcpy( call->result, ptr, res_size );
+         ptr += res_size;
+      }
+   }
+
+   ra->n_calls = 0;
+   ra->args_size = 0;
+   FREE( arg_tmp );
+   FREE( res_tmp );
+   FREE( ret_buf );
+   FREE( res_buf );
+   FREE( owners );
+   FREE( order );
+   FREE( cnts );
+   FREE( displs );
+   FREE( bytes );
+   FREE( byte_displs );
+   FREE( inc_bytes );
+   FREE( inc_byte_displs );
+   FREE( res_bytes );
+   FREE( res_displs );
+   FREE( ret_bytes );
+   FREE( ret_displs );
+}
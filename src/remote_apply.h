@@ -0,0 +1,159 @@
+/*!
+** @file
+** @author Luke Hodkinson, 2014
+*/
+
+#ifndef remote_apply_h
+#define remote_apply_h
+
+#include <stddef.h>
+#include <mpi.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*!
+** Handler run by the owner of an element. Called with the
+** global index, a pointer to the owned element, the arguments
+** queued with the call and a slot of the handler's result size
+** to fill in, NULL if the result size is zero. The result is
+** only sent back if the caller asked for it.
+*/
+typedef void (*remote_func_t)( unsigned idx,
+                               void* elem,
+                               void const* args,
+                               void* result,
+                               void* ctx );
+
+/*!
+** A registered handler and the sizes of its payloads.
+*/
+struct remote_handler
+{
+   remote_func_t func;
+   size_t        arg_size;
+   size_t        res_size;
+   void*         ctx;
+};
+typedef struct remote_handler remote_handler_t;
+
+/*!
+** A queued call.
+*/
+struct remote_call
+{
+   unsigned idx;
+   unsigned hid;
+   size_t   arg_offs;
+   void*    result;
+};
+typedef struct remote_call remote_call_t;
+
+/*!
+** Calls applied to elements of a block distributed array by
+** their owners. Rather than fetching an element, modifying it
+** and sending it back, the caller ships the operation and its
+** arguments to the owner, which halves the traffic of read,
+** modify, write patterns.
+*/
+struct remote_apply
+{
+   unsigned          n_elems;
+   void*             data;
+   MPI_Aint          elem_size;
+   unsigned          base;
+   unsigned          n_local;
+   unsigned          n_handlers;
+   unsigned          max_handlers;
+   remote_handler_t* handlers;
+   unsigned          n_calls;
+   unsigned          max_calls;
+   remote_call_t*    calls;
+   size_t            args_size;
+   size_t            max_args;
+   void*             args;
+   MPI_Comm          comm;
+};
+typedef struct remote_apply remote_apply_t;
+
+/*!
+** Set up remote application over a block distributed array.
+** The local array is referenced and modified in place by
+** handlers. Must be called collectively.
+**
+** @param[out] ra        remote apply to initialise
+** @param[in]  n_elems   number of global data elements
+** @param[in]  data      array of local data elements
+** @param[in]  data_type MPI datatype of data elements
+** @param[in]  comm      MPI communicator
+*/
+void
+remote_apply_init( remote_apply_t* ra,
+                   unsigned n_elems,
+                   void* data,
+                   MPI_Datatype data_type,
+                   MPI_Comm comm );
+
+/*!
+** Release a remote apply. Must be called collectively.
+**
+** @param[inout] ra remote apply
+*/
+void
+remote_apply_free( remote_apply_t* ra );
+
+/*!
+** Register a handler. Handlers are identified by the order of
+** registration, so every rank must register the same handlers
+** in the same order.
+**
+** @param[inout] ra       remote apply
+** @param[in]    func     handler
+** @param[in]    arg_size size of the arguments of each call
+** @param[in]    res_size size of the result of each call, may be 0
+** @param[in]    ctx      user context passed to the handler
+** @returns Handler id.
+*/
+unsigned
+remote_apply_register( remote_apply_t* ra,
+                       remote_func_t func,
+                       size_t arg_size,
+                       size_t res_size,
+                       void* ctx );
+
+/*!
+** Queue a call of a handler on an element. The arguments are
+** copied. The result, if wanted, is written when the calls are
+** executed, so it must remain valid until then.
+**
+** @param[inout] ra     remote apply
+** @param[in]    hid    handler id
+** @param[in]    idx    global index of the element
+** @param[in]    args   arguments of the handler's size
+** @param[out]   result result slot, or NULL to not return one
+*/
+void
+remote_apply_add( remote_apply_t* ra,
+                  unsigned hid,
+                  unsigned idx,
+                  void const* args,
+                  void* result );
+
+/*!
+** Ship all queued calls to the owners of their elements and run
+** them there, returning any results. An owner runs calls in the
+** order of the calling ranks, and each rank's calls in the order
+** they were queued. The queue is empty afterwards. Must be
+** called collectively.
+**
+** @param[inout] ra remote apply
+*/
+void
+remote_apply_execute( remote_apply_t* ra );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
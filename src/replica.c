@@ -0,0 +1,125 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include "replica.h"
+#include "kernels.h"
+#include "utils.h"
+
+void
+replica_init( replica_t* rep,
+              unsigned n_elems,
+              void const* data,
+              MPI_Datatype data_type,
+              MPI_Comm comm )
+{
+   unsigned *cnts, *displs;
+   unsigned n_local_elems, base;
+   int n_ranks, rank, node_size, node_rank;
+   int lims[2], contig;
+   MPI_Aint lb;
+
+   assert( rep );
+   assert( !n_elems || comm );
+
+   MPI_OK( MPI_Comm_size( comm, &n_ranks ) );
+   MPI_OK( MPI_Comm_rank( comm, &rank ) );
+   MPI_OK( MPI_Type_get_extent( data_type, &lb, &rep->elem_size ) );
+   rep->n_elems = n_elems;
+
+   n_local_elems = local_size( n_elems, n_ranks, rank );
+   MPI_OK( MPI_Scan( &n_local_elems, &base, 1, MPI_UNSIGNED, MPI_SUM, comm ) );
+   base -= n_local_elems;
+
+   /* A node wide copy is only possible if each node holds a
+      contiguous range of ranks, and therefore of elements. */
+   MPI_OK( MPI_Comm_split_type( comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &rep->node_comm ) );
+   MPI_OK( MPI_Comm_size( rep->node_comm, &node_size ) );
+   MPI_OK( MPI_Comm_rank( rep->node_comm, &node_rank ) );
+   lims[0] = -rank;
+   lims[1] = rank;
+   MPI_OK( MPI_Allreduce( MPI_IN_PLACE, lims, 2, MPI_INT, MPI_MAX, rep->node_comm ) );
+   contig = (lims[1] + lims[0] + 1 == node_size);
+   MPI_OK( MPI_Allreduce( MPI_IN_PLACE, &contig, 1, MPI_INT, MPI_LAND, comm ) );
+   rep->shared = contig && node_size > 1;
+
+   if( !rep->shared )
+   {
+      cnts = ALLOC( unsigned, n_ranks );
+      displs = ALLOC( unsigned, n_ranks );
+      MPI_OK( MPI_Allgather( &n_local_elems, 1, MPI_UNSIGNED, cnts, 1, MPI_UNSIGNED, comm ) );
+      make_displs( n_ranks, cnts, displs );
+      rep->data = ALLOC( uint8_t, rep->elem_size*n_elems );
+      MPI_OK( MPI_Allgatherv( (void*)data, n_local_elems, data_type,
+                              rep->data, (int*)cnts, (int*)displs, data_type, comm ) );
+      FREE( cnts );
+      FREE( displs );
+      MPI_OK( MPI_Comm_free( &rep->node_comm ) );
+      rep->win = MPI_WIN_NULL;
+   }
+   else
+   {
+      MPI_Comm leader_comm;
+      MPI_Aint win_size;
+      int disp_unit, n_leaders, ii;
+      unsigned node_range[2];
+
+      /* Node leaders own the shared storage. */
+      MPI_OK( MPI_Win_allocate_shared( (node_rank == 0) ? rep->elem_size*n_elems : 0, rep->elem_size,
+                                       MPI_INFO_NULL, rep->node_comm, &rep->data, &rep->win ) );
+      MPI_OK( MPI_Win_shared_query( rep->win, 0, &win_size, &disp_unit, &rep->data ) );
+
+      /* Everyone writes their own block into the node copy. */
+      MPI_OK( MPI_Win_fence( 0, rep->win ) );
+      memcpy( (uint8_t*)rep->data + rep->elem_size*base, data, rep->elem_size*n_local_elems );
+      MPI_OK( MPI_Win_fence( 0, rep->win ) );
+
+      /* Leaders then fill in the other nodes' ranges. */
+      MPI_OK( MPI_Comm_split( comm, (node_rank == 0) ? 0 : MPI_UNDEFINED, rank, &leader_comm ) );
+      node_range[0] = base;
+      node_range[1] = n_local_elems;
+      MPI_OK( MPI_Allreduce( MPI_IN_PLACE, node_range + 1, 1, MPI_UNSIGNED, MPI_SUM, rep->node_comm ) );
+      if( node_rank == 0 )
+      {
+         MPI_OK( MPI_Comm_size( leader_comm, &n_leaders ) );
+         cnts = ALLOC( unsigned, 2*n_leaders );
+         displs = ALLOC( unsigned, n_leaders );
+         MPI_OK( MPI_Allgather( node_range, 2, MPI_UNSIGNED, cnts, 2, MPI_UNSIGNED, leader_comm ) );
+         for( ii = 0; ii < n_leaders; ++ii )
+         {
+            displs[ii] = cnts[2*ii + 0];
+            cnts[ii] = cnts[2*ii + 1];
+         }
+         MPI_OK( MPI_Allgatherv( MPI_IN_PLACE, 0, data_type,
+                                 rep->data, (int*)cnts, (int*)displs, data_type, leader_comm ) );
+         FREE( cnts );
+         FREE( displs );
+         MPI_OK( MPI_Comm_free( &leader_comm ) );
+      }
+      MPI_OK( MPI_Win_fence( 0, rep->win ) );
+   }
+}
+
+void
+replica_free( replica_t* rep )
+{
+   if( rep->shared )
+   {
+      MPI_OK( MPI_Win_free( &rep->win ) );
+      MPI_OK( MPI_Comm_free( &rep->node_comm ) );
+   }
+   else
+      FREE( rep->data );
+   rep->data = NULL;
+}
+
+void
+replica_gather( replica_t const* rep,
+                unsigned n_idxs,
+                unsigned const* idxs,
+                void* recv_data )
+{
+   assert( !n_idxs || idxs );
+   assert( !n_idxs || recv_data );
+   kernel_gather( n_idxs, idxs, rep->elem_size, rep->data, recv_data );
+}
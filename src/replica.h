@@ -0,0 +1,76 @@
+/*!
+** @file
+** @author Luke Hodkinson, 2014
+*/
+
+#ifndef replica_h
+#define replica_h
+
+#include <mpi.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*!
+** A fully replicated copy of a distributed array. Where ranks
+** sharing a node are contiguous in the communicator, a single
+** copy is kept per node in shared memory; otherwise each rank
+** holds its own copy.
+*/
+struct replica
+{
+   unsigned  n_elems;
+   MPI_Aint  elem_size;
+   void*     data;
+   int       shared;
+   MPI_Win   win;
+   MPI_Comm  node_comm;
+};
+typedef struct replica replica_t;
+
+/*!
+** Replicate a block distributed array on all ranks. Must be
+** called collectively.
+**
+** @param[out] rep       replica to initialise
+** @param[in]  n_elems   number of global data elements
+** @param[in]  data      array of local data elements
+** @param[in]  data_type MPI datatype of data elements
+** @param[in]  comm      MPI communicator
+*/
+void
+replica_init( replica_t* rep,
+              unsigned n_elems,
+              void const* data,
+              MPI_Datatype data_type,
+              MPI_Comm comm );
+
+/*!
+** Release a replica. Must be called collectively.
+**
+** @param[inout] rep replica
+*/
+void
+replica_free( replica_t* rep );
+
+/*!
+** Gather elements from a replica by global index. No
+** communication is involved.
+**
+** @param[in]  rep       replica
+** @param[in]  n_idxs    number of desired indices
+** @param[in]  idxs      array of desired global indices
+** @param[out] recv_data preallocated array of n_idxs elements
+*/
+void
+replica_gather( replica_t const* rep,
+                unsigned n_idxs,
+                unsigned const* idxs,
+                void* recv_data );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,186 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include "transpose.h"
+#include "utils.h"
+
+void
+transpose_local( unsigned rows,
+                 unsigned cols,
+                 size_t elem_size,
+                 void const* src,
+                 void* dst )
+{
+   unsigned r0, c0, r1, c1, rr, cc;
+
+   /* Word sized elements get plain typed loops the compiler can
+      vectorise; anything else is copied element by element. */
+   for( r0 = 0; r0 < rows; r0 += TRANSPOSE_TILE )
+   {
+      r1 = MIN( r0 + TRANSPOSE_TILE, rows );
+      for( c0 = 0; c0 < cols; c0 += TRANSPOSE_TILE )
+      {
+         c1 = MIN( c0 + TRANSPOSE_TILE, cols );
+         if( elem_size == sizeof(uint32_t) )
+         {
+            uint32_t const* s = (uint32_t const*)src;
+            uint32_t* d = (uint32_t*)dst;
+
+            for( cc = c0; cc < c1; ++cc )
+            {
+               for( rr = r0; rr < r1; ++rr )
+                  d[(size_t)cc*rows + rr] = s[(size_t)rr*cols + cc];
+            }
+         }
+         else if( elem_size == sizeof(uint64_t) )
+         {
+            uint64_t const* s = (uint64_t const*)src;
+            uint64_t* d = (uint64_t*)dst;
+
+            for( cc = c0; cc < c1; ++cc )
+            {
+               for( rr = r0; rr < r1; ++rr )
+                  d[(size_t)cc*rows + rr] = s[(size_t)rr*cols + cc];
+            }
+         }
+         else
+         {
+            for( cc = c0; cc < c1; ++cc )
+            {
+               for( rr = r0; rr < r1; ++rr )
+               {
+                  memcpy( (uint8_t*)dst + elem_size*((size_t)cc*rows + rr),
+                          (uint8_t const*)src + elem_size*((size_t)rr*cols + cc), elem_size );
+               }
+            }
+         }
+      }
+   }
+}
+
+void
+_transpose_exchange( unsigned rows,
+                     unsigned cols,
+                     void const* tiles,
+                     void* recv_data,
+                     MPI_Datatype data_type,
+                     MPI_Comm comm )
+{
+   MPI_Datatype *send_types, *recv_types;
+   int *send_cnts, *send_displs, *recv_cnts, *recv_displs;
+   unsigned n_rows, n_cols, row_base, col_base, nr, nc;
+   MPI_Aint lb, elem_size;
+   int n_ranks, rank, rr;
+
+   MPI_OK( MPI_Comm_size( comm, &n_ranks ) );
+   MPI_OK( MPI_Comm_rank( comm, &rank ) );
+   MPI_OK( MPI_Type_get_extent( data_type, &lb, &elem_size ) );
+   n_rows = local_size( rows, n_ranks, rank );
+   n_cols = local_size( cols, n_ranks, rank );
+
+   /* After the local transpose, the tile bound for each rank is
+      contiguous. Received tiles are strided pieces of my result
+      rows, described by a vector type so they land in place. */
+   send_types = ALLOC( MPI_Datatype, n_ranks );
+   recv_types = ALLOC( MPI_Datatype, n_ranks );
+   send_cnts = ALLOC( int, n_ranks );
+   send_displs = ALLOC( int, n_ranks );
+   recv_cnts = ALLOC( int, n_ranks );
+   recv_displs = ALLOC( int, n_ranks );
+   for( rr = 0, row_base = col_base = 0; rr < n_ranks; ++rr )
+   {
+      nr = local_size( rows, n_ranks, rr );
+      nc = local_size( cols, n_ranks, rr );
+      send_types[rr] = data_type;
+      send_cnts[rr] = nc*n_rows;
+      send_displs[rr] = elem_size*col_base*n_rows;
+      recv_cnts[rr] = (nr && n_cols) ? 1 : 0;
+      recv_displs[rr] = elem_size*row_base;
+      recv_types[rr] = data_type;
+      if( recv_cnts[rr] )
+      {
+         MPI_OK( MPI_Type_vector( n_cols, nr, rows, data_type, recv_types + rr ) );
+         MPI_OK( MPI_Type_commit( recv_types + rr ) );
+      }
+      row_base += nr;
+      col_base += nc;
+   }
+
+   MPI_OK( MPI_Alltoallw( (void*)tiles, send_cnts, send_displs, send_types,
+                          recv_data, recv_cnts, recv_displs, recv_types, comm ) );
+
+   for( rr = 0; rr < n_ranks; ++rr )
+   {
+      if( recv_cnts[rr] )
+         MPI_OK( MPI_Type_free( recv_types + rr ) );
+   }
+   FREE( send_types );
+   FREE( recv_types );
+   FREE( send_cnts );
+   FREE( send_displs );
+   FREE( recv_cnts );
+   FREE( recv_displs );
+}
+
+void
+transpose( unsigned rows,
+           unsigned cols,
+           void const* data,
+           void** recv_data,
+           MPI_Datatype data_type,
+           MPI_Comm comm )
+{
+   unsigned n_rows, n_cols;
+   MPI_Aint lb, elem_size;
+   uint8_t *tiles;
+   int n_ranks, rank;
+
+   assert( recv_data );
+
+   MPI_OK( MPI_Comm_size( comm, &n_ranks ) );
+   MPI_OK( MPI_Comm_rank( comm, &rank ) );
+   MPI_OK( MPI_Type_get_extent( data_type, &lb, &elem_size ) );
+   n_rows = local_size( rows, n_ranks, rank );
+   n_cols = local_size( cols, n_ranks, rank );
+   assert( !n_rows || !cols || data );
+
+   tiles = ALLOC( uint8_t, elem_size*n_rows*cols );
+   transpose_local( n_rows, cols, elem_size, data, tiles );
+   *recv_data = (void*)ALLOC( uint8_t, elem_size*n_cols*rows );
+   _transpose_exchange( rows, cols, tiles, *recv_data, data_type, comm );
+   FREE( tiles );
+}
+
+void
+transpose_inplace( unsigned rows,
+                   unsigned cols,
+                   void** data,
+                   MPI_Datatype data_type,
+                   MPI_Comm comm )
+{
+   unsigned n_rows, n_cols;
+   MPI_Aint lb, elem_size;
+   uint8_t *tiles;
+   int n_ranks, rank;
+
+   assert( data );
+
+   MPI_OK( MPI_Comm_size( comm, &n_ranks ) );
+   MPI_OK( MPI_Comm_rank( comm, &rank ) );
+   MPI_OK( MPI_Type_get_extent( data_type, &lb, &elem_size ) );
+   n_rows = local_size( rows, n_ranks, rank );
+   n_cols = local_size( cols, n_ranks, rank );
+
+   /* The tiles are the only copy; the original buffer is resized
+      to hold my rows of the result and received into directly. */
+   tiles = ALLOC( uint8_t, elem_size*n_rows*cols );
+   transpose_local( n_rows, cols, elem_size, *data, tiles );
+   if( n_cols*rows != n_rows*cols )
+   {
+      *data = realloc( *data, elem_size*n_cols*rows );
+      assert( *data || !n_cols || !rows );
+   }
+   _transpose_exchange( rows, cols, tiles, *data, data_type, comm );
+   FREE( tiles );
+}
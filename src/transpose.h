@@ -0,0 +1,83 @@
+/*!
+** @file
+** @author Luke Hodkinson, 2014
+*/
+
+#ifndef transpose_h
+#define transpose_h
+
+#include <stddef.h>
+#include <mpi.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*!
+** Side length of the tiles used by local transposes.
+*/
+#define TRANSPOSE_TILE 32
+
+/*!
+** Transpose a local row major matrix, tile by tile so both the
+** reads and the writes stay within cache.
+**
+** @param[in]  rows      number of rows of the source
+** @param[in]  cols      number of columns of the source
+** @param[in]  elem_size size of each element in bytes
+** @param[in]  src       source matrix, rows by cols
+** @param[out] dst       destination matrix, cols by rows
+*/
+void
+transpose_local( unsigned rows,
+                 unsigned cols,
+                 size_t elem_size,
+                 void const* src,
+                 void* dst );
+
+/*!
+** Transpose a distributed matrix. The rows of the rows by cols
+** source are block distributed; so are the rows of the cols by
+** rows result. Each rank transposes its rows locally, which
+** lays out one contiguous tile per destination, and a single
+** all-to-all drops the tiles straight into place. Must be called
+** collectively.
+**
+** @param[in]  rows      number of global rows
+** @param[in]  cols      number of columns
+** @param[in]  data      local rows of the matrix
+** @param[out] recv_data local rows of the transpose
+** @param[in]  data_type MPI datatype of matrix elements
+** @param[in]  comm      MPI communicator
+*/
+void
+transpose( unsigned rows,
+           unsigned cols,
+           void const* data,
+           void** recv_data,
+           MPI_Datatype data_type,
+           MPI_Comm comm );
+
+/*!
+** Transpose a distributed matrix in place. As transpose, but the
+** result replaces the local rows, reusing their buffer; only one
+** local copy of the rows is needed on the side.
+**
+** @param[in]    rows      number of global rows
+** @param[in]    cols      number of columns
+** @param[inout] data      local rows of the matrix
+** @param[in]    data_type MPI datatype of matrix elements
+** @param[in]    comm      MPI communicator
+*/
+void
+transpose_inplace( unsigned rows,
+                   unsigned cols,
+                   void** data,
+                   MPI_Datatype data_type,
+                   MPI_Comm comm );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -3,6 +3,10 @@
 
 #include <assert.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define ALLOC( type, size )                     \
    (type*)_alloc( sizeof(type)*(size) )
 
@@ -65,4 +69,8 @@ make_counts( unsigned size,
 
 #endif
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
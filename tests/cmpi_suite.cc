@@ -0,0 +1,138 @@
+#include <vector>
+#include <mpi.h>
+#define CATCH_CONFIG_RUNNER
+#include "catch.hpp"
+#include "cmpi.hh"
+#include "utils.h"
+
+struct particle
+{
+   double   pos[3];
+   unsigned id;
+};
+
+TEST_CASE( "Typed scatters" )
+{
+   int n_ranks, rank;
+   MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+   MPI_Comm_size( MPI_COMM_WORLD, &n_ranks );
+
+   unsigned n_elems = 5*n_ranks + 2;
+   unsigned n_local = local_size( n_elems, n_ranks, rank ), base;
+   MPI_Scan( &n_local, &base, 1, MPI_UNSIGNED, MPI_SUM, MPI_COMM_WORLD );
+   base -= n_local;
+
+   std::vector<double> data( n_local );
+   std::vector<particle> parts( n_local );
+   for( unsigned ii = 0; ii < n_local; ++ii )
+   {
+      data[ii] = 0.5*(base + ii);
+      parts[ii].pos[0] = parts[ii].pos[1] = parts[ii].pos[2] = base + ii;
+      parts[ii].id = base + ii;
+   }
+   std::vector<unsigned> idxs;
+   for( unsigned ii = 0; ii < n_elems; ii += 2 )
+      idxs.push_back( (ii + 3*rank)%n_elems );
+
+   cmpi::buffer<double> res = cmpi::scatter<double>( n_elems, idxs, data, MPI_COMM_WORLD );
+   REQUIRE( res.size() == idxs.size() );
+   for( unsigned ii = 0; ii < idxs.size(); ++ii )
+      REQUIRE( res[ii] == 0.5*idxs[ii] );
+
+   // Records of any layout travel as packed bytes.
+   cmpi::buffer<particle> pres = cmpi::scatter<particle>( n_elems, idxs, parts, MPI_COMM_WORLD );
+   for( unsigned ii = 0; ii < idxs.size(); ++ii )
+   {
+      REQUIRE( pres[ii].id == idxs[ii] );
+      REQUIRE( pres[ii].pos[2] == idxs[ii] );
+   }
+
+   // A plan executed into caller provided output.
+   cmpi::plan pl( n_elems, idxs, MPI_COMM_WORLD );
+   std::vector<double> out( idxs.size() );
+   for( unsigned pass = 0; pass < 2; ++pass )
+   {
+      for( unsigned ii = 0; ii < n_local; ++ii )
+         data[ii] += 1.0;
+      pl.execute<double>( data, out );
+      for( unsigned ii = 0; ii < idxs.size(); ++ii )
+         REQUIRE( out[ii] == 0.5*idxs[ii] + pass + 1 );
+   }
+
+   // The same plan serves any element type, odd sizes included.
+   struct rgb { unsigned char c[3]; };
+   std::vector<rgb> cols( n_local );
+   for( unsigned ii = 0; ii < n_local; ++ii )
+      cols[ii].c[0] = cols[ii].c[1] = cols[ii].c[2] = base + ii;
+   cmpi::buffer<rgb> cres = pl.execute<rgb>( cols );
+   cmpi::buffer<particle> pout = pl.execute<particle>( parts );
+   for( unsigned ii = 0; ii < idxs.size(); ++ii )
+   {
+      REQUIRE( cres[ii].c[2] == (unsigned char)idxs[ii] );
+      REQUIRE( pout[ii].id == idxs[ii] );
+   }
+
+   // Buffers move, and release their arrays.
+   cmpi::buffer<double> moved( std::move( res ) );
+   REQUIRE( res.empty() );
+   REQUIRE( moved.size() == idxs.size() );
+   double* raw = moved.release();
+   free( raw );
+
+   // Transforms take any function object.
+   double scale = 4.0;
+   cmpi::buffer<float> tres = cmpi::scatter_transform<float>(
+      n_elems, idxs, parts,
+      [scale]( particle const& p ) { return (float)(scale*p.id); }, MPI_COMM_WORLD );
+   for( unsigned ii = 0; ii < idxs.size(); ++ii )
+      REQUIRE( tres[ii] == 4.0f*idxs[ii] );
+
+   // Spans and buffers work as well as vectors.
+   cmpi::buffer<double> local( n_local );
+   for( unsigned ii = 0; ii < n_local; ++ii )
+      local[ii] = data[ii];
+   auto twice = []( double x ) { return 2.0*x; };
+   cmpi::buffer<double> sres = cmpi::scatter_transform<double>(
+      n_elems, idxs, cmpi::span<double const>( data ), twice, MPI_COMM_WORLD );
+   cmpi::buffer<double> bres = cmpi::scatter_transform<double>( n_elems, idxs, local, twice, MPI_COMM_WORLD );
+   for( unsigned ii = 0; ii < idxs.size(); ++ii )
+   {
+      REQUIRE( sres[ii] == 2.0*(0.5*idxs[ii] + 2) );
+      REQUIRE( bres[ii] == sres[ii] );
+   }
+}
+
+TEST_CASE( "Typed local gathers" )
+{
+   struct rgb { unsigned char c[3]; };
+   std::vector<int> src( 50 ), out( 20 ), back( 50, -1 );
+   std::vector<rgb> csrc( 50 ), cout( 20 );
+   std::vector<unsigned> idxs( 20 );
+   for( unsigned ii = 0; ii < 50; ++ii )
+   {
+      src[ii] = 3*ii;
+      csrc[ii].c[0] = csrc[ii].c[1] = csrc[ii].c[2] = ii;
+   }
+   for( unsigned ii = 0; ii < 20; ++ii )
+      idxs[ii] = (7*ii)%50;
+
+   cmpi::local_gather<int>( idxs, src, out );
+   cmpi::local_gather<rgb>( idxs, csrc, cout );
+   cmpi::local_scatter<int>( idxs, out, back );
+   for( unsigned ii = 0; ii < 20; ++ii )
+   {
+      REQUIRE( out[ii] == 3*(int)idxs[ii] );
+      REQUIRE( cout[ii].c[1] == idxs[ii] );
+      REQUIRE( back[idxs[ii]] == 3*(int)idxs[ii] );
+   }
+}
+
+int
+main( int argc,
+      char** argv )
+{
+   MPI_Init( &argc, &argv );
+   int result = Catch::Session().run( argc, argv );
+   MPI_Finalize();
+   return EXIT_SUCCESS;
+}
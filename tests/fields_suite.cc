@@ -0,0 +1,151 @@
+#include <mpi.h>
+#include <stddef.h>
+#define CATCH_CONFIG_RUNNER
+#include "catch.hpp"
+#include "fields.h"
+
+struct particle
+{
+   double pos[3];
+   int    id;
+   char   flags[20];
+   float  mass;
+};
+
+MPI_Datatype
+make_particle_type()
+{
+   int blocklens[4] = { 3, 1, 20, 1 };
+   MPI_Aint displs[4] = { offsetof( particle, pos ), offsetof( particle, id ),
+                          offsetof( particle, flags ), offsetof( particle, mass ) };
+   MPI_Datatype types[4] = { MPI_DOUBLE, MPI_INT, MPI_CHAR, MPI_FLOAT }, tmp, type;
+   MPI_Type_create_struct( 4, blocklens, displs, types, &tmp );
+   MPI_Type_create_resized( tmp, 0, sizeof(particle), &type );
+   MPI_Type_free( &tmp );
+   MPI_Type_commit( &type );
+   return type;
+}
+
+TEST_CASE( "Build a field set from a struct datatype" )
+{
+   MPI_Datatype type = make_particle_type();
+   field_set_t fs;
+   field_set_from_struct( &fs, type, 0xa );
+   REQUIRE( fs.n_fields == 2 );
+   REQUIRE( fs.offs[0] == offsetof( particle, id ) );
+   REQUIRE( fs.sizes[0] == sizeof(int) );
+   REQUIRE( fs.offs[1] == offsetof( particle, mass ) );
+   REQUIRE( fs.sizes[1] == sizeof(float) );
+   REQUIRE( fs.size == sizeof(int) + sizeof(float) );
+   field_set_free( &fs );
+   MPI_Type_free( &type );
+}
+
+TEST_CASE( "Scatter a subset of fields" )
+{
+   int n_ranks, rank;
+   MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+   MPI_Comm_size( MPI_COMM_WORLD, &n_ranks );
+
+   MPI_Datatype type = make_particle_type();
+   field_set_t fs;
+   field_set_from_struct( &fs, type, 0xa );
+
+   std::vector<particle> data( 3 );
+   for( int ii = 0; ii < 3; ++ii )
+   {
+      data[ii].id = rank*3 + ii;
+      data[ii].mass = 0.5f*(rank*3 + ii);
+   }
+   std::vector<unsigned> idxs( 3 );
+   for( int ii = 0; ii < 3; ++ii )
+      idxs[ii] = (rank*3 + ii + 4)%(n_ranks*3);
+
+   char* aos;
+   scatter_fields( n_ranks*3, 3, idxs.data(), data.data(), (void**)&aos, type, &fs, FIELDS_AOS, MPI_COMM_WORLD );
+   for( int ii = 0; ii < 3; ++ii )
+   {
+      int id;
+      float mass;
+      memcpy( &id, aos + ii*fs.size, sizeof(int) );
+      memcpy( &mass, aos + ii*fs.size + sizeof(int), sizeof(float) );
+      REQUIRE( id == idxs[ii] );
+      REQUIRE( mass == 0.5f*idxs[ii] );
+   }
+   free( aos );
+
+   char* soa;
+   scatter_fields( n_ranks*3, 3, idxs.data(), data.data(), (void**)&soa, type, &fs, FIELDS_SOA, MPI_COMM_WORLD );
+   int* ids = (int*)soa;
+   float* masses = (float*)(soa + 3*sizeof(int));
+   for( int ii = 0; ii < 3; ++ii )
+   {
+      REQUIRE( ids[ii] == idxs[ii] );
+      REQUIRE( masses[ii] == 0.5f*idxs[ii] );
+   }
+   free( soa );
+
+   field_set_free( &fs );
+   MPI_Type_free( &type );
+}
+
+TEST_CASE( "Flatten datatypes into data ranges" )
+{
+   MPI_Datatype type = make_particle_type();
+   field_set_t fs;
+   field_set_flatten( &fs, type );
+   REQUIRE( fs.n_fields == 1 );
+   REQUIRE( fs.offs[0] == 0 );
+   REQUIRE( fs.size == offsetof( particle, mass ) + sizeof(float) );
+   field_set_free( &fs );
+   REQUIRE( field_set_cached( type ) == field_set_cached( type ) );
+   REQUIRE( field_set_cached( type )->size == fs.size );
+   MPI_Type_free( &type );
+
+   // Every other pair of ints out of eight.
+   MPI_Type_vector( 2, 2, 4, MPI_INT, &type );
+   field_set_flatten( &fs, type );
+   REQUIRE( fs.n_fields == 2 );
+   REQUIRE( fs.offs[0] == 0 );
+   REQUIRE( fs.sizes[0] == 2*sizeof(int) );
+   REQUIRE( fs.offs[1] == 4*sizeof(int) );
+   REQUIRE( fs.sizes[1] == 2*sizeof(int) );
+   REQUIRE( fs.size == 4*sizeof(int) );
+   field_set_free( &fs );
+   MPI_Type_free( &type );
+
+   // A 2x2 block at (1, 1) of a 3x4 int array.
+   int sizes[2] = { 3, 4 }, subs[2] = { 2, 2 }, starts[2] = { 1, 1 };
+   MPI_Type_create_subarray( 2, sizes, subs, starts, MPI_ORDER_C, MPI_INT, &type );
+   field_set_flatten( &fs, type );
+   REQUIRE( fs.n_fields == 2 );
+   REQUIRE( fs.offs[0] == 5*sizeof(int) );
+   REQUIRE( fs.sizes[0] == 2*sizeof(int) );
+   REQUIRE( fs.offs[1] == 9*sizeof(int) );
+   REQUIRE( fs.sizes[1] == 2*sizeof(int) );
+   REQUIRE( fs.size == 4*sizeof(int) );
+   field_set_free( &fs );
+   MPI_Type_free( &type );
+
+   // The same block in Fortran order runs down the columns.
+   MPI_Type_create_subarray( 2, sizes, subs, starts, MPI_ORDER_FORTRAN, MPI_INT, &type );
+   field_set_flatten( &fs, type );
+   REQUIRE( fs.n_fields == 2 );
+   REQUIRE( fs.offs[0] == 4*sizeof(int) );
+   REQUIRE( fs.offs[1] == 7*sizeof(int) );
+   REQUIRE( fs.size == 4*sizeof(int) );
+   field_set_free( &fs );
+   MPI_Type_free( &type );
+
+   REQUIRE( field_set_cached( MPI_INT ) == NULL );
+}
+
+int
+main( int argc,
+      char** argv )
+{
+   MPI_Init( &argc, &argv );
+   int result = Catch::Session().run( argc, argv );
+   MPI_Finalize();
+   return EXIT_SUCCESS;
+}
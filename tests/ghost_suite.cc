@@ -0,0 +1,54 @@
+#include <mpi.h>
+#define CATCH_CONFIG_RUNNER
+#include "catch.hpp"
+#include "ghost.h"
+
+TEST_CASE( "Refresh ghosts with changed values only" )
+{
+   int n_ranks, rank;
+   MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+   MPI_Comm_size( MPI_COMM_WORLD, &n_ranks );
+
+   // Ghost the last element of the previous rank and the first
+   // element of the next.
+   std::vector<unsigned> idxs( 2 );
+   idxs[0] = ((rank == 0) ? (n_ranks - 1) : (rank - 1))*3 + 2;
+   idxs[1] = ((rank + 1)%n_ranks)*3;
+   std::vector<int> data( 3 );
+   for( int ii = 0; ii < 3; ++ii )
+      data[ii] = rank*3 + ii;
+
+   ghost_t gh;
+   ghost_init( &gh, n_ranks*3, 2, idxs.data(), data.data(), MPI_INT, MPI_COMM_WORLD );
+   int const* ghosts = (int const*)ghost_data( &gh );
+   REQUIRE( ghosts[0] == idxs[0] );
+   REQUIRE( ghosts[1] == idxs[1] );
+
+   // Nothing changed, nothing sent.
+   ghost_update( &gh, data.data() );
+   REQUIRE( gh.n_sent == 0 );
+   REQUIRE( ghosts[0] == idxs[0] );
+
+   // Change only the first element of each rank.
+   data[0] += 100;
+   ghost_mark_dirty( &gh, 0 );
+   ghost_mark_dirty( &gh, 0 );
+   data[1] += 100;
+   ghost_mark_dirty( &gh, 1 );
+   ghost_update( &gh, data.data() );
+   REQUIRE( ghosts[0] == idxs[0] );
+   REQUIRE( ghosts[1] == idxs[1] + 100 );
+   REQUIRE( gh.n_sent == ((n_ranks == 1) ? 0 : 1) );
+
+   ghost_free( &gh );
+}
+
+int
+main( int argc,
+      char** argv )
+{
+   MPI_Init( &argc, &argv );
+   int result = Catch::Session().run( argc, argv );
+   MPI_Finalize();
+   return EXIT_SUCCESS;
+}
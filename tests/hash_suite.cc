@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <limits.h>
+#include <time.h>
 #include "hash.h"
 
 static unsigned const norm_size = 100000;
@@ -39,6 +40,43 @@ test_duplicates( hash_t* hash )
       hash_insert( hash, 100*ii, ii );
 }
 
+void
+test_remove( hash_t* hash )
+{
+   unsigned m = hash->max_size, ii;
+   printf( "Testing remove.\n" );
+
+   /* Three keys sharing a bucket make a chain. */
+   for( ii = 0; ii < 3; ++ii )
+      hash_insert( hash, 1 + ii*m, ii );
+
+   /* Missing keys, in that bucket and in an empty one. */
+   hash_remove( hash, 1 + 3*m );
+   hash_remove( hash, 2 );
+   for( ii = 0; ii < 3; ++ii )
+   {
+      if( hash_lookup( hash, 1 + ii*m ) != ii )
+         printf( "Failed remove of missing key = %d\n", 1 + ii*m );
+   }
+
+   /* The middle of the chain. */
+   hash_remove( hash, 1 + m );
+   if( hash_lookup( hash, 1 + m ) != HASH_INVALID )
+      printf( "Failed remove from middle = %d\n", 1 + m );
+   if( hash_lookup( hash, 1 ) != 0 || hash_lookup( hash, 1 + 2*m ) != 2 )
+      printf( "Failed lookup after remove from middle\n" );
+
+   /* The head of the chain, then the last one left. */
+   hash_remove( hash, 1 );
+   if( hash_lookup( hash, 1 ) != HASH_INVALID )
+      printf( "Failed remove of head = %d\n", 1 );
+   if( hash_lookup( hash, 1 + 2*m ) != 2 )
+      printf( "Failed lookup after remove of head\n" );
+   hash_remove( hash, 1 + 2*m );
+   if( hash->tbl[1] )
+      printf( "Failed to empty bucket\n" );
+}
+
 void
 test_big( hash_t* hash )
 {
@@ -67,6 +105,9 @@ main( int argc,
    test_normal( hash );
    test_duplicates( hash );
    hash_delete( hash );
+   hash = hash_new( norm_size );
+   test_remove( hash );
+   hash_delete( hash );
    hash = hash_new( big_size );
    test_big( hash );
    hash_delete( hash );
@@ -0,0 +1,86 @@
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+#define CATCH_CONFIG_RUNNER
+#include "catch.hpp"
+#include "kernels.h"
+
+void
+check_kernels( unsigned n,
+               unsigned n_src,
+               size_t elem_size )
+{
+   std::vector<char> src( n_src*elem_size ), out( n*elem_size ), back( n_src*elem_size, 0 );
+   std::vector<unsigned> idxs( n );
+   for( unsigned ii = 0; ii < src.size(); ++ii )
+      src[ii] = (7*ii + 3)%127;
+   for( unsigned ii = 0; ii < n; ++ii )
+      idxs[ii] = (ii*2654435761u)%n_src;
+
+   // Offset by one element so vector paths see unaligned buffers.
+   unsigned n_bad = 0;
+   kernel_gather( n - 1, idxs.data() + 1, elem_size, src.data(), out.data() + elem_size );
+   for( unsigned ii = 1; ii < n; ++ii )
+      n_bad += memcmp( out.data() + elem_size*ii, src.data() + elem_size*idxs[ii], elem_size ) != 0;
+   REQUIRE( n_bad == 0 );
+
+   // Scatter the gathered elements back where they came from.
+   kernel_scatter( n - 1, idxs.data() + 1, elem_size, out.data() + elem_size, back.data() );
+   for( unsigned ii = 1; ii < n; ++ii )
+      n_bad += memcmp( back.data() + elem_size*idxs[ii], src.data() + elem_size*idxs[ii], elem_size ) != 0;
+   REQUIRE( n_bad == 0 );
+}
+
+void
+check_stream( unsigned n,
+              size_t elem_size )
+{
+   std::vector<char> src( 5000*elem_size );
+   std::vector<unsigned> idxs( n );
+   void* out;
+   for( unsigned ii = 0; ii < src.size(); ++ii )
+      src[ii] = ii%113;
+   for( unsigned ii = 0; ii < n; ++ii )
+      idxs[ii] = (13*ii)%5000;
+
+   // Streaming stores need an aligned output.
+   REQUIRE( posix_memalign( &out, 64, n*elem_size ) == 0 );
+   kernel_gather( n, idxs.data(), elem_size, src.data(), out );
+   unsigned n_bad = 0;
+   for( unsigned ii = 0; ii < n; ++ii )
+      n_bad += memcmp( (char*)out + elem_size*ii, src.data() + elem_size*idxs[ii], elem_size ) != 0;
+   REQUIRE( n_bad == 0 );
+   free( out );
+}
+
+TEST_CASE( "Gather and scatter kernels" )
+{
+   size_t sizes[] = { 1, 2, 3, 4, 8, 12, 16, 20, 24, 32 };
+   int max_level = kernels_max_level();
+   REQUIRE( kernels_level() == KERNELS_GENERIC );
+   for( int level = KERNELS_GENERIC; level <= max_level; ++level )
+   {
+      int now = kernels_set_level( level );
+      REQUIRE( now == level );
+      for( unsigned ss = 0; ss < sizeof(sizes)/sizeof(size_t); ++ss )
+      {
+         check_kernels( 37, 101, sizes[ss] );
+         check_kernels( 1000, 300, sizes[ss] );
+      }
+
+      // Large enough outputs take the streaming stores.
+      check_stream( KERNELS_STREAM_BYTES/4 + 9, 4 );
+      check_stream( KERNELS_STREAM_BYTES/8 + 9, 8 );
+   }
+   kernels_set_level( KERNELS_GENERIC );
+}
+
+int
+main( int argc,
+      char** argv )
+{
+   MPI_Init( &argc, &argv );
+   int result = Catch::Session().run( argc, argv );
+   MPI_Finalize();
+   return EXIT_SUCCESS;
+}
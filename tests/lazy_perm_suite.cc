@@ -0,0 +1,60 @@
+#include <mpi.h>
+#define CATCH_CONFIG_RUNNER
+#include "catch.hpp"
+#include "lazy_perm.h"
+#include "permute.h"
+
+TEST_CASE( "Compose a permute and a permutev" )
+{
+   int n_ranks, rank;
+   MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+   MPI_Comm_size( MPI_COMM_WORLD, &n_ranks );
+
+   // Shift the elements, group them into two rows per rank and
+   // then reverse the order of the rows.
+   std::vector<unsigned> idxs( 3 ), row_idxs( 2 ), displs( 3 );
+   for( int ii = 0; ii < 3; ++ii )
+      idxs[ii] = (rank*3 + ii + 2)%(n_ranks*3);
+   displs[0] = 0;
+   displs[1] = 1;
+   displs[2] = 3;
+   row_idxs[0] = n_ranks*2 - 1 - rank*2;
+   row_idxs[1] = n_ranks*2 - 2 - rank*2;
+
+   int *eager = (int*)malloc( 3*sizeof(int) ), *lazy = (int*)malloc( 3*sizeof(int) );
+   for( int ii = 0; ii < 3; ++ii )
+      eager[ii] = lazy[ii] = 10*(rank*3 + ii);
+
+   unsigned* eager_displs = (unsigned*)malloc( 3*sizeof(unsigned) );
+   std::copy( displs.begin(), displs.end(), eager_displs );
+   permute( n_ranks*3, 3, idxs.data(), (void**)&eager, MPI_INT, MPI_COMM_WORLD );
+   permutev( n_ranks*2, &eager_displs, 2, row_idxs.data(), (void**)&eager, MPI_INT, MPI_COMM_WORLD );
+
+   lazy_perm_t lp;
+   lazy_perm_init( &lp, n_ranks*3, MPI_COMM_WORLD );
+   lazy_perm_permute( &lp, n_ranks*3, 3, idxs.data() );
+   lazy_perm_set_rows( &lp, 2, displs.data() );
+   lazy_perm_permutev( &lp, n_ranks*2, 2, row_idxs.data() );
+   lazy_perm_apply( &lp, (void**)&lazy, MPI_INT );
+
+   REQUIRE( lp.n_idxs == eager_displs[2] );
+   for( int ii = 0; ii < 3; ++ii )
+      REQUIRE( lazy_perm_displs( &lp )[ii] == eager_displs[ii] );
+   for( unsigned ii = 0; ii < lp.n_idxs; ++ii )
+      REQUIRE( lazy[ii] == eager[ii] );
+
+   lazy_perm_free( &lp );
+   free( eager_displs );
+   free( eager );
+   free( lazy );
+}
+
+int
+main( int argc,
+      char** argv )
+{
+   MPI_Init( &argc, &argv );
+   int result = Catch::Session().run( argc, argv );
+   MPI_Finalize();
+   return EXIT_SUCCESS;
+}
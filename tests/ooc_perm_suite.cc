@@ -0,0 +1,71 @@
+#include <mpi.h>
+#include <stdio.h>
+#include <unistd.h>
+#define CATCH_CONFIG_RUNNER
+#include "catch.hpp"
+#include "ooc_perm.h"
+#include "utils.h"
+
+TEST_CASE( "Permute through spill files" )
+{
+   int n_ranks, rank;
+   MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+   MPI_Comm_size( MPI_COMM_WORLD, &n_ranks );
+
+   // Uneven input counts, reversed into the block distribution.
+   unsigned n_local = rank + 2, n_elems, base;
+   MPI_Allreduce( &n_local, &n_elems, 1, MPI_UNSIGNED, MPI_SUM, MPI_COMM_WORLD );
+   MPI_Scan( &n_local, &base, 1, MPI_UNSIGNED, MPI_SUM, MPI_COMM_WORLD );
+   base -= n_local;
+   std::vector<double> data( n_local );
+   std::vector<unsigned> dests( n_local );
+   for( unsigned ii = 0; ii < n_local; ++ii )
+   {
+      data[ii] = 0.5*(base + ii);
+      dests[ii] = n_elems - 1 - (base + ii);
+   }
+
+   char data_path[256], dest_path[256], out_path[256];
+   sprintf( data_path, "/tmp/cmpi_ooc_data.%d.%d", (int)getpid(), rank );
+   sprintf( dest_path, "/tmp/cmpi_ooc_dest.%d.%d", (int)getpid(), rank );
+   sprintf( out_path, "/tmp/cmpi_ooc_out.%d.%d", (int)getpid(), rank );
+   FILE* file = fopen( data_path, "wb" );
+   fwrite( data.data(), sizeof(double), n_local, file );
+   fclose( file );
+   file = fopen( dest_path, "wb" );
+   fwrite( dests.data(), sizeof(unsigned), n_local, file );
+   fclose( file );
+
+   // A tiny budget forces single record blocks and a pass over
+   // the input per destination, a middle one holds three 64KB
+   // blocks per pass, and a large one needs a single pass.
+   size_t limits[] = { 48, 400000, 1 << 20 };
+   for( size_t limit : limits )
+   {
+      ooc_permute_push( n_elems, n_local, data_path, dest_path, out_path, "/tmp", limit, MPI_DOUBLE, MPI_COMM_WORLD );
+
+      unsigned n_out = local_size( n_elems, n_ranks, rank ), out_base;
+      MPI_Scan( &n_out, &out_base, 1, MPI_UNSIGNED, MPI_SUM, MPI_COMM_WORLD );
+      out_base -= n_out;
+      std::vector<double> out( n_out );
+      file = fopen( out_path, "rb" );
+      REQUIRE( fread( out.data(), sizeof(double), n_out, file ) == n_out );
+      fclose( file );
+      for( unsigned ii = 0; ii < n_out; ++ii )
+         REQUIRE( out[ii] == 0.5*(n_elems - 1 - (out_base + ii)) );
+   }
+
+   unlink( data_path );
+   unlink( dest_path );
+   unlink( out_path );
+}
+
+int
+main( int argc,
+      char** argv )
+{
+   MPI_Init( &argc, &argv );
+   int result = Catch::Session().run( argc, argv );
+   MPI_Finalize();
+   return EXIT_SUCCESS;
+}
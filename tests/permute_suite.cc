@@ -1,13 +1,23 @@
 #include <mpi.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <thread>
 #define CATCH_CONFIG_RUNNER
 #include "catch.hpp"
 #include "permute.h"
 
+// Internal helpers, with C linkage.
+extern "C" {
 int
 locate_rank( unsigned n_elems,
              int n_ranks,
              unsigned idx );
 
+unsigned
+local_size( unsigned n_elems,
+            int n_ranks,
+            int rank );
+
 void
 make_displs( unsigned size,
              unsigned const* cnts,
@@ -30,6 +40,7 @@ make_required( unsigned n_elems,
                unsigned* req_cnts,
                unsigned const* req_displs,
                unsigned* local );
+}
 
 TEST_CASE( "Locate which rank indices exist on" )
 {
@@ -180,15 +191,16 @@ TEST_CASE( "Permute a distributed array" )
    idxs[0] = ((rank == 0) ? (n_ranks - 1) : (rank - 1))*3 + 2;
    idxs[1] = ((rank + 1)%n_ranks)*3;
    idxs[2] = rank*3 + 1;
-   std::vector<int> data( 3 );
+   int* data = (int*)malloc( 3*sizeof(int) );
    data[0] = rank*3 + 0;
    data[1] = rank*3 + 1;
    data[2] = rank*3 + 2;
-   permute( n_ranks*3, 3, idxs.data(), data.data(), MPI_INT, MPI_COMM_WORLD );
+   permute( n_ranks*3, 3, idxs.data(), (void**)&data, MPI_INT, MPI_COMM_WORLD );
 
    REQUIRE( data[0] == idxs[0] );
    REQUIRE( data[1] == idxs[1] );
    REQUIRE( data[2] == idxs[2] );
+   free( data );
 }
 
 TEST_CASE( "Scatter a distributed array" )
@@ -282,11 +294,641 @@ TEST_CASE( "Scatter a distributed array to all" )
    free( recv_displs );
 }
 
+TEST_CASE( "Pipelined scatter of a distributed array" )
+{
+   int n_ranks, rank;
+   MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+   MPI_Comm_size( MPI_COMM_WORLD, &n_ranks );
+
+   std::vector<unsigned> idxs( 3*n_ranks );
+   for( int ii = 0; ii < idxs.size(); ++ii )
+      idxs[ii] = (rank*7 + ii*5)%(n_ranks*3);
+   std::vector<int> data( 3 );
+   data[0] = rank*3 + 0;
+   data[1] = rank*3 + 1;
+   data[2] = rank*3 + 2;
+   int* recv_data;
+   scatter_pipelined( n_ranks*3, idxs.size(), idxs.data(), data.data(), (void**)&recv_data, MPI_INT, MPI_COMM_WORLD );
+
+   for( unsigned ii = 0; ii < idxs.size(); ++ii )
+      REQUIRE( recv_data[ii] == idxs[ii] );
+
+   free( recv_data );
+}
+
+TEST_CASE( "Automatically select a scatter transport" )
+{
+   int n_ranks, rank;
+   MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+   MPI_Comm_size( MPI_COMM_WORLD, &n_ranks );
+
+   std::vector<unsigned> idxs( 3*n_ranks );
+   for( int ii = 0; ii < idxs.size(); ++ii )
+      idxs[ii] = (rank*7 + ii*5)%(n_ranks*3);
+   std::vector<int> data( 3 );
+   data[0] = rank*3 + 0;
+   data[1] = rank*3 + 1;
+   data[2] = rank*3 + 2;
+
+   scatter_plan_t plan;
+   scatter_tuner_t tuner;
+   std::vector<int> recv_data( idxs.size() );
+   scatter_plan_init( &plan, n_ranks*3, idxs.size(), idxs.data(), MPI_COMM_WORLD );
+   scatter_tuner_init( &tuner, NULL, 1, MPI_COMM_WORLD );
+   for( int run = 0; run < 2; ++run )
+   {
+      std::fill( recv_data.begin(), recv_data.end(), -1 );
+      scatter_plan_execute_auto( &plan, data.data(), recv_data.data(), MPI_INT, &tuner, "test" );
+      for( unsigned ii = 0; ii < idxs.size(); ++ii )
+         REQUIRE( recv_data[ii] == idxs[ii] );
+   }
+   REQUIRE( tuner.n_entries == 1 );
+   REQUIRE( scatter_tuner_lookup( &tuner, "test" ) >= 0 );
+   scatter_tuner_free( &tuner );
+
+   scatter_stats_t stats;
+   scatter_plan_stats( &plan, MPI_INT, &stats );
+   REQUIRE( stats.max_partners <= n_ranks - 1 );
+   std::fill( recv_data.begin(), recv_data.end(), -1 );
+   scatter_plan_execute_packed( &plan, data.data(), recv_data.data(), MPI_INT );
+   for( unsigned ii = 0; ii < idxs.size(); ++ii )
+      REQUIRE( recv_data[ii] == idxs[ii] );
+   scatter_plan_free( &plan );
+
+   int* auto_data;
+   scatter_auto( n_ranks*3, idxs.size(), idxs.data(), data.data(), (void**)&auto_data, MPI_INT, MPI_COMM_WORLD,
+                 NULL, SCATTER_SITE );
+   for( unsigned ii = 0; ii < idxs.size(); ++ii )
+      REQUIRE( auto_data[ii] == idxs[ii] );
+   free( auto_data );
+}
+
+TEST_CASE( "Scatter a distributed array by replication" )
+{
+   int n_ranks, rank;
+   MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+   MPI_Comm_size( MPI_COMM_WORLD, &n_ranks );
+
+   std::vector<unsigned> idxs( 3*n_ranks );
+   for( int ii = 0; ii < idxs.size(); ++ii )
+      idxs[ii] = (rank*7 + ii*5)%(n_ranks*3);
+   std::vector<int> data( 3 );
+   data[0] = rank*3 + 0;
+   data[1] = rank*3 + 1;
+   data[2] = rank*3 + 2;
+   int* recv_data;
+   REQUIRE( scatter_should_replicate( n_ranks*3, idxs.size(), MPI_INT, MPI_COMM_WORLD ) );
+   scatter_replicated( n_ranks*3, idxs.size(), idxs.data(), data.data(), (void**)&recv_data, MPI_INT, MPI_COMM_WORLD );
+
+   for( unsigned ii = 0; ii < idxs.size(); ++ii )
+      REQUIRE( recv_data[ii] == idxs[ii] );
+
+   free( recv_data );
+}
+
+TEST_CASE( "Push permute a distributed array" )
+{
+   int n_ranks, rank;
+   MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+   MPI_Comm_size( MPI_COMM_WORLD, &n_ranks );
+
+   // Reverse the global array.
+   std::vector<unsigned> dest_idxs( 3 );
+   int* data = (int*)malloc( 3*sizeof(int) );
+   for( int ii = 0; ii < 3; ++ii )
+   {
+      data[ii] = rank*3 + ii;
+      dest_idxs[ii] = n_ranks*3 - 1 - (rank*3 + ii);
+   }
+   permute_push( n_ranks*3, 3, dest_idxs.data(), (void**)&data, MPI_INT, MPI_COMM_WORLD );
+
+   for( int ii = 0; ii < 3; ++ii )
+      REQUIRE( data[ii] == n_ranks*3 - 1 - (rank*3 + ii) );
+
+   free( data );
+}
+
+TEST_CASE( "Scatter distributed CSR data with an empty request" )
+{
+   int n_ranks, rank;
+   MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+   MPI_Comm_size( MPI_COMM_WORLD, &n_ranks );
+
+   // Rows of chars with odd lengths; rank 0 requests nothing.
+   std::vector<unsigned> idxs, displs( 3 );
+   if( rank != 0 )
+   {
+      idxs.push_back( (rank*2 + 1)%(n_ranks*2) );
+      idxs.push_back( (rank*2 + 2)%(n_ranks*2) );
+   }
+   displs[0] = 0;
+   displs[1] = 1;
+   displs[2] = 4;
+   std::vector<char> data( 4 );
+   for( int ii = 0; ii < 4; ++ii )
+      data[ii] = rank*4 + ii;
+   char* recv_data;
+   unsigned* recv_displs;
+   scatterv( n_ranks*2, displs.data(), idxs.size(), idxs.data(), data.data(), (void**)&recv_data, &recv_displs, MPI_CHAR, MPI_COMM_WORLD );
+
+   REQUIRE( recv_displs[0] == 0 );
+   for( unsigned ii = 0; ii < idxs.size(); ++ii )
+   {
+      unsigned owner = idxs[ii]/2, row = idxs[ii]%2;
+      unsigned len = recv_displs[ii + 1] - recv_displs[ii];
+      REQUIRE( len == ((row == 0) ? 1 : 3) );
+      for( unsigned jj = 0; jj < len; ++jj )
+         REQUIRE( recv_data[recv_displs[ii] + jj] == owner*4 + row + jj );
+   }
+
+   free( recv_data );
+   free( recv_displs );
+}
+
+TEST_CASE( "Scatter padded records without their padding" )
+{
+   int n_ranks, rank;
+   MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+   MPI_Comm_size( MPI_COMM_WORLD, &n_ranks );
+
+   struct rec { double x; char c; };
+   int blocklens[2] = { 1, 1 };
+   MPI_Aint displs[2] = { offsetof( rec, x ), offsetof( rec, c ) };
+   MPI_Datatype types[2] = { MPI_DOUBLE, MPI_CHAR }, tmp, type;
+   MPI_Type_create_struct( 2, blocklens, displs, types, &tmp );
+   MPI_Type_create_resized( tmp, 0, sizeof(rec), &type );
+   MPI_Type_free( &tmp );
+   MPI_Type_commit( &type );
+
+   std::vector<unsigned> idxs( 3 );
+   std::vector<rec> data( 3 ), recv_data( 3 );
+   for( int ii = 0; ii < 3; ++ii )
+   {
+      idxs[ii] = (rank*3 + ii + 1)%(n_ranks*3);
+      data[ii].x = rank*3 + ii;
+      data[ii].c = 'a' + rank*3 + ii;
+   }
+
+   scatter_plan_t plan;
+   scatter_stats_t stats;
+   scatter_plan_init( &plan, n_ranks*3, 3, idxs.data(), MPI_COMM_WORLD );
+   scatter_plan_stats( &plan, type, &stats );
+   REQUIRE( stats.true_size == sizeof(double) + 1 );
+   scatter_plan_execute_flat( &plan, data.data(), recv_data.data(), type );
+   for( int ii = 0; ii < 3; ++ii )
+   {
+      REQUIRE( recv_data[ii].x == idxs[ii] );
+      REQUIRE( recv_data[ii].c == 'a' + idxs[ii] );
+   }
+   scatter_plan_free( &plan );
+   MPI_Type_free( &type );
+}
+
+void
+halve( void const* elem,
+       void* out,
+       void* ctx )
+{
+   *(double*)out = 0.5*(*(int const*)elem) + *(double*)ctx;
+}
+
+TEST_CASE( "Transform elements while scattering" )
+{
+   int n_ranks, rank;
+   MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+   MPI_Comm_size( MPI_COMM_WORLD, &n_ranks );
+
+   std::vector<unsigned> idxs( 3*n_ranks );
+   for( int ii = 0; ii < idxs.size(); ++ii )
+      idxs[ii] = (rank*7 + ii*5)%(n_ranks*3);
+   std::vector<int> data( 3 );
+   data[0] = rank*3 + 0;
+   data[1] = rank*3 + 1;
+   data[2] = rank*3 + 2;
+   double offs = 1.0, *recv_data;
+   scatter_transform( n_ranks*3, idxs.size(), idxs.data(), data.data(), (void**)&recv_data, MPI_INT,
+                      sizeof(double), halve, &offs, MPI_COMM_WORLD );
+
+   for( unsigned ii = 0; ii < idxs.size(); ++ii )
+      REQUIRE( recv_data[ii] == 0.5*idxs[ii] + 1.0 );
+
+   free( recv_data );
+}
+
+TEST_CASE( "Scatter a distributed array grouped by rank" )
+{
+   int n_ranks, rank;
+   MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+   MPI_Comm_size( MPI_COMM_WORLD, &n_ranks );
+
+   std::vector<unsigned> idxs( 3*n_ranks );
+   for( int ii = 0; ii < idxs.size(); ++ii )
+      idxs[ii] = (rank*7 + ii*5)%(n_ranks*3);
+   std::vector<int> data( 3 );
+   data[0] = rank*3 + 0;
+   data[1] = rank*3 + 1;
+   data[2] = rank*3 + 2;
+   int* grouped;
+   unsigned *local, *cnts;
+   scatter_grouped( n_ranks*3, idxs.size(), idxs.data(), data.data(), (void**)&grouped, &local, &cnts,
+                    MPI_INT, MPI_COMM_WORLD );
+
+   unsigned pos = 0;
+   for( int ii = 0; ii < n_ranks; ++ii )
+   {
+      for( unsigned jj = 0; jj < cnts[ii]; ++jj, ++pos )
+      {
+         int owner = grouped[pos]/3;
+         REQUIRE( owner == ii );
+         REQUIRE( grouped[pos] == idxs[local[pos]] );
+      }
+   }
+   REQUIRE( pos == idxs.size() );
+
+   std::vector<int> ordered( idxs.size() );
+   scatter_ungroup( idxs.size(), local, grouped, ordered.data(), MPI_INT );
+   for( unsigned ii = 0; ii < idxs.size(); ++ii )
+      REQUIRE( ordered[ii] == idxs[ii] );
+
+   free( grouped );
+   free( local );
+   free( cnts );
+}
+
+TEST_CASE( "Update a scatter plan incrementally" )
+{
+   int n_ranks, rank;
+   MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+   MPI_Comm_size( MPI_COMM_WORLD, &n_ranks );
+
+   std::vector<unsigned> idxs( 3*n_ranks );
+   for( int ii = 0; ii < idxs.size(); ++ii )
+      idxs[ii] = (rank*7 + ii*5)%(n_ranks*3);
+   std::vector<int> data( 3 );
+   data[0] = rank*3 + 0;
+   data[1] = rank*3 + 1;
+   data[2] = rank*3 + 2;
+
+   scatter_plan_t plan;
+   scatter_plan_init( &plan, n_ranks*3, idxs.size(), idxs.data(), MPI_COMM_WORLD );
+
+   // Drop the first and last requests on odd ranks, and add one on
+   // even ranks.
+   std::vector<unsigned> removed, added, new_idxs;
+   if( rank%2 )
+   {
+      removed.push_back( 0 );
+      removed.push_back( idxs.size() - 1 );
+   }
+   else
+      added.push_back( (rank*3 + 4)%(n_ranks*3) );
+   for( unsigned ii = 0; ii < idxs.size(); ++ii )
+   {
+      if( !(rank%2) || (ii != 0 && ii != idxs.size() - 1) )
+         new_idxs.push_back( idxs[ii] );
+   }
+   new_idxs.insert( new_idxs.end(), added.begin(), added.end() );
+   scatter_plan_update( &plan, removed.size(), removed.data(), added.size(), added.data() );
+   REQUIRE( plan.n_idxs == new_idxs.size() );
+
+   std::vector<int> recv_data( new_idxs.size() );
+   scatter_plan_execute( &plan, data.data(), recv_data.data(), MPI_INT );
+   for( unsigned ii = 0; ii < new_idxs.size(); ++ii )
+      REQUIRE( recv_data[ii] == new_idxs[ii] );
+   scatter_plan_free( &plan );
+}
+
+TEST_CASE( "Execute a batch of scatters" )
+{
+   int n_ranks, rank;
+   MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+   MPI_Comm_size( MPI_COMM_WORLD, &n_ranks );
+
+   std::vector<unsigned> idxs( 3*n_ranks ), dbl_idxs( 2 );
+   for( int ii = 0; ii < idxs.size(); ++ii )
+      idxs[ii] = (rank*7 + ii*5)%(n_ranks*3);
+   std::vector<int> data( 3 );
+   for( int ii = 0; ii < 3; ++ii )
+      data[ii] = rank*3 + ii;
+   std::vector<double> dbl_data( 2 );
+   for( int ii = 0; ii < 2; ++ii )
+   {
+      dbl_idxs[ii] = (rank*2 + ii + 3)%(n_ranks*2);
+      dbl_data[ii] = 0.5*(rank*2 + ii);
+   }
+
+   scatter_batch_t batch;
+   int *recv_data;
+   double *dbl_recv_data;
+   scatter_batch_begin( &batch, MPI_COMM_WORLD );
+   scatter_batch_add( &batch, n_ranks*3, idxs.size(), idxs.data(), data.data(), (void**)&recv_data, MPI_INT );
+   scatter_batch_add( &batch, n_ranks*2, 2, dbl_idxs.data(), dbl_data.data(), (void**)&dbl_recv_data, MPI_DOUBLE );
+   scatter_batch_execute( &batch );
+
+   for( unsigned ii = 0; ii < idxs.size(); ++ii )
+      REQUIRE( recv_data[ii] == idxs[ii] );
+   for( unsigned ii = 0; ii < 2; ++ii )
+      REQUIRE( dbl_recv_data[ii] == 0.5*dbl_idxs[ii] );
+
+   free( recv_data );
+   free( dbl_recv_data );
+}
+
+TEST_CASE( "Execute plans from concurrent threads" )
+{
+   int provided, n_ranks, rank;
+   MPI_Query_thread( &provided );
+   if( provided < MPI_THREAD_MULTIPLE )
+      return;
+   MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+   MPI_Comm_size( MPI_COMM_WORLD, &n_ranks );
+
+   unsigned const n_threads = 4;
+   std::vector<int> data( 10 );
+   for( int ii = 0; ii < 10; ++ii )
+      data[ii] = rank*10 + ii;
+   std::vector<std::vector<unsigned> > idxs( n_threads );
+   std::vector<std::vector<int> > recv_data( n_threads );
+   std::vector<scatter_plan_t> plans( n_threads );
+   for( unsigned tt = 0; tt < n_threads; ++tt )
+   {
+      idxs[tt].resize( 10 );
+      recv_data[tt].resize( 10 );
+      for( unsigned ii = 0; ii < 10; ++ii )
+         idxs[tt][ii] = (rank*10 + ii*(tt + 3) + tt)%(n_ranks*10);
+      scatter_plan_init( &plans[tt], n_ranks*10, 10, idxs[tt].data(), MPI_COMM_WORLD );
+   }
+
+   std::vector<std::thread> threads;
+   for( unsigned tt = 0; tt < n_threads; ++tt )
+   {
+      threads.push_back( std::thread( [&, tt]()
+         {
+            for( int rep = 0; rep < 10; ++rep )
+               scatter_plan_execute( &plans[tt], data.data(), recv_data[tt].data(), MPI_INT );
+         } ) );
+   }
+   for( unsigned tt = 0; tt < n_threads; ++tt )
+      threads[tt].join();
+
+   for( unsigned tt = 0; tt < n_threads; ++tt )
+   {
+      for( unsigned ii = 0; ii < 10; ++ii )
+         REQUIRE( recv_data[tt][ii] == idxs[tt][ii] );
+      scatter_plan_free( &plans[tt] );
+   }
+}
+
+TEST_CASE( "Permute CSR rows balanced by bytes" )
+{
+   int n_ranks, rank;
+   MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+   MPI_Comm_size( MPI_COMM_WORLD, &n_ranks );
+
+   // Four rows per rank; the last row of the array is very long.
+   unsigned n_rows = n_ranks*4, long_len = 12*n_ranks;
+   std::vector<unsigned> lens( 4 ), idxs( 4 );
+   for( unsigned ii = 0; ii < 4; ++ii )
+   {
+      unsigned row = rank*4 + ii;
+      lens[ii] = (row == n_rows - 1) ? long_len : 1;
+      idxs[ii] = n_rows - 1 - row;
+   }
+   unsigned* displs = (unsigned*)malloc( 5*sizeof(unsigned) );
+   displs[0] = 0;
+   for( unsigned ii = 0; ii < 4; ++ii )
+      displs[ii + 1] = displs[ii] + lens[ii];
+   int* data = (int*)malloc( displs[4]*sizeof(int) );
+   for( unsigned ii = 0; ii < 4; ++ii )
+   {
+      for( unsigned jj = displs[ii]; jj < displs[ii + 1]; ++jj )
+         data[jj] = 100*(rank*4 + ii) + jj - displs[ii];
+   }
+
+   unsigned* dist;
+   permutev_balanced( n_rows, NULL, &displs, 4, idxs.data(), (void**)&data, MPI_INT, &dist, MPI_COMM_WORLD );
+   REQUIRE( dist[0] == 0 );
+   REQUIRE( dist[n_ranks] == n_rows );
+
+   // Rows arrive reversed, and no rank holds much more than an
+   // even share plus one row.
+   unsigned n_local = dist[rank + 1] - dist[rank], n_items = displs[n_local], total;
+   for( unsigned ii = 0; ii < n_local; ++ii )
+   {
+      unsigned row = n_rows - 1 - (dist[rank] + ii);
+      unsigned len = (row == n_rows - 1) ? long_len : 1;
+      unsigned got_len = displs[ii + 1] - displs[ii];
+      REQUIRE( got_len == len );
+      for( unsigned jj = 0; jj < len; ++jj )
+      {
+         int expected = 100*row + jj;
+         REQUIRE( data[displs[ii] + jj] == expected );
+      }
+   }
+   MPI_Allreduce( &n_items, &total, 1, MPI_UNSIGNED, MPI_SUM, MPI_COMM_WORLD );
+   unsigned bytes = (n_local + n_items)*4, limit = ((n_rows + total)*4)/n_ranks + (long_len + 1)*4;
+   REQUIRE( bytes <= limit );
+
+   // The descriptor feeds straight into the next permute.
+   unsigned* dist2;
+   std::vector<unsigned> back( n_local );
+   for( unsigned ii = 0; ii < n_local; ++ii )
+      back[ii] = n_rows - 1 - (dist[rank] + ii);
+   permutev_balanced( n_rows, dist, &displs, n_local, back.data(), (void**)&data, MPI_INT, &dist2,
+                      MPI_COMM_WORLD );
+   unsigned n_local2 = dist2[rank + 1] - dist2[rank];
+   for( unsigned ii = 0; ii < n_local2; ++ii )
+   {
+      // Reversing twice restores the original order.
+      int expected = 100*(dist2[rank] + ii);
+      REQUIRE( data[displs[ii]] == expected );
+   }
+
+   free( dist );
+   free( dist2 );
+   free( displs );
+   free( data );
+}
+
+TEST_CASE( "Split giant CSR rows into segments" )
+{
+   int n_ranks, rank;
+   MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+   MPI_Comm_size( MPI_COMM_WORLD, &n_ranks );
+
+   // Two rows per rank; row 1 holds most of the items and one
+   // row is empty.
+   unsigned n_rows = n_ranks*2, giant = 10*n_ranks + 3;
+   std::vector<unsigned> lens( 2 ), idxs( 2 );
+   for( unsigned ii = 0; ii < 2; ++ii )
+   {
+      unsigned row = rank*2 + ii;
+      lens[ii] = (row == 1) ? giant : ((row == 2) ? 0 : 2);
+      idxs[ii] = n_rows - 1 - row;
+   }
+   std::vector<unsigned> displs( 3 );
+   displs[0] = 0;
+   for( unsigned ii = 0; ii < 2; ++ii )
+      displs[ii + 1] = displs[ii] + lens[ii];
+   std::vector<int> data( displs[2] );
+   for( unsigned ii = 0; ii < 2; ++ii )
+   {
+      for( unsigned jj = displs[ii]; jj < displs[ii + 1]; ++jj )
+         data[jj] = 1000*(rank*2 + ii) + jj - displs[ii];
+   }
+
+   int* recv_data;
+   scatter_segs_t segs;
+   scatterv_segmented( n_rows, displs.data(), 2, idxs.data(), data.data(), (void**)&recv_data, &segs, MPI_INT,
+                       MPI_COMM_WORLD );
+
+   // Items are spread evenly, whatever the rows.
+   unsigned n_items = segs.displs[segs.n_segs], total;
+   MPI_Allreduce( &n_items, &total, 1, MPI_UNSIGNED, MPI_SUM, MPI_COMM_WORLD );
+   REQUIRE( n_items <= total/n_ranks + 1 );
+
+   // Every segment holds the right slice of its row.
+   for( unsigned ss = 0; ss < segs.n_segs; ++ss )
+   {
+      for( unsigned jj = segs.displs[ss]; jj < segs.displs[ss + 1]; ++jj )
+      {
+         int expected = 1000*segs.rows[ss] + segs.offs[ss] + jj - segs.displs[ss];
+         REQUIRE( recv_data[jj] == expected );
+      }
+   }
+
+   // Row sums come out whole at the segment starting each row.
+   std::vector<int> sums( segs.n_segs, -1 );
+   scatter_segs_reduce( &segs, recv_data, sums.data(), MPI_INT, MPI_SUM, MPI_COMM_WORLD );
+   for( unsigned ss = 0; ss < segs.n_segs; ++ss )
+   {
+      unsigned row = segs.rows[ss], len = (row == 1) ? giant : ((row == 2) ? 0 : 2);
+      if( segs.offs[ss] || !len )
+         continue;
+      int expected = 1000*row*len + len*(len - 1)/2;
+      REQUIRE( sums[ss] == expected );
+   }
+
+   free( recv_data );
+   scatter_segs_free( &segs );
+}
+
+TEST_CASE( "Redistribute between offset vectors" )
+{
+   int n_ranks, rank;
+   MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+   MPI_Comm_size( MPI_COMM_WORLD, &n_ranks );
+
+   // Rank r holds r + 1 elements; move to blocks and back.
+   std::vector<unsigned> dist( n_ranks + 1 );
+   dist[0] = 0;
+   for( int rr = 0; rr < n_ranks; ++rr )
+      dist[rr + 1] = dist[rr] + rr + 1;
+   unsigned n_elems = dist[n_ranks];
+   double* data = (double*)malloc( (rank + 1)*sizeof(double) );
+   for( int ii = 0; ii <= rank; ++ii )
+      data[ii] = 0.5*(dist[rank] + ii);
+
+   redistribute( dist.data(), NULL, (void**)&data, MPI_DOUBLE, MPI_COMM_WORLD );
+   unsigned n_local = local_size( n_elems, n_ranks, rank ), base;
+   MPI_Scan( &n_local, &base, 1, MPI_UNSIGNED, MPI_SUM, MPI_COMM_WORLD );
+   base -= n_local;
+   for( unsigned ii = 0; ii < n_local; ++ii )
+      REQUIRE( data[ii] == 0.5*(base + ii) );
+
+   redistribute( NULL, dist.data(), (void**)&data, MPI_DOUBLE, MPI_COMM_WORLD );
+   for( int ii = 0; ii <= rank; ++ii )
+      REQUIRE( data[ii] == 0.5*(dist[rank] + ii) );
+
+   // Identical distributions move nothing.
+   double* before = data;
+   redistribute( dist.data(), dist.data(), (void**)&data, MPI_DOUBLE, MPI_COMM_WORLD );
+   REQUIRE( data == before );
+
+   free( data );
+}
+
+TEST_CASE( "Permute with analytic descriptors" )
+{
+   int n_ranks, rank;
+   MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+   MPI_Comm_size( MPI_COMM_WORLD, &n_ranks );
+
+   std::vector<perm_desc_t> perms( 5 );
+   perm_reverse( &perms[0], n_ranks*6 + 1 );
+   perm_shift( &perms[1], n_ranks*6 + 1, 10 );
+   perm_stride( &perms[2], n_ranks*6, 3 );
+   perm_transpose( &perms[3], 3, n_ranks*2, 2 );
+   perm_transpose( &perms[4], n_ranks*2 + 1, 1, 3 );
+
+   for( unsigned pp = 0; pp < perms.size(); ++pp )
+   {
+      unsigned n_elems = perms[pp].n_elems, n_local = local_size( n_elems, n_ranks, rank ), base;
+      MPI_Scan( &n_local, &base, 1, MPI_UNSIGNED, MPI_SUM, MPI_COMM_WORLD );
+      base -= n_local;
+
+      // The two maps are inverses.
+      for( unsigned ii = 0; ii < n_elems; ++ii )
+      {
+         unsigned back = perm_dst( &perms[pp], perm_src( &perms[pp], ii ) );
+         REQUIRE( back == ii );
+      }
+
+      int* data = (int*)malloc( (n_local + 1)*sizeof(int) );
+      for( unsigned ii = 0; ii < n_local; ++ii )
+         data[ii] = base + ii;
+      permute_analytic( &perms[pp], (void**)&data, MPI_INT, MPI_COMM_WORLD );
+      for( unsigned ii = 0; ii < n_local; ++ii )
+      {
+         int expected = perm_src( &perms[pp], base + ii );
+         REQUIRE( data[ii] == expected );
+      }
+      free( data );
+   }
+
+   // Known results, whatever the number of ranks.
+   struct
+   {
+      perm_desc_t perm;
+      std::vector<int> out;
+   } known[4];
+   perm_reverse( &known[0].perm, 10 );
+   known[0].out = { 9, 8, 7, 6, 5, 4, 3, 2, 1, 0 };
+   perm_shift( &known[1].perm, 10, 3 );
+   known[1].out = { 3, 4, 5, 6, 7, 8, 9, 0, 1, 2 };
+   perm_transpose( &known[2].perm, 3, 4, 1 );
+   known[2].out = { 0, 4, 8, 1, 5, 9, 2, 6, 10, 3, 7, 11 };
+   perm_transpose( &known[3].perm, 2, 2, 2 );
+   known[3].out = { 0, 1, 4, 5, 2, 3, 6, 7 };
+   for( unsigned pp = 0; pp < 4; ++pp )
+   {
+      unsigned n_elems = known[pp].perm.n_elems, n_local = local_size( n_elems, n_ranks, rank ), base;
+      MPI_Scan( &n_local, &base, 1, MPI_UNSIGNED, MPI_SUM, MPI_COMM_WORLD );
+      base -= n_local;
+
+      int* data = (int*)malloc( (n_local + 1)*sizeof(int) );
+      for( unsigned ii = 0; ii < n_local; ++ii )
+         data[ii] = base + ii;
+      permute_analytic( &known[pp].perm, (void**)&data, MPI_INT, MPI_COMM_WORLD );
+      for( unsigned ii = 0; ii < n_local; ++ii )
+         REQUIRE( data[ii] == known[pp].out[base + ii] );
+      free( data );
+   }
+
+   // Striding gathers every third element first.
+   perm_desc_t stride;
+   perm_stride( &stride, 12, 3 );
+   REQUIRE( perm_src( &stride, 0 ) == 0 );
+   REQUIRE( perm_src( &stride, 1 ) == 3 );
+   REQUIRE( perm_src( &stride, 4 ) == 1 );
+}
+
 int
 main( int argc,
       char** argv )
 {
-   MPI_Init( &argc, &argv );
+   int provided;
+   MPI_Init_thread( &argc, &argv, MPI_THREAD_MULTIPLE, &provided );
    int result = Catch::Session().run( argc, argv );
    MPI_Finalize();
    return EXIT_SUCCESS;
@@ -0,0 +1,76 @@
+#include <stdlib.h>
+#include <mpi.h>
+#define CATCH_CONFIG_RUNNER
+#include "catch.hpp"
+#include "read_cache.h"
+#include "utils.h"
+
+TEST_CASE( "Repeated random reads through a cache" )
+{
+   int n_ranks, rank;
+   MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+   MPI_Comm_size( MPI_COMM_WORLD, &n_ranks );
+
+   unsigned n_elems = 50*n_ranks + 7;
+   unsigned n_local = local_size( n_elems, n_ranks, rank ), base;
+   MPI_Scan( &n_local, &base, 1, MPI_UNSIGNED, MPI_SUM, MPI_COMM_WORLD );
+   base -= n_local;
+   std::vector<double> data( n_local );
+   for( unsigned ii = 0; ii < n_local; ++ii )
+      data[ii] = 10.0*(base + ii);
+
+   // Enough slots for every block, so the second pass only hits.
+   read_cache_t rc;
+   read_cache_init( &rc, n_elems, data.data(), MPI_DOUBLE, 8, n_elems/8 + n_ranks, MPI_COMM_WORLD );
+
+   srand( 13 + rank );
+   unsigned n_idxs = 150 + 10*rank;
+   std::vector<unsigned> idxs( n_idxs );
+   std::vector<double> result( n_idxs );
+   for( unsigned ii = 0; ii < n_idxs; ++ii )
+      idxs[ii] = rand()%n_elems;
+   for( unsigned pass = 0; pass < 2; ++pass )
+   {
+      read_cache_get( &rc, n_idxs, idxs.data(), result.data() );
+      for( unsigned ii = 0; ii < n_idxs; ++ii )
+         REQUIRE( result[ii] == 10.0*idxs[ii] );
+   }
+
+   read_cache_stats_t stats;
+   read_cache_stats( &rc, &stats );
+   double remote = stats.n_lookups - stats.n_local;
+   double served = stats.n_hits + stats.n_misses;
+   REQUIRE( served == remote );
+   if( n_ranks > 1 )
+   {
+      REQUIRE( stats.n_hits >= remote/2 );
+      REQUIRE( stats.bytes_saved > 0.0 );
+   }
+
+   // A tiny cache evicts, but reads stay correct.
+   read_cache_free( &rc );
+   read_cache_init( &rc, n_elems, data.data(), MPI_DOUBLE, 4, 2, MPI_COMM_WORLD );
+   for( unsigned pass = 0; pass < 3; ++pass )
+   {
+      read_cache_get( &rc, n_idxs, idxs.data(), result.data() );
+      for( unsigned ii = 0; ii < n_idxs; ++ii )
+         REQUIRE( result[ii] == 10.0*idxs[ii] );
+      if( pass == 1 )
+         read_cache_clear( &rc );
+   }
+
+   // Ranks with nothing to read still take part.
+   read_cache_get( &rc, rank%2 ? 0 : 1, idxs.data(), result.data() );
+   REQUIRE( result[0] == 10.0*idxs[0] );
+   read_cache_free( &rc );
+}
+
+int
+main( int argc,
+      char** argv )
+{
+   MPI_Init( &argc, &argv );
+   int result = Catch::Session().run( argc, argv );
+   MPI_Finalize();
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,98 @@
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+#define CATCH_CONFIG_RUNNER
+#include "catch.hpp"
+#include "relabel.h"
+#include "permute.h"
+#include "utils.h"
+
+void
+check_relabel( unsigned n_elems,
+               std::vector<unsigned> const& idxs,
+               unsigned* n_after )
+{
+   int n_ranks, rank;
+   MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+   MPI_Comm_size( MPI_COMM_WORLD, &n_ranks );
+   unsigned n_local = local_size( n_elems, n_ranks, rank ), base;
+   MPI_Scan( &n_local, &base, 1, MPI_UNSIGNED, MPI_SUM, MPI_COMM_WORLD );
+   base -= n_local;
+
+   std::vector<unsigned> dests( n_local + 1 ), new_idxs( idxs.size() + 1 );
+   relabel_by_access( n_elems, idxs.size(), idxs.data(), dests.data(), new_idxs.data(), MPI_COMM_WORLD );
+
+   // Destinations form a permutation.
+   std::vector<int> seen( n_elems, 0 ), all_seen( n_elems );
+   for( unsigned ii = 0; ii < n_local; ++ii )
+   {
+      REQUIRE( dests[ii] < n_elems );
+      seen[dests[ii]] = 1;
+   }
+   MPI_Allreduce( seen.data(), all_seen.data(), n_elems, MPI_INT, MPI_SUM, MPI_COMM_WORLD );
+   for( unsigned ii = 0; ii < n_elems; ++ii )
+      REQUIRE( all_seen[ii] == 1 );
+
+   // After moving the data, the relabelled requests find it.
+   unsigned* data = (unsigned*)malloc( sizeof(unsigned)*(n_local + 1) );
+   for( unsigned ii = 0; ii < n_local; ++ii )
+      data[ii] = base + ii;
+   permute_push( n_elems, n_local, dests.data(), (void**)&data, MPI_UNSIGNED, MPI_COMM_WORLD );
+   void* recv_data;
+   scatter( n_elems, idxs.size(), new_idxs.data(), data, &recv_data, MPI_UNSIGNED, MPI_COMM_WORLD );
+   *n_after = 0;
+   for( unsigned ii = 0; ii < idxs.size(); ++ii )
+   {
+      REQUIRE( ((unsigned*)recv_data)[ii] == idxs[ii] );
+      if( new_idxs[ii] >= base && new_idxs[ii] < base + n_local )
+         ++*n_after;
+   }
+   free( recv_data );
+   free( data );
+}
+
+TEST_CASE( "Relabel strided requests to be local" )
+{
+   int n_ranks, rank;
+   MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+   MPI_Comm_size( MPI_COMM_WORLD, &n_ranks );
+
+   // Each rank reads every n_ranks'th element, so before
+   // relabelling nearly all reads are remote, and afterwards
+   // all of them are local.
+   unsigned n_elems = 20*n_ranks, n_after;
+   std::vector<unsigned> idxs;
+   for( unsigned ii = rank; ii < n_elems; ii += n_ranks )
+      idxs.push_back( ii );
+   check_relabel( n_elems, idxs, &n_after );
+   REQUIRE( n_after == idxs.size() );
+}
+
+TEST_CASE( "Relabel when one rank reads everything" )
+{
+   int n_ranks, rank;
+   MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+   MPI_Comm_size( MPI_COMM_WORLD, &n_ranks );
+
+   // Rank 0 can only take a block's worth; the rest overflow.
+   unsigned n_elems = 7*n_ranks + 2, n_after;
+   std::vector<unsigned> idxs;
+   if( rank == 0 )
+   {
+      for( unsigned ii = 0; ii < n_elems; ++ii )
+         idxs.push_back( (7*ii + 1)%n_elems );
+   }
+   check_relabel( n_elems, idxs, &n_after );
+   if( rank == 0 )
+      REQUIRE( n_after == local_size( n_elems, n_ranks, 0 ) );
+}
+
+int
+main( int argc,
+      char** argv )
+{
+   MPI_Init( &argc, &argv );
+   int result = Catch::Session().run( argc, argv );
+   MPI_Finalize();
+   return EXIT_SUCCESS;
+}
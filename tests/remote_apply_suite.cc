@@ -0,0 +1,104 @@
+#include <stdlib.h>
+#include <mpi.h>
+#define CATCH_CONFIG_RUNNER
+#include "catch.hpp"
+#include "remote_apply.h"
+#include "utils.h"
+
+void
+add( unsigned idx,
+     void* elem,
+     void const* args,
+     void* result,
+     void* ctx )
+{
+   *(double*)elem += *(double const*)args;
+   ++*(unsigned*)ctx;
+}
+
+void
+fetch_scaled( unsigned idx,
+              void* elem,
+              void const* args,
+              void* result,
+              void* ctx )
+{
+   *(double*)result = *(int const*)args*(*(double*)elem);
+}
+
+TEST_CASE( "Apply handlers at the owners of elements" )
+{
+   int n_ranks, rank;
+   MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+   MPI_Comm_size( MPI_COMM_WORLD, &n_ranks );
+
+   unsigned n_elems = 10*n_ranks + 3;
+   unsigned n_local = local_size( n_elems, n_ranks, rank ), base;
+   MPI_Scan( &n_local, &base, 1, MPI_UNSIGNED, MPI_SUM, MPI_COMM_WORLD );
+   base -= n_local;
+   std::vector<double> data( n_local, 0.0 );
+
+   remote_apply_t ra;
+   unsigned n_applied = 0;
+   remote_apply_init( &ra, n_elems, data.data(), MPI_DOUBLE, MPI_COMM_WORLD );
+   unsigned add_id = remote_apply_register( &ra, add, sizeof(double), 0, &n_applied );
+   unsigned fetch_id = remote_apply_register( &ra, fetch_scaled, sizeof(int), sizeof(double), NULL );
+
+   // Every rank adds rank + 1 to a spread of elements.
+   unsigned n_calls = 3*n_elems/2;
+   for( unsigned ii = 0; ii < n_calls; ++ii )
+   {
+      double inc = rank + 1;
+      remote_apply_add( &ra, add_id, (7*ii + rank)%n_elems, &inc, NULL );
+   }
+   remote_apply_execute( &ra );
+
+   std::vector<double> expected( n_elems, 0.0 );
+   for( int rr = 0; rr < n_ranks; ++rr )
+   {
+      for( unsigned ii = 0; ii < n_calls; ++ii )
+         expected[(7*ii + rr)%n_elems] += rr + 1;
+   }
+   for( unsigned ii = 0; ii < n_local; ++ii )
+      REQUIRE( data[ii] == expected[base + ii] );
+   unsigned total;
+   MPI_Allreduce( &n_applied, &total, 1, MPI_UNSIGNED, MPI_SUM, MPI_COMM_WORLD );
+   REQUIRE( total == n_calls*n_ranks );
+
+   // Results come back to their slots; calls without a result
+   // slot are still run.
+   std::vector<double> results( n_elems, -1.0 );
+   for( unsigned ii = 0; ii < n_elems; ++ii )
+   {
+      int scale = ii%3 + 1;
+      remote_apply_add( &ra, fetch_id, n_elems - 1 - ii, &scale, ii%4 ? results.data() + ii : NULL );
+   }
+   remote_apply_execute( &ra );
+   for( unsigned ii = 0; ii < n_elems; ++ii )
+   {
+      double want = ii%4 ? (ii%3 + 1)*expected[n_elems - 1 - ii] : -1.0;
+      REQUIRE( results[ii] == want );
+   }
+
+   // Ranks with nothing queued still take part.
+   if( rank == 0 )
+   {
+      double inc = 1.0;
+      remote_apply_add( &ra, add_id, n_elems - 1, &inc, NULL );
+   }
+   remote_apply_execute( &ra );
+   if( base + n_local == n_elems && n_local )
+      REQUIRE( data[n_local - 1] == expected[n_elems - 1] + 1.0 );
+
+   remote_apply_free( &ra );
+}
+
+int
+main( int argc,
+      char** argv )
+{
+   MPI_Init( &argc, &argv );
+   int result = Catch::Session().run( argc, argv );
+   MPI_Finalize();
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,80 @@
+#include <mpi.h>
+#define CATCH_CONFIG_RUNNER
+#include "catch.hpp"
+#include "transpose.h"
+#include "utils.h"
+
+TEST_CASE( "Transpose a local matrix" )
+{
+   // Larger than a tile in both directions, with ragged edges.
+   unsigned rows = TRANSPOSE_TILE + 5, cols = 2*TRANSPOSE_TILE + 3;
+   std::vector<double> src( rows*cols ), dst( rows*cols );
+   std::vector<char> csrc( 3*rows*cols ), cdst( 3*rows*cols );
+   for( unsigned ii = 0; ii < rows*cols; ++ii )
+   {
+      src[ii] = ii;
+      for( unsigned kk = 0; kk < 3; ++kk )
+         csrc[3*ii + kk] = (ii + kk)%128;
+   }
+   transpose_local( rows, cols, sizeof(double), src.data(), dst.data() );
+   transpose_local( rows, cols, 3, csrc.data(), cdst.data() );
+   for( unsigned rr = 0; rr < rows; ++rr )
+   {
+      for( unsigned cc = 0; cc < cols; ++cc )
+      {
+         REQUIRE( dst[cc*rows + rr] == src[rr*cols + cc] );
+         REQUIRE( cdst[3*(cc*rows + rr) + 2] == csrc[3*(rr*cols + cc) + 2] );
+      }
+   }
+}
+
+TEST_CASE( "Transpose a distributed matrix" )
+{
+   int n_ranks, rank;
+   MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+   MPI_Comm_size( MPI_COMM_WORLD, &n_ranks );
+
+   unsigned rows = 3*n_ranks + 1, cols = 2*n_ranks + 3;
+   unsigned n_rows = local_size( rows, n_ranks, rank ), n_cols = local_size( cols, n_ranks, rank );
+   unsigned row_base, col_base;
+   MPI_Scan( &n_rows, &row_base, 1, MPI_UNSIGNED, MPI_SUM, MPI_COMM_WORLD );
+   MPI_Scan( &n_cols, &col_base, 1, MPI_UNSIGNED, MPI_SUM, MPI_COMM_WORLD );
+   row_base -= n_rows;
+   col_base -= n_cols;
+
+   int* data = (int*)malloc( (n_rows*cols + 1)*sizeof(int) );
+   for( unsigned rr = 0; rr < n_rows; ++rr )
+   {
+      for( unsigned cc = 0; cc < cols; ++cc )
+         data[rr*cols + cc] = 1000*(row_base + rr) + cc;
+   }
+
+   int* result;
+   transpose( rows, cols, data, (void**)&result, MPI_INT, MPI_COMM_WORLD );
+   for( unsigned cc = 0; cc < n_cols; ++cc )
+   {
+      for( unsigned rr = 0; rr < rows; ++rr )
+      {
+         int expected = 1000*rr + col_base + cc;
+         REQUIRE( result[cc*rows + rr] == expected );
+      }
+   }
+
+   // Transposing back in place restores the original.
+   transpose_inplace( cols, rows, (void**)&result, MPI_INT, MPI_COMM_WORLD );
+   for( unsigned ii = 0; ii < n_rows*cols; ++ii )
+      REQUIRE( result[ii] == data[ii] );
+
+   free( data );
+   free( result );
+}
+
+int
+main( int argc,
+      char** argv )
+{
+   MPI_Init( &argc, &argv );
+   int result = Catch::Session().run( argc, argv );
+   MPI_Finalize();
+   return EXIT_SUCCESS;
+}